@@ -0,0 +1,116 @@
+// Autocomplete latency per keystroke on a generated C file with the given
+// number of functions (default 20000, about 5 MB).
+//
+// At sample points spread over the file an identifier is typed one byte
+// at a time, the way editorProcessKey does it: the byte goes into the
+// document, the tree is reparsed, and from the second byte on the scope
+// lookup autocomplete makes runs (syntaxCursorOnDeclaratorName and
+// syntaxCollectIdentifiersInScope), which should not grow with the file.
+
+#include "common.h"
+#include "document.h"
+#include "syntax.h"
+#include <stdio.h>
+#include <time.h>
+
+#define SAMPLES 200
+#define TYPED "total"
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// lines per generated function; typing happens on the blank line
+#define FUNC_LINES 9
+#define BLANK_LINE 6
+
+static char *generate(int funcs, size_t *len){
+    size_t cap = (size_t) funcs * 400 + 1;
+    char *buf = malloc(cap);
+    if (!buf) { perror("malloc"); exit(1); }
+    size_t n = 0;
+    for (int i = 0; i < funcs; i++) {
+        n += (size_t) snprintf(buf + n, cap - n,
+            "struct rec%d { int field_a%d; char *field_name%d; };\n"
+            "static int helper%d(int count%d, const char *name%d) {\n"
+            "    int total%d = count%d;\n"
+            "    for (int i = 0; i < count%d; i++) {\n"
+            "        total%d += name%d[i];\n"
+            "    }\n"
+            "\n"
+            "    return total%d;\n"
+            "}\n",
+            i, i, i, i, i, i, i, i, i, i, i, i);
+    }
+    *len = n;
+    return buf;
+}
+
+static int cmp_double(const void *a, const void *b){
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *t, int n){
+    qsort(t, (size_t) n, sizeof(double), cmp_double);
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += t[i];
+    printf("  %-10s mean %8.1f us  p50 %8.1f us  p99 %8.1f us  (%d keys)\n", name,
+           sum / n * 1e6, t[n / 2] * 1e6, t[n * 99 / 100] * 1e6, n);
+}
+
+int main(int argc, char **argv){
+    int funcs = argc > 1 ? atoi(argv[1]) : 20000;
+    if (funcs < SAMPLES) funcs = SAMPLES;
+
+    docInit(&E.doc);
+    if (syntaxInit("c", "tree-sitter-c/queries/highlights.scm") != 0) {
+        fprintf(stderr, "syntaxInit failed\n");
+        return 1;
+    }
+    size_t len;
+    char *text = generate(funcs, &len);
+    if (docLoadBuffer(&E.doc, text, len) != 0) { fprintf(stderr, "docLoadBuffer failed\n"); return 1; }
+    double t = now_s();
+    syntaxReparseFull();
+    printf("%d functions, %.1f MB, %d lines, full parse %.3f s\n", funcs, len / 1048576.0,
+           docNumRows(&E.doc), now_s() - t);
+
+    int typed = (int) strlen(TYPED);
+    static double reparse[SAMPLES * 8], complete[SAMPLES * 8], total[SAMPLES * 8];
+    int nkeys = 0, ncomplete = 0;
+    char out[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+    for (int s = 0; s < SAMPLES; s++) {
+        int row = (int) ((long) s * funcs / SAMPLES) * FUNC_LINES + BLANK_LINE;
+        int col = 0;
+        for (int k = 0; k < typed; k++) {
+            double t0 = now_s();
+            docRowInsert(&E.doc, row, col + k, TYPED + k, 1);
+            syntaxReparse();
+            double t1 = now_s();
+            if (k >= 1) {
+                char word[MAX_WORD_LENGTH];
+                memcpy(word, TYPED, (size_t) k + 1);
+                word[k + 1] = '\0';
+                if (!syntaxCursorOnDeclaratorName(row, col + k + 1)) {
+                    syntaxCollectIdentifiersInScope(word, row, col + k + 1, out);
+                }
+                complete[ncomplete++] = now_s() - t1;
+            }
+            reparse[nkeys] = t1 - t0;
+            total[nkeys++] = now_s() - t0;
+        }
+        docRowDelete(&E.doc, row, col, typed);
+        syntaxReparse();
+    }
+
+    report("reparse", reparse, nkeys);
+    report("complete", complete, ncomplete);
+    report("keystroke", total, nkeys);
+
+    syntaxFree();
+    docFree(&E.doc);
+    return 0;
+}
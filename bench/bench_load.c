@@ -0,0 +1,157 @@
+// Load throughput for generated files of the given sizes in MB (default
+// 100 and 1000), written to /tmp once and reused.
+//
+// "getline" is the old editorOpen loop: getline, trim, one malloc per row,
+// then docAppendRows.
+// "read+index" reads the file into one buffer and builds the document over
+// it with docLoadBuffer. The scan rows time lineScan alone on a buffer that
+// is already in memory.
+
+#include "common.h"
+#include "document.h"
+#include "lineindex.h"
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void generate(const char *path, size_t bytes){
+    struct stat st;
+    if (stat(path, &st) == 0 && (size_t) st.st_size >= bytes) return;
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) { perror(path); exit(1); }
+    static const char words[] = "static int return while for struct char void size_t if else ";
+    unsigned int seed = 12345;
+    size_t written = 0;
+    char line[256];
+    while (written < bytes) {
+        seed = seed * 1103515245u + 12345u;
+        int len = (int) ((seed >> 16) % 120);
+        for (int i = 0; i < len; i++) line[i] = words[(seed + (unsigned) i * 7) % (sizeof(words) - 1)];
+        // a few CRLF lines to exercise the trimming
+        if ((seed >> 8) % 16 == 0) line[len++] = '\r';
+        line[len++] = '\n';
+        fwrite(line, 1, len, fp);
+        written += (size_t) len;
+    }
+    fclose(fp);
+}
+
+static size_t load_getline(const char *path){
+    FILE *fp = fopen(path, "r");
+    if (!fp) { perror(path); exit(1); }
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    erow *rows = NULL;
+    int nrows = 0, rowcap = 0;
+
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+            linelen--;
+        if (nrows == rowcap) {
+            rowcap = rowcap ? rowcap * 2 : 1024;
+            rows = realloc(rows, sizeof(erow) * rowcap);
+        }
+        rows[nrows].size = linelen;
+        rows[nrows].chars = malloc(linelen + 1);
+        memcpy(rows[nrows].chars, line, linelen);
+        rows[nrows].chars[linelen] = '\0';
+        nrows++;
+    }
+    free(line);
+    fclose(fp);
+
+    Document d;
+    docInit(&d);
+    if (docAppendRows(&d, rows, nrows) != 0) { fprintf(stderr, "docAppendRows failed\n"); exit(1); }
+    free(rows);
+    docFree(&d);
+    return (size_t) nrows;
+}
+
+static char *read_all(const char *path, size_t *len){
+    FILE *fp = fopen(path, "r");
+    if (!fp) { perror(path); exit(1); }
+    struct stat st;
+    fstat(fileno(fp), &st);
+    char *buf = malloc((size_t) st.st_size);
+    if (!buf) { perror("malloc"); exit(1); }
+    *len = fread(buf, 1, (size_t) st.st_size, fp);
+    fclose(fp);
+    return buf;
+}
+
+static size_t load_indexed(const char *path){
+    size_t len;
+    char *buf = read_all(path, &len);
+    Document d;
+    docInit(&d);
+    if (docLoadBuffer(&d, buf, len) != 0) { fprintf(stderr, "docLoadBuffer failed\n"); exit(1); }
+    size_t rows = (size_t) docNumRows(&d);
+    docFree(&d);
+    return rows;
+}
+
+static size_t scan_all(size_t (*scan)(const char *, size_t, size_t *, size_t),
+                       const char *buf, size_t len){
+    static size_t ends[4096];
+    size_t total = 0, start = 0;
+    for (;;) {
+        size_t n = scan(buf + start, len - start, ends, 4096);
+        total += n;
+        if (n < 4096) break;
+        start += ends[n - 1] + 1;
+    }
+    return total;
+}
+
+static void report(const char *name, double mb, double secs, size_t lines){
+    printf("  %-12s %9.1f MB/s  %10zu lines  %8.3f s\n", name, mb / secs, lines, secs);
+}
+
+int main(int argc, char **argv){
+    static const char *defaults[] = { "100", "1000" };
+    const char **sizes = argc > 1 ? (const char **) argv + 1 : defaults;
+    int nsizes = argc > 1 ? argc - 1 : 2;
+
+    printf("lineScan uses %s\n", lineScanImpl());
+    for (int s = 0; s < nsizes; s++) {
+        size_t mb = strtoul(sizes[s], NULL, 10);
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/textedit_bench_%zuMB.txt", mb);
+        generate(path, mb << 20);
+        printf("%zu MB (%s)\n", mb, path);
+
+        size_t len;
+        char *buf = read_all(path, &len); // also warms the page cache
+        double size_mb = len / 1048576.0;
+
+        double t = now_s();
+        size_t lines = load_getline(path);
+        report("getline", size_mb, now_s() - t, lines);
+
+        t = now_s();
+        lines = load_indexed(path);
+        report("read+index", size_mb, now_s() - t, lines);
+
+        struct { const char *name; size_t (*fn)(const char *, size_t, size_t *, size_t); } scans[] = {
+            { "scan scalar", lineScanScalar },
+            { "scan sse2", lineScanSSE2 },
+            { "scan avx2", lineScanAVX2 },
+        };
+        for (int i = 0; i < 3; i++) {
+            t = now_s();
+            lines = scan_all(scans[i].fn, buf, len);
+            report(scans[i].name, size_mb, now_s() - t, lines);
+        }
+        free(buf);
+    }
+    return 0;
+}
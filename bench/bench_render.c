@@ -0,0 +1,137 @@
+// Counts allocations and time per rendered frame.
+//
+// "legacy" replays the old append buffer: a fresh abuf per frame and one
+// realloc per appended fragment. "arena" is the current buffer, kept across
+// frames. abAppend* and the allocator are intercepted with ld --wrap (see
+// the bench target in the Makefile), so screen.c runs unchanged in both.
+
+#include "common.h"
+#include "buffer.h"
+#include "screen.h"
+#include <stdio.h>
+#include <time.h>
+
+#define ROWS 50
+#define COLS 200
+#define FRAMES 2000
+
+static long g_allocs = 0;
+static bool g_legacy = false;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_abAppend(struct abuf *ab, const char *s, int len);
+void __real_abAppendChar(struct abuf *ab, char c);
+void __real_abAppendInt(struct abuf *ab, int v);
+void __real_abAppendSGR(struct abuf *ab, int code);
+
+void *__wrap_malloc(size_t size){
+    g_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_realloc(void *p, size_t size){
+    g_allocs++;
+    return __real_realloc(p, size);
+}
+
+// the append buffer as it was: grow by exactly len on every call
+static void legacy_append(struct abuf *ab, const char *s, int len){
+    char *new = realloc(ab->b, ab->len + len);
+
+    if (new == NULL) return;
+    memcpy(&new[ab->len], s, len);
+    ab->b = new;
+    ab->len += len;
+}
+
+void __wrap_abAppend(struct abuf *ab, const char *s, int len){
+    if (g_legacy) legacy_append(ab, s, len);
+    else __real_abAppend(ab, s, len);
+}
+
+void __wrap_abAppendChar(struct abuf *ab, char c){
+    if (g_legacy) legacy_append(ab, &c, 1);
+    else __real_abAppendChar(ab, c);
+}
+
+void __wrap_abAppendInt(struct abuf *ab, int v){
+    if (g_legacy) {
+        char buf[16];
+        legacy_append(ab, buf, snprintf(buf, sizeof(buf), "%d", v));
+    } else {
+        __real_abAppendInt(ab, v);
+    }
+}
+
+void __wrap_abAppendSGR(struct abuf *ab, int code){
+    if (g_legacy) {
+        char buf[16];
+        legacy_append(ab, buf, snprintf(buf, sizeof(buf), "\x1b[%dm", code));
+    } else {
+        __real_abAppendSGR(ab, code);
+    }
+}
+
+static const int k_colors[] = { 39, 31, 32, 33, 34, 35, 36, -208 };
+
+// a screen of short colored tokens, shifted by frame so every frame differs
+static void draw_frame(int frame){
+    static const char text[] = "int main(void) { return parse(argv[1], 42); } // ";
+    screenClear();
+    for (int r = 0; r < ROWS - 1; r++){
+        int col = 0;
+        int t = r + frame;
+        while (col < COLS - (r % 17)) {
+            int len = 3 + (t % 7);
+            const char *s = &text[t % (sizeof(text) - 10)];
+            col += screenPut(r, col, s, len, k_colors[t % 8], SCREEN_BG_DEFAULT, 0);
+            col += screenPut(r, col, " ", 1, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, 0);
+            t++;
+        }
+    }
+    screenFill(ROWS - 1, 0, COLS, ' ', SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, SCREEN_ATTR_REVERSE);
+    screenPut(ROWS - 1, 0, "L1 bench.c - 1000 lines", 23, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, SCREEN_ATTR_REVERSE);
+}
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, bool legacy){
+    struct abuf frame = ABUF_INIT;
+    long bytes = 0;
+    g_legacy = legacy;
+
+    screenResize(ROWS, COLS);
+    g_allocs = 0;
+    double start = now_ns();
+    for (int i = 0; i < FRAMES; i++){
+        draw_frame(i);
+        screenInvalidate(); // full repaint, like every frame used to be
+        if (legacy) {
+            struct abuf ab = { NULL, 0, 0 };
+            screenFlush(&ab, 0, 0);
+            bytes += ab.len;
+            free(ab.b);
+        } else {
+            abReset(&frame);
+            screenFlush(&frame, 0, 0);
+            bytes += frame.len;
+        }
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%-8s %10.1f allocs/frame %10ld bytes/frame %10.0f ns/frame\n", name,
+           (double) g_allocs / FRAMES, bytes / FRAMES, elapsed / FRAMES);
+    abFree(&frame);
+    screenFree();
+}
+
+int main(void){
+    run("legacy", true);
+    run("arena", false);
+    return 0;
+}
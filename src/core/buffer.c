@@ -2,15 +2,57 @@
 
 /*** append buffer functions ***/
 
-void abAppend(struct abuf *ab, const char *s, int len){
-    char *new = realloc(ab->b, ab->len + len);
+// make room for len more bytes, returns 0 on success
+static int ab_reserve(struct abuf *ab, int len){
+    if (ab->len + len <= ab->cap) return 0;
+
+    int cap = ab->cap ? ab->cap : 256;
+    while (cap < ab->len + len) cap *= 2;
 
-    if (new == NULL) return;
-    memcpy(&new[ab->len], s, len);
+    char *new = realloc(ab->b, cap);
+    if (new == NULL) return -1;
     ab->b = new;
+    ab->cap = cap;
+    return 0;
+}
+
+void abAppend(struct abuf *ab, const char *s, int len){
+    if (len <= 0 || ab_reserve(ab, len) != 0) return;
+    memcpy(&ab->b[ab->len], s, len);
     ab->len += len;
 }
 
+void abAppendChar(struct abuf *ab, char c){
+    if (ab_reserve(ab, 1) != 0) return;
+    ab->b[ab->len++] = c;
+}
+
+void abAppendInt(struct abuf *ab, int v){
+    char tmp[12];
+    int n = 0;
+    unsigned u = v < 0 ? 0u - (unsigned) v : (unsigned) v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+    if (v < 0) tmp[n++] = '-';
+
+    if (ab_reserve(ab, n) != 0) return;
+    while (n > 0) ab->b[ab->len++] = tmp[--n];
+}
+
+void abAppendSGR(struct abuf *ab, int code){
+    abAppend(ab, "\x1b[", 2);
+    abAppendInt(ab, code);
+    abAppendChar(ab, 'm');
+}
+
+void abReset(struct abuf *ab){
+    ab->len = 0;
+}
+
 void abFree(struct abuf *ab){
     free(ab->b);
+    ab->b = NULL;
+    ab->len = ab->cap = 0;
 }
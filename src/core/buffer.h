@@ -4,14 +4,22 @@
 #include "common.h"
 
 /*** append buffer ***/
+// Capacity grows geometrically, so appends are amortized O(1). A buffer
+// can be reused across frames with abReset, which keeps its memory.
 struct abuf {
     char *b;
     int len;
+    int cap;
 };
 
-#define ABUF_INIT { NULL, 0 }
+#define ABUF_INIT { NULL, 0, 0 }
 
 void abAppend(struct abuf *ab, const char *s, int len);
+void abAppendChar(struct abuf *ab, char c);
+void abAppendInt(struct abuf *ab, int v);
+// "\x1b[<code>m"
+void abAppendSGR(struct abuf *ab, int code);
+void abReset(struct abuf *ab);
 void abFree(struct abuf *ab);
 
 #endif
@@ -0,0 +1,847 @@
+#include "document.h"
+#include "lineindex.h"
+#include <limits.h>
+#include <sys/mman.h>
+
+#define DOC_SLAB_NODES 1024
+
+struct DocNode {
+    DocNode *left, *right;
+    unsigned int prio;
+    int count;      // rows in this subtree
+    size_t bytes;   // bytes in this subtree, every row counted with its '\n'
+    erow row;
+};
+
+struct DocSlab {
+    DocSlab *next;
+    DocNode nodes[DOC_SLAB_NODES];
+};
+
+/*** node allocation ***/
+
+static unsigned int next_prio(Document *d) {
+    // xorshift32, only needs to be cheap and well spread
+    unsigned int x = d->seed ? d->seed : 2463534242u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    d->seed = x;
+    return x;
+}
+
+static DocNode *node_new(Document *d, char *chars, int size) {
+    DocNode *n = d->free_nodes;
+    if (n) {
+        d->free_nodes = n->left;
+    } else {
+        if (!d->slabs || d->slab_used == DOC_SLAB_NODES) {
+            DocSlab *s = malloc(sizeof(DocSlab));
+            if (!s) return NULL;
+            s->next = d->slabs;
+            d->slabs = s;
+            d->slab_used = 0;
+        }
+        n = &d->slabs->nodes[d->slab_used++];
+    }
+    n->left = n->right = NULL;
+    n->prio = next_prio(d);
+    n->count = 1;
+    n->bytes = (size_t)size + 1;
+    n->row.size = size;
+    n->row.mapped = false;
+    n->row.frozen = false;
+    n->row.chars = chars;
+    return n;
+}
+
+// free row text, or keep it for a snapshot that may still be reading it
+static void release_chars(Document *d, erow *r) {
+    if (r->mapped) return;
+    if (r->frozen && d->snapshots > 0) {
+        if (d->nretired == d->retired_cap) {
+            int cap = d->retired_cap ? d->retired_cap * 2 : 64;
+            char **grown = realloc(d->retired, sizeof(char *) * (size_t)cap);
+            // with nowhere to park it, leaking the text beats freeing it
+            // under the reader
+            if (!grown) return;
+            d->retired = grown;
+            d->retired_cap = cap;
+        }
+        d->retired[d->nretired++] = r->chars;
+        return;
+    }
+    free(r->chars);
+}
+
+static void node_release(Document *d, DocNode *n) {
+    release_chars(d, &n->row);
+    n->row.chars = NULL;
+    n->left = d->free_nodes;
+    d->free_nodes = n;
+}
+
+static void subtree_release(Document *d, DocNode *t) {
+    if (!t) return;
+    subtree_release(d, t->left);
+    subtree_release(d, t->right);
+    node_release(d, t);
+}
+
+// like subtree_release, but the row chars stay with the caller
+static void subtree_discard(Document *d, DocNode *t) {
+    if (!t) return;
+    subtree_discard(d, t->left);
+    subtree_discard(d, t->right);
+    t->row.chars = NULL;
+    node_release(d, t);
+}
+
+/*** treap primitives ***/
+
+static int node_count(const DocNode *t) { return t ? t->count : 0; }
+static size_t node_bytes(const DocNode *t) { return t ? t->bytes : 0; }
+
+static void pull(DocNode *t) {
+    t->count = 1 + node_count(t->left) + node_count(t->right);
+    t->bytes = (size_t)t->row.size + 1 + node_bytes(t->left) + node_bytes(t->right);
+}
+
+// first k rows of t go to *l, the rest to *r
+static void split(DocNode *t, int k, DocNode **l, DocNode **r) {
+    if (!t) { *l = *r = NULL; return; }
+    int lc = node_count(t->left);
+    if (k <= lc) {
+        split(t->left, k, l, &t->left);
+        pull(t);
+        *r = t;
+    } else {
+        split(t->right, k - lc - 1, &t->right, r);
+        pull(t);
+        *l = t;
+    }
+}
+
+static DocNode *merge(DocNode *l, DocNode *r) {
+    if (!l) return r;
+    if (!r) return l;
+    if (l->prio > r->prio) {
+        l->right = merge(l->right, r);
+        pull(l);
+        return l;
+    }
+    r->left = merge(l, r->left);
+    pull(r);
+    return r;
+}
+
+static void pull_all(DocNode *t) {
+    if (!t) return;
+    pull_all(t->left);
+    pull_all(t->right);
+    pull(t);
+}
+
+// push node onto the right spine of a treap being built left to right
+static void spine_push(DocNode **stack, int *sp, DocNode *node) {
+    DocNode *last = NULL;
+    while (*sp > 0 && stack[*sp - 1]->prio < node->prio) last = stack[--*sp];
+    node->left = last;
+    if (*sp > 0) stack[*sp - 1]->right = node;
+    stack[(*sp)++] = node;
+}
+
+static DocNode *find_node(const Document *d, int at) {
+    DocNode *t = d->root;
+    while (t) {
+        int lc = node_count(t->left);
+        if (at < lc) {
+            t = t->left;
+        } else if (at == lc) {
+            return t;
+        } else {
+            at -= lc + 1;
+            t = t->right;
+        }
+    }
+    return NULL;
+}
+
+// add delta to the cached byte length of every node on the path to row at
+static void adjust_bytes(Document *d, int at, long delta) {
+    DocNode *t = d->root;
+    while (t) {
+        t->bytes = (size_t)((long)t->bytes + delta);
+        int lc = node_count(t->left);
+        if (at < lc) {
+            t = t->left;
+        } else if (at == lc) {
+            return;
+        } else {
+            at -= lc + 1;
+            t = t->right;
+        }
+    }
+}
+
+// build a treap from rows in O(n) using the right spine as a stack
+static DocNode *build(Document *d, const erow *rows, int n) {
+    if (n <= 0) return NULL;
+    DocNode **stack = malloc(sizeof(DocNode *) * (size_t)n);
+    if (!stack) return NULL;
+
+    int sp = 0;
+    for (int i = 0; i < n; i++) {
+        DocNode *node = node_new(d, rows[i].chars, rows[i].size);
+        if (!node) {
+            if (sp > 0) subtree_discard(d, stack[0]);
+            free(stack);
+            return NULL;
+        }
+        spine_push(stack, &sp, node);
+    }
+
+    DocNode *root = stack[0];
+    free(stack);
+    pull_all(root);
+    return root;
+}
+
+static char *dup_bytes(const char *s, int len) {
+    char *p = malloc((size_t)len + 1);
+    if (!p) return NULL;
+    if (len > 0) memcpy(p, s, (size_t)len);
+    p[len] = '\0';
+    return p;
+}
+
+// give a row its own copy of the text before it is modified, if it is
+// borrowed from the backing text or shared with a snapshot
+static int materialize(Document *d, erow *r) {
+    if (!r->mapped && !(r->frozen && d->snapshots > 0)) {
+        r->frozen = false;
+        return 0;
+    }
+
+    char *chars = dup_bytes(r->chars, r->size);
+    if (!chars) return -1;
+    release_chars(d, r);
+    r->chars = chars;
+    r->mapped = false;
+    r->frozen = false;
+    return 0;
+}
+
+typedef struct {
+    DocNode **stack; // right spine of the treap so far
+    int sp, cap;
+} SpineBuilder;
+
+static int spine_add_line(Document *d, SpineBuilder *sb, char *p, size_t size) {
+    if (size > 0 && p[size - 1] == '\r') size--;
+    if (size > INT_MAX) return -1;
+
+    if (sb->sp == sb->cap) {
+        int cap = sb->cap ? sb->cap * 2 : 64;
+        DocNode **grown = realloc(sb->stack, sizeof(DocNode *) * (size_t)cap);
+        if (!grown) return -1;
+        sb->stack = grown;
+        sb->cap = cap;
+    }
+
+    DocNode *node = node_new(d, p, (int)size);
+    if (!node) return -1;
+    node->row.mapped = true;
+    spine_push(sb->stack, &sb->sp, node);
+    return 0;
+}
+
+// build rows over the lines of data in one pass, taking line ends from
+// lineScan a table at a time. The right spine is O(log n) deep on
+// average, so its stack grows on demand.
+static DocNode *build_borrowed(Document *d, char *data, size_t len) {
+    SpineBuilder sb = { NULL, 0, 0 };
+    size_t ends[1024];
+    size_t start = 0;
+
+    while (start < len) {
+        size_t n = lineScan(data + start, len - start, ends, 1024);
+        size_t line = 0;
+        for (size_t k = 0; k < n; k++) {
+            if (spine_add_line(d, &sb, data + start + line, ends[k] - line) != 0) goto fail;
+            line = ends[k] + 1;
+        }
+        if (n < 1024) {
+            // no more line ends, the rest is an unterminated last line
+            if (start + line < len &&
+                spine_add_line(d, &sb, data + start + line, len - start - line) != 0) goto fail;
+            break;
+        }
+        start += line;
+    }
+
+    DocNode *root = sb.sp > 0 ? sb.stack[0] : NULL;
+    free(sb.stack);
+    pull_all(root);
+    return root;
+
+fail:
+    if (sb.sp > 0) subtree_release(d, sb.stack[0]);
+    free(sb.stack);
+    return NULL;
+}
+
+/*** public api ***/
+
+void docInit(Document *d) {
+    d->root = NULL;
+    d->free_nodes = NULL;
+    d->slabs = NULL;
+    d->slab_used = 0;
+    d->seed = 0;
+    d->on_edit = NULL;
+    d->edit_ctx = NULL;
+    d->batch = 0;
+    d->batch_edit = false;
+    d->map = NULL;
+    d->map_len = 0;
+    d->map_heap = false;
+    d->snapshots = 0;
+    d->retired = NULL;
+    d->nretired = d->retired_cap = 0;
+}
+
+void docFree(Document *d) {
+    subtree_release(d, d->root);
+    while (d->slabs) {
+        DocSlab *next = d->slabs->next;
+        free(d->slabs);
+        d->slabs = next;
+    }
+    d->root = NULL;
+    d->free_nodes = NULL;
+    d->slab_used = 0;
+    if (d->map && d->map_heap) free(d->map);
+    else if (d->map) munmap(d->map, d->map_len);
+    d->map = NULL;
+    d->map_len = 0;
+    d->map_heap = false;
+    for (int k = 0; k < d->nretired; k++) free(d->retired[k]);
+    free(d->retired);
+    d->retired = NULL;
+    d->nretired = d->retired_cap = 0;
+    d->snapshots = 0;
+}
+
+void docSetEditListener(Document *d, DocEditListener fn, void *ctx) {
+    d->on_edit = fn;
+    d->edit_ctx = ctx;
+}
+
+void docBeginBatch(Document *d) {
+    d->batch++;
+}
+
+void docEndBatch(Document *d) {
+    if (d->batch == 0 || --d->batch > 0 || !d->batch_edit) return;
+    d->batch_edit = false;
+    if (d->on_edit) d->on_edit(&d->batched, d->edit_ctx);
+}
+
+int docNumRows(const Document *d) {
+    return node_count(d->root);
+}
+
+size_t docLength(const Document *d) {
+    return d->root ? d->root->bytes - 1 : 0;
+}
+
+erow *docRow(const Document *d, int at) {
+    DocNode *n = find_node(d, at);
+    return n ? &n->row : NULL;
+}
+
+static int collect_rows(DocNode *t, int first, int last, erow **out) {
+    if (!t || first >= last) return 0;
+    int n = 0;
+    int lc = node_count(t->left);
+    if (first < lc) n += collect_rows(t->left, first, last < lc ? last : lc, out);
+    if (first <= lc && lc < last) out[n++] = &t->row;
+    if (last > lc + 1) {
+        int rfirst = first > lc + 1 ? first - lc - 1 : 0;
+        n += collect_rows(t->right, rfirst, last - lc - 1, out + n);
+    }
+    return n;
+}
+
+int docRows(const Document *d, int first, int count, erow **out) {
+    if (first < 0) { count += first; first = 0; }
+    if (count <= 0) return 0;
+    return collect_rows(d->root, first, first + count, out);
+}
+
+size_t docRowOffset(const Document *d, int row) {
+    size_t offset = 0;
+    DocNode *t = d->root;
+    if (row >= node_count(t)) return docLength(d);
+    while (t) {
+        int lc = node_count(t->left);
+        if (row < lc) {
+            t = t->left;
+        } else if (row == lc) {
+            return offset + node_bytes(t->left);
+        } else {
+            offset += node_bytes(t->left) + (size_t)t->row.size + 1;
+            row -= lc + 1;
+            t = t->right;
+        }
+    }
+    return offset;
+}
+
+int docRowAtByte(const Document *d, size_t byte, int *col) {
+    DocNode *t = d->root;
+    int base = 0;
+    if (!t) { if (col) *col = 0; return 0; }
+
+    if (byte > docLength(d)) byte = docLength(d);
+    while (t) {
+        size_t lb = node_bytes(t->left);
+        if (byte < lb) {
+            t = t->left;
+            continue;
+        }
+        byte -= lb;
+        if (byte <= (size_t)t->row.size) {
+            if (col) *col = (int)byte;
+            return base + node_count(t->left);
+        }
+        byte -= (size_t)t->row.size + 1;
+        base += node_count(t->left) + 1;
+        t = t->right;
+    }
+    // unreachable for byte <= docLength
+    if (col) *col = 0;
+    return base > 0 ? base - 1 : 0;
+}
+
+// fold e, made after the edits in c, into c: the result replaces the text
+// c started from with the text after e
+static void merge_edit(DocEdit *c, const DocEdit *e) {
+    // nothing before either start has moved
+    if (e->start_byte < c->start_byte) {
+        c->start_byte = e->start_byte;
+        c->start_row = e->start_row;
+        c->start_col = e->start_col;
+    }
+    // the changed range so far ends at c's new end, or at e's old end if
+    // that is further; past c's new end, text is c's old text shifted
+    size_t end_byte = c->new_end_byte;
+    int end_row = c->new_end_row, end_col = c->new_end_col;
+    if (e->old_end_byte > end_byte) {
+        c->old_end_byte += e->old_end_byte - end_byte;
+        c->old_end_col = e->old_end_row == end_row ? c->old_end_col + e->old_end_col - end_col
+                                                   : e->old_end_col;
+        c->old_end_row += e->old_end_row - end_row;
+        end_byte = e->old_end_byte;
+        end_row = e->old_end_row;
+        end_col = e->old_end_col;
+    }
+    // and e moves that end along with everything after its old end
+    c->new_end_byte = end_byte - e->old_end_byte + e->new_end_byte;
+    c->new_end_col = end_row == e->old_end_row ? end_col - e->old_end_col + e->new_end_col : end_col;
+    c->new_end_row = end_row - e->old_end_row + e->new_end_row;
+}
+
+static void notify(Document *d, DocEdit *e) {
+    if (!d->on_edit) return;
+    if (d->batch == 0) {
+        d->on_edit(e, d->edit_ctx);
+    } else if (!d->batch_edit) {
+        d->batched = *e;
+        d->batch_edit = true;
+    } else {
+        merge_edit(&d->batched, e);
+    }
+}
+
+// fill in an edit that replaced the text between (row, col) and
+// (old_row, old_col) with text ending at (new_row, new_col)
+static void edit_at(const Document *d, DocEdit *e, int row, int col,
+                    int old_row, int old_col, int new_row, int new_col)
+{
+    e->start_byte = docRowOffset(d, row) + (size_t)col;
+    e->start_row = row;
+    e->start_col = col;
+    e->old_end_row = old_row;
+    e->old_end_col = old_col;
+    e->new_end_row = new_row;
+    e->new_end_col = new_col;
+    e->old_end_byte = e->start_byte;
+    e->new_end_byte = e->start_byte;
+}
+
+// make row hold its first col bytes followed by s[0..len)
+static int replace_tail(Document *d, int row, erow *r, int col, const char *s, int len) {
+    if (materialize(d, r) != 0) return -1;
+    char *chars = realloc(r->chars, (size_t)col + (size_t)len + 1);
+    if (!chars) return -1;
+    r->chars = chars;
+    memcpy(&r->chars[col], s, (size_t)len);
+    r->chars[col + len] = '\0';
+    adjust_bytes(d, row, (long)(col + len) - r->size);
+    r->size = col + len;
+    return 0;
+}
+
+static int insert_rows(Document *d, int at, const erow *rows, int n) {
+    DocNode *chunk = build(d, rows, n);
+    if (!chunk) return -1;
+
+    DocNode *a, *b;
+    split(d->root, at, &a, &b);
+    d->root = merge(merge(a, chunk), b);
+    return 0;
+}
+
+// describe inserting n rows holding bytes bytes (each row counted with a
+// '\n') at row at, the last of them last_size long
+static void insert_edit(const Document *d, DocEdit *e, int at, int n,
+                        size_t bytes, int last_size)
+{
+    int numrows = docNumRows(d);
+    if (numrows == 0) {
+        // nothing to attach to, the rows become the whole text
+        edit_at(d, e, 0, 0, 0, 0, n - 1, last_size);
+        bytes--;
+    } else if (at < numrows) {
+        edit_at(d, e, at, 0, at, 0, at + n, 0);
+    } else {
+        // appended rows hang off the '\n' after the current last row
+        int last = docRow(d, at - 1)->size;
+        edit_at(d, e, at - 1, last, at - 1, last, at + n - 1, last_size);
+    }
+    e->new_end_byte = e->start_byte + bytes;
+}
+
+int docInsertRows(Document *d, int at, const erow *rows, int n) {
+    if (n <= 0) return 0;
+    int numrows = docNumRows(d);
+    if (at < 0) at = 0;
+    if (at > numrows) at = numrows;
+
+    DocEdit e;
+    if (d->on_edit) {
+        size_t bytes = 0;
+        for (int i = 0; i < n; i++) bytes += (size_t)rows[i].size + 1;
+        insert_edit(d, &e, at, n, bytes, rows[n - 1].size);
+    }
+
+    if (insert_rows(d, at, rows, n) != 0) return -1;
+    if (d->on_edit) notify(d, &e);
+    return 0;
+}
+
+int docAppendRows(Document *d, const erow *rows, int n) {
+    return docInsertRows(d, docNumRows(d), rows, n);
+}
+
+int docSetBacking(Document *d, char *text, size_t len, bool heap) {
+    if (d->map) return -1;
+    d->map = text;
+    d->map_len = len;
+    d->map_heap = heap;
+    return 0;
+}
+
+// append rows for a chunk of nodes built by this document's allocator
+static void append_chunk(Document *d, DocNode *chunk) {
+    DocEdit e;
+    if (d->on_edit) {
+        DocNode *last = chunk;
+        while (last->right) last = last->right;
+        insert_edit(d, &e, docNumRows(d), chunk->count, chunk->bytes, last->row.size);
+    }
+    d->root = merge(d->root, chunk);
+    if (d->on_edit) notify(d, &e);
+}
+
+int docAppendBorrowed(Document *d, char *text, size_t len) {
+    DocNode *chunk = build_borrowed(d, text, len);
+    if (!chunk) return len > 0 ? -1 : 0;
+    append_chunk(d, chunk);
+    return 0;
+}
+
+void docAppendDocument(Document *d, Document *src) {
+    DocNode *chunk = src->root;
+    src->root = NULL;
+
+    // the nodes stay where they are, d takes over the slabs holding them
+    if (src->slabs) {
+        DocSlab *tail = src->slabs;
+        while (tail->next) tail = tail->next;
+        if (d->slabs) {
+            tail->next = d->slabs->next;
+            d->slabs->next = src->slabs;
+        } else {
+            d->slabs = src->slabs;
+            d->slab_used = src->slab_used;
+        }
+        src->slabs = NULL;
+    }
+    if (src->free_nodes) {
+        DocNode *tail = src->free_nodes;
+        while (tail->left) tail = tail->left;
+        tail->left = d->free_nodes;
+        d->free_nodes = src->free_nodes;
+        src->free_nodes = NULL;
+    }
+    docFree(src);
+
+    if (chunk) append_chunk(d, chunk);
+}
+
+static void snapshot_rows(DocNode *t, erow *out, int *n) {
+    while (t) {
+        snapshot_rows(t->left, out, n);
+        t->row.frozen = true;
+        out[(*n)++] = t->row;
+        t = t->right;
+    }
+}
+
+int docSnapshot(Document *d, DocSnapshot *s) {
+    s->count = docNumRows(d);
+    s->rows = malloc(sizeof(erow) * (size_t)(s->count ? s->count : 1));
+    if (!s->rows) return -1;
+    int n = 0;
+    snapshot_rows(d->root, s->rows, &n);
+    d->snapshots++;
+    return 0;
+}
+
+void docReleaseSnapshot(Document *d, DocSnapshot *s) {
+    free(s->rows);
+    s->rows = NULL;
+    s->count = 0;
+    if (d->snapshots > 0 && --d->snapshots == 0) {
+        for (int k = 0; k < d->nretired; k++) free(d->retired[k]);
+        d->nretired = 0;
+    }
+}
+
+int docLoadMapped(Document *d, char *map, size_t len) {
+    if (d->root || docSetBacking(d, map, len, false) != 0) return -1;
+    return docAppendBorrowed(d, map, len);
+}
+
+int docLoadBuffer(Document *d, char *buf, size_t len) {
+    if (d->root || docSetBacking(d, buf, len, true) != 0) return -1;
+    return docAppendBorrowed(d, buf, len);
+}
+
+int docInsertRow(Document *d, int at, const char *s, int len) {
+    erow row;
+    row.size = len;
+    row.chars = dup_bytes(s, len);
+    if (!row.chars) return -1;
+    if (docInsertRows(d, at, &row, 1) != 0) {
+        free(row.chars);
+        return -1;
+    }
+    return 0;
+}
+
+int docDeleteRow(Document *d, int at) {
+    int numrows = docNumRows(d);
+    if (at < 0 || at >= numrows) return -1;
+
+    DocEdit e;
+    if (d->on_edit) {
+        int size = docRow(d, at)->size;
+        if (numrows == 1) {
+            edit_at(d, &e, 0, 0, 0, size, 0, 0);
+            e.old_end_byte += (size_t)size;
+        } else if (at < numrows - 1) {
+            edit_at(d, &e, at, 0, at + 1, 0, at, 0);
+            e.old_end_byte += (size_t)size + 1;
+        } else {
+            // the last row takes the '\n' before it along
+            int prev = docRow(d, at - 1)->size;
+            edit_at(d, &e, at - 1, prev, at, size, at - 1, prev);
+            e.old_end_byte += (size_t)size + 1;
+        }
+    }
+
+    DocNode *a, *b, *m;
+    split(d->root, at, &a, &b);
+    split(b, 1, &m, &b);
+    subtree_release(d, m);
+    d->root = merge(a, b);
+    if (d->on_edit) notify(d, &e);
+    return 0;
+}
+
+int docRowInsert(Document *d, int row, int at, const char *s, int len) {
+    DocNode *n = find_node(d, row);
+    if (!n) return -1;
+    if (len <= 0) return 0;
+    erow *r = &n->row;
+    if (at < 0) at = 0;
+    if (at > r->size) at = r->size;
+    if (materialize(d, r) != 0) return -1;
+
+    char *chars = realloc(r->chars, (size_t)r->size + (size_t)len + 1);
+    if (!chars) return -1;
+    r->chars = chars;
+    memmove(&r->chars[at + len], &r->chars[at], (size_t)(r->size - at) + 1);
+    memcpy(&r->chars[at], s, (size_t)len);
+    r->size += len;
+    adjust_bytes(d, row, len);
+
+    if (d->on_edit) {
+        DocEdit e;
+        edit_at(d, &e, row, at, row, at, row, at + len);
+        e.new_end_byte += (size_t)len;
+        notify(d, &e);
+    }
+    return 0;
+}
+
+int docRowDelete(Document *d, int row, int at, int len) {
+    DocNode *n = find_node(d, row);
+    if (!n) return -1;
+    erow *r = &n->row;
+    if (at < 0) at = 0;
+    if (at > r->size) at = r->size;
+    if (len > r->size - at) len = r->size - at;
+    if (len <= 0) return 0;
+    if (materialize(d, r) != 0) return -1;
+
+    memmove(&r->chars[at], &r->chars[at + len], (size_t)(r->size - at - len) + 1);
+    r->size -= len;
+    adjust_bytes(d, row, -len);
+
+    if (d->on_edit) {
+        DocEdit e;
+        edit_at(d, &e, row, at, row, at + len, row, at);
+        e.old_end_byte += (size_t)len;
+        notify(d, &e);
+    }
+    return 0;
+}
+
+int docSplitRow(Document *d, int row, int at) {
+    return docInsertText(d, row, at, "\n", 1, NULL, NULL);
+}
+
+int docJoinRow(Document *d, int row) {
+    erow *r = docRow(d, row);
+    if (!r || row + 1 >= docNumRows(d)) return -1;
+    return docDeleteRange(d, row, r->size, row + 1, 0);
+}
+
+int docInsertText(Document *d, int row, int col, const char *s, int len,
+                  int *end_row, int *end_col)
+{
+    erow *r = docRow(d, row);
+    if (!r) return -1;
+    if (col < 0) col = 0;
+    if (col > r->size) col = r->size;
+
+    const char *nl = len > 0 ? memchr(s, '\n', (size_t)len) : NULL;
+    if (!nl) {
+        if (docRowInsert(d, row, col, s, len) != 0) return -1;
+        if (end_row) *end_row = row;
+        if (end_col) *end_col = col + len;
+        return 0;
+    }
+
+    // count the new rows first so they can be built as one chunk
+    int lines = 0;
+    for (const char *p = nl; p; p = memchr(p + 1, '\n', (size_t)(s + len - p - 1))) lines++;
+
+    erow *rows = malloc(sizeof(erow) * (size_t)lines);
+    if (!rows) return -1;
+
+    // rows[0..lines-2] are the middle lines, rows[lines-1] is the last line
+    // followed by whatever was after col on the original row
+    int made = 0;
+    const char *p = nl + 1;
+    while (made < lines - 1) {
+        const char *e = memchr(p, '\n', (size_t)(s + len - p));
+        rows[made].size = (int)(e - p);
+        rows[made].chars = dup_bytes(p, rows[made].size);
+        if (!rows[made].chars) goto fail;
+        made++;
+        p = e + 1;
+    }
+    int last_len = (int)(s + len - p);
+    int tail_len = r->size - col;
+    char *last = malloc((size_t)last_len + (size_t)tail_len + 1);
+    if (!last) goto fail;
+    memcpy(last, p, (size_t)last_len);
+    memcpy(last + last_len, &r->chars[col], (size_t)tail_len);
+    last[last_len + tail_len] = '\0';
+    rows[made].size = last_len + tail_len;
+    rows[made].chars = last;
+    made++;
+
+    DocEdit e;
+    if (d->on_edit) {
+        edit_at(d, &e, row, col, row, col, row + lines, last_len);
+        e.new_end_byte += (size_t)len;
+    }
+
+    // truncate the original row at col and append the first segment
+    int first_len = (int)(nl - s);
+    if (replace_tail(d, row, r, col, s, first_len) != 0) goto fail;
+
+    if (insert_rows(d, row + 1, rows, lines) != 0) {
+        // put the original row back together before giving up
+        replace_tail(d, row, r, col, last + last_len, tail_len);
+        goto fail;
+    }
+    free(rows);
+    if (d->on_edit) notify(d, &e);
+    if (end_row) *end_row = row + lines;
+    if (end_col) *end_col = last_len;
+    return 0;
+
+fail:
+    for (int i = 0; i < made; i++) free(rows[i].chars);
+    free(rows);
+    return -1;
+}
+
+int docDeleteRange(Document *d, int row, int col, int end_row, int end_col) {
+    int n = docNumRows(d);
+    if (row < 0 || row >= n) return -1;
+    if (end_row >= n) { end_row = n - 1; end_col = docRow(d, end_row)->size; }
+    if (end_row < row || (end_row == row && end_col <= col)) return 0;
+    if (end_row == row) return docRowDelete(d, row, col, end_col - col);
+
+    erow *first = docRow(d, row);
+    erow *last = docRow(d, end_row);
+    if (col > first->size) col = first->size;
+    if (end_col > last->size) end_col = last->size;
+
+    DocEdit e;
+    if (d->on_edit) {
+        edit_at(d, &e, row, col, end_row, end_col, row, col);
+        e.old_end_byte = docRowOffset(d, end_row) + (size_t)end_col;
+    }
+
+    if (replace_tail(d, row, first, col, &last->chars[end_col], last->size - end_col) != 0) {
+        return -1;
+    }
+
+    DocNode *a, *b, *m;
+    split(d->root, row + 1, &a, &b);
+    split(b, end_row - row, &m, &b);
+    subtree_release(d, m);
+    d->root = merge(a, b);
+    if (d->on_edit) notify(d, &e);
+    return 0;
+}
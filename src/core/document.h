@@ -0,0 +1,74 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include "common.h"
+
+/*** document store ***/
+// Rows are kept in an implicit treap ordered by row index. Each node caches
+// the row count and byte length of its subtree, so looking up a row,
+// inserting/deleting rows and converting between byte offsets and (row, col)
+// are all O(log n). Byte offsets count one '\n' between consecutive rows.
+
+void docInit(Document *d);
+void docFree(Document *d); // drops all rows, keeps the edit listener
+
+// fill an empty document with the lines of a file mapping. Rows point into
+// the mapping until they are first modified; the document unmaps it in
+// docFree. '\r' before a '\n' is not part of the row.
+int docLoadMapped(Document *d, char *map, size_t len);
+// same for text read into a malloc'd buffer, which the document frees
+int docLoadBuffer(Document *d, char *buf, size_t len);
+
+// the pieces of the above, for loading a file a chunk at a time:
+// docSetBacking hands over the mapping (heap false) or buffer that rows
+// will borrow from, docAppendBorrowed appends rows for the lines in text,
+// which must lie inside a buffer that outlives the rows.
+int docSetBacking(Document *d, char *text, size_t len, bool heap);
+int docAppendBorrowed(Document *d, char *text, size_t len);
+// Copy the current rows (sizes and text pointers) into s, for reading on
+// another thread. Until docReleaseSnapshot, rows are copied before they
+// are modified and text of deleted rows is kept, so s stays valid while
+// the document goes on being edited. The backing text must outlive s.
+int docSnapshot(Document *d, DocSnapshot *s);
+void docReleaseSnapshot(Document *d, DocSnapshot *s);
+
+// move every row of src to the end of d in O(log n), leaving src empty.
+// src must not have a backing buffer of its own.
+void docAppendDocument(Document *d, Document *src);
+
+// called after every edit with positions from before (start, old_end) and
+// after (new_end) the edit
+void docSetEditListener(Document *d, DocEditListener fn, void *ctx);
+// edits made until the matching docEndBatch are reported as one, which
+// covers everything they changed; batches nest
+void docBeginBatch(Document *d);
+void docEndBatch(Document *d);
+
+int docNumRows(const Document *d);
+size_t docLength(const Document *d);
+
+// row pointers stay valid until that row is deleted
+erow *docRow(const Document *d, int at);
+// fill out[] with up to count rows starting at first, returns rows written
+int docRows(const Document *d, int first, int count, erow **out);
+
+size_t docRowOffset(const Document *d, int row);
+int docRowAtByte(const Document *d, size_t byte, int *col);
+
+// row level edits, all return 0 on success and -1 on allocation failure
+int docInsertRow(Document *d, int at, const char *s, int len);
+int docInsertRows(Document *d, int at, const erow *rows, int n); // takes ownership of chars
+int docAppendRows(Document *d, const erow *rows, int n);
+int docDeleteRow(Document *d, int at);
+int docRowInsert(Document *d, int row, int at, const char *s, int len);
+int docRowDelete(Document *d, int row, int at, int len);
+int docSplitRow(Document *d, int row, int at);
+int docJoinRow(Document *d, int row);
+
+// range edits; text may contain '\n'. docInsertText reports where the
+// inserted text ends through end_row/end_col (either may be NULL)
+int docInsertText(Document *d, int row, int col, const char *s, int len,
+                  int *end_row, int *end_col);
+int docDeleteRange(Document *d, int row, int col, int end_row, int end_col);
+
+#endif
@@ -0,0 +1,375 @@
+#include "editlog.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// Record layout: a tag byte, the body length as a varint, the body.
+// A group body is the entry count followed by the entries:
+//   header    kind in bits 0-2, chained in bit 3, ch follows in bit 4
+//   varints   zigzag(row - previous row, 0 for the first entry), col,
+//             zigzag(end_row - row), zigzag(end_col), where end_col is
+//             relative to col when end_row == row
+//   [ch]
+//   varint    text length, then segments: varint (n << 1 | repeat)
+//             followed by n literal bytes, or one byte repeated n times
+
+#define TAG_GROUP 1
+
+#define HDR_KIND 0x07
+#define HDR_CHAINED 0x08
+#define HDR_CH 0x10
+#define MIN_REPEAT 4 // shorter runs stay in the literal segment
+
+static size_t g_mem_cap = EDITLOG_MEM_CAP;
+
+void editLogSetMemoryCap(size_t bytes) {
+    g_mem_cap = bytes;
+}
+
+static size_t put_varint(unsigned char *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+// the varint at *p, which has to end before end; *p is moved past it, or
+// set to NULL if it doesn't (or already was)
+static uint64_t get_varint(const unsigned char **p, const unsigned char *end) {
+    uint64_t v = 0;
+    for (int shift = 0; *p && *p < end && shift < 64; shift += 7) {
+        unsigned char b = *(*p)++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    *p = NULL;
+    return 0;
+}
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static size_t put_segment(unsigned char *p, const char *text, size_t n, bool repeat) {
+    size_t k = put_varint(p, (uint64_t)n << 1 | repeat);
+    if (repeat) {
+        p[k++] = (unsigned char)text[0];
+    } else {
+        memcpy(p + k, text, n);
+        k += n;
+    }
+    return k;
+}
+
+static size_t max_entry_size(const EditOperation *op) {
+    size_t len = op->text ? (size_t)op->len : 0;
+    // literal bytes plus a segment header for every repeat and the
+    // literal before it
+    return 1 + 4 * 10 + 1 + 10 + len + (len / MIN_REPEAT + 1) * 2 * 10;
+}
+
+static size_t encode_entry(unsigned char *p, const EditOperation *op, int prev_row) {
+    bool has_ch = op->ch != 0;
+    size_t k = 0;
+    p[k++] = (unsigned char)((op->kind & HDR_KIND) | (op->chained ? HDR_CHAINED : 0) |
+                             (has_ch ? HDR_CH : 0));
+    k += put_varint(p + k, zigzag((int64_t)op->row - prev_row));
+    k += put_varint(p + k, (uint64_t)op->col);
+    k += put_varint(p + k, zigzag((int64_t)op->end_row - op->row));
+    int64_t end_col = op->end_row == op->row ? (int64_t)op->end_col - op->col : op->end_col;
+    k += put_varint(p + k, zigzag(end_col));
+    if (has_ch) p[k++] = (unsigned char)op->ch;
+
+    size_t len = op->text ? (size_t)op->len : 0;
+    k += put_varint(p + k, len);
+    size_t lit = 0, i = 0;
+    while (i < len) {
+        size_t j = i + 1;
+        while (j < len && op->text[j] == op->text[i]) j++;
+        if (j - i >= MIN_REPEAT) {
+            if (i > lit) k += put_segment(p + k, op->text + lit, i - lit, false);
+            k += put_segment(p + k, op->text + i, j - i, true);
+            lit = j;
+        }
+        i = j;
+    }
+    if (len > lit) k += put_segment(p + k, op->text + lit, len - lit, false);
+    return k;
+}
+
+// decode the entry at p, which has to end before end; with text NULL only
+// op->len is filled in for the text, otherwise the text is written there.
+// Returns the end of the entry, or NULL if it is damaged.
+static const unsigned char *decode_entry(const unsigned char *p, const unsigned char *end,
+                                         EditOperation *op, int prev_row, char *text) {
+    unsigned char hdr = *p++;
+    memset(op, 0, sizeof(*op));
+    if ((hdr & HDR_KIND) > OP_DELETE_TEXT) return NULL;
+    op->kind = (EditOpKind)(hdr & HDR_KIND);
+    op->chained = (hdr & HDR_CHAINED) != 0;
+    op->row = (int)(prev_row + unzigzag(get_varint(&p, end)));
+    op->col = (int)get_varint(&p, end);
+    op->end_row = (int)(op->row + unzigzag(get_varint(&p, end)));
+    int64_t end_col = unzigzag(get_varint(&p, end));
+    op->end_col = (int)(op->end_row == op->row ? end_col + op->col : end_col);
+    if ((hdr & HDR_CH) && p && p < end) op->ch = (char)*p++;
+    else if (hdr & HDR_CH) return NULL;
+    uint64_t len = get_varint(&p, end);
+    if (!p || len > INT_MAX) return NULL;
+    op->len = (int)len;
+
+    size_t done = 0;
+    while (done < (size_t)op->len) {
+        uint64_t seg = get_varint(&p, end);
+        size_t n = (size_t)(seg >> 1);
+        if (!p || n == 0 || n > (size_t)op->len - done) return NULL;
+        if (seg & 1) {
+            if (p == end) return NULL;
+            if (text) memset(text + done, *p, n);
+            p++;
+        } else {
+            if (n > (size_t)(end - p)) return NULL;
+            if (text) memcpy(text + done, p, n);
+            p += n;
+        }
+        done += n;
+    }
+    if (text && op->len > 0) op->text = text;
+    return p;
+}
+
+void editLogInit(EditLog *log) {
+    memset(log, 0, sizeof(*log));
+    log->spill_fd = -1;
+}
+
+void editLogFree(EditLog *log) {
+    free(log->b);
+    if (log->spill) munmap(log->spill, log->spill_cap);
+    if (log->spill_fd != -1) close(log->spill_fd);
+    editLogInit(log);
+}
+
+void editLogAttach(EditLog *log, const unsigned char *records, size_t len) {
+    log->base = records;
+    log->base_len = len;
+}
+
+// the bytes of the log from global offset off to *end, the end of the
+// part holding it; NULL if off is past the end of the log
+static const unsigned char *at(const EditLog *log, size_t off, const unsigned char **end) {
+    if (off < log->base_len) {
+        *end = log->base + log->base_len;
+        return log->base + off;
+    }
+    off -= log->base_len;
+    if (off < log->spill_len) {
+        *end = log->spill + log->spill_len;
+        return log->spill + off;
+    }
+    off -= log->spill_len;
+    if (off >= log->len) return NULL;
+    *end = log->b + log->len;
+    return log->b + off;
+}
+
+// the body of the record at off if it has the tag and fits in the log;
+// *end is set to the end of the body
+static const unsigned char *record_at(const EditLog *log, size_t off, int tag,
+                                      const unsigned char **end) {
+    const unsigned char *p = at(log, off, end);
+    if (!p || *p++ != tag) return NULL;
+    uint64_t body = get_varint(&p, *end);
+    if (!p || body > (uint64_t)(*end - p)) return NULL;
+    *end = p + body;
+    return p;
+}
+
+/*** spilling ***/
+
+// make room for n more bytes in the spill mapping
+static int spill_reserve(EditLog *log, size_t n) {
+    if (log->spill_len + n <= log->spill_cap) return 0;
+    if (log->spill_fd == -1) {
+        const char *dir = getenv("TMPDIR");
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/textedit-history.XXXXXX", dir && *dir ? dir : "/tmp");
+        log->spill_fd = mkstemp(path);
+        if (log->spill_fd == -1) return -1;
+        unlink(path); // only ever reached through the descriptor
+    }
+    size_t cap = log->spill_cap ? log->spill_cap : (1u << 20);
+    while (cap < log->spill_len + n) cap *= 2;
+    if (ftruncate(log->spill_fd, (off_t)cap) == -1) return -1;
+    unsigned char *map = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, log->spill_fd, 0);
+    if (map == MAP_FAILED) return -1;
+    if (log->spill) munmap(log->spill, log->spill_cap);
+    log->spill = map;
+    log->spill_cap = cap;
+    return 0;
+}
+
+// move the oldest whole records out of memory until at most keep bytes
+// are left
+static void spill(EditLog *log, size_t keep) {
+    size_t cut = 0;
+    while (log->len - cut > keep) {
+        const unsigned char *p = log->b + cut + 1;
+        size_t body = (size_t)get_varint(&p, log->b + log->len);
+        cut = (size_t)(p - log->b) + body;
+    }
+    if (cut == 0 || spill_reserve(log, cut) != 0) return;
+    memcpy(log->spill + log->spill_len, log->b, cut);
+    log->spill_len += cut;
+    memmove(log->b, log->b + cut, log->len - cut);
+    log->len -= cut;
+}
+
+// reserve room for a record with a body of up to max bytes; returns where
+// the body goes, leaving room for the tag and length
+static unsigned char *begin_record(EditLog *log, size_t max) {
+    size_t need = 1 + 10 + max;
+    if (log->len + need > log->cap) {
+        size_t cap = log->cap ? log->cap : 4096;
+        while (cap < log->len + need) cap *= 2;
+        unsigned char *b = realloc(log->b, cap);
+        if (!b) return NULL;
+        log->b = b;
+        log->cap = cap;
+    }
+    return log->b + log->len + 1 + 10;
+}
+
+// write the tag and length in front of a body of size bytes
+static void end_record(EditLog *log, int tag, size_t size, size_t *off) {
+    unsigned char *rec = log->b + log->len;
+    unsigned char hdr[11];
+    hdr[0] = (unsigned char)tag;
+    size_t h = 1 + put_varint(hdr + 1, size);
+    memmove(rec + h, rec + 11, size);
+    memcpy(rec, hdr, h);
+    *off = log->base_len + log->spill_len + log->len;
+    log->len += h + size;
+    log->records++;
+    // spill down to half the cap so the move is paid once per cap/2 bytes
+    if (g_mem_cap && log->len > g_mem_cap) spill(log, g_mem_cap / 2);
+}
+
+int editLogAppend(EditLog *log, const EditOperation *ops, int count, size_t *off) {
+    size_t max = 10;
+    for (int i = 0; i < count; i++) max += max_entry_size(&ops[i]);
+    unsigned char *body = begin_record(log, max);
+    if (!body) return -1;
+
+    size_t k = put_varint(body, (uint64_t)count);
+    int prev_row = 0;
+    for (int i = 0; i < count; i++) {
+        k += encode_entry(body + k, &ops[i], prev_row);
+        prev_row = ops[i].row;
+    }
+    end_record(log, TAG_GROUP, k, off);
+    return 0;
+}
+
+int editLogRead(const EditLog *log, size_t off, EditGroup *g) {
+    const unsigned char *end;
+    const unsigned char *p = record_at(log, off, TAG_GROUP, &end);
+    memset(g, 0, sizeof(*g));
+    if (!p) return -1;
+    // every entry takes a byte at least
+    uint64_t n = get_varint(&p, end);
+    if (!p || n > (uint64_t)(end - p)) return -1;
+    int count = (int)n;
+    const unsigned char *first = p;
+
+    // one pass for the text size, which also checks the entries, and one
+    // to decode
+    EditOperation op;
+    size_t text_len = 0;
+    int prev_row = 0;
+    for (int i = 0; i < count; i++) {
+        p = p < end ? decode_entry(p, end, &op, prev_row, NULL) : NULL;
+        if (!p) return -1;
+        prev_row = op.row;
+        text_len += (size_t)op.len;
+    }
+    g->ops = malloc(sizeof(EditOperation) * (size_t)(count ? count : 1));
+    g->text = malloc(text_len ? text_len : 1);
+    if (!g->ops || !g->text) {
+        editGroupFree(g);
+        return -1;
+    }
+    p = first;
+    prev_row = 0;
+    char *text = g->text;
+    for (int i = 0; i < count; i++) {
+        p = decode_entry(p, end, &g->ops[i], prev_row, text);
+        prev_row = g->ops[i].row;
+        text += g->ops[i].len;
+    }
+    g->count = count;
+    return 0;
+}
+
+void editGroupFree(EditGroup *g) {
+    free(g->ops);
+    free(g->text);
+    memset(g, 0, sizeof(*g));
+}
+
+void editLogStats(const EditLog *log, EditLogStats *st) {
+    st->records = log->records;
+    st->mem_bytes = log->len;
+    st->spilled_bytes = log->spill_len;
+    st->mapped_bytes = log->base_len;
+}
+
+int editLogSnapshot(const EditLog *log, EditLogSnapshot *s) {
+    memset(s, 0, sizeof(*s));
+    s->spill_fd = -1;
+    s->base = log->base;
+    s->base_len = log->base_len;
+    s->b = malloc(log->len ? log->len : 1);
+    if (!s->b) return -1;
+    memcpy(s->b, log->b, log->len);
+    s->len = log->len;
+    if (log->spill_len > 0) {
+        s->spill_fd = dup(log->spill_fd);
+        if (s->spill_fd == -1) {
+            editLogReleaseSnapshot(s);
+            return -1;
+        }
+        s->spill_len = log->spill_len;
+    }
+    return 0;
+}
+
+void editLogReleaseSnapshot(EditLogSnapshot *s) {
+    free(s->b);
+    if (s->spill_fd != -1) close(s->spill_fd);
+    memset(s, 0, sizeof(*s));
+    s->spill_fd = -1;
+}
+
+int editLogWriteSnapshot(const EditLogSnapshot *s, int fd) {
+    if (writeFully(fd, s->base, s->base_len) != 0) return -1;
+    // the spilled records are never rewritten, but the mapping may move,
+    // so they are read through the descriptor
+    unsigned char buf[1 << 16];
+    for (size_t done = 0; done < s->spill_len;) {
+        size_t want = s->spill_len - done < sizeof(buf) ? s->spill_len - done : sizeof(buf);
+        ssize_t r = pread(s->spill_fd, buf, want, (off_t)done);
+        if (r == -1 && errno == EINTR) continue;
+        if (r <= 0 || writeFully(fd, buf, (size_t)r) != 0) return -1;
+        done += (size_t)r;
+    }
+    return writeFully(fd, s->b, s->len);
+}
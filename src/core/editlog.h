@@ -0,0 +1,66 @@
+#ifndef EDITLOG_H
+#define EDITLOG_H
+
+#include "common.h"
+
+/*** compact history storage ***/
+// An append-only byte log of edit groups (the entries one undo step takes
+// back), each found by its offset. Instead of an
+// EditOperation and a text allocation per entry, positions are varints
+// relative to the previous entry of the group and text is stored inline
+// as literal and repeat segments. When the log grows past the memory cap
+// the oldest records are appended to a file mapping; their offsets stay
+// the same and they are read from there. The log of an earlier session
+// can be attached in front, so its records keep their offsets too.
+
+#ifndef EDITLOG_MEM_CAP
+#define EDITLOG_MEM_CAP (4u << 20) // bytes of the log kept in memory
+#endif
+
+// a decoded group; the entries' text points into text
+typedef struct {
+    EditOperation *ops;
+    int count;
+    char *text;
+} EditGroup;
+
+typedef struct {
+    size_t records;       // appended in this session
+    size_t mem_bytes;
+    size_t spilled_bytes;
+    size_t mapped_bytes;  // attached from an earlier session
+} EditLogStats;
+
+// every record of a log at one point, for writing out on another thread
+typedef struct {
+    const unsigned char *base;
+    size_t base_len;
+    int spill_fd;
+    size_t spill_len;
+    unsigned char *b; // copy of the in-memory records
+    size_t len;
+} EditLogSnapshot;
+
+void editLogInit(EditLog *log);
+void editLogFree(EditLog *log);
+// put the len bytes of records at the front of an empty log; they must
+// stay mapped until the log is freed
+void editLogAttach(EditLog *log, const unsigned char *records, size_t len);
+// append the count entries of ops as one group at *off; returns 0 on
+// success, -1 on allocation failure
+int editLogAppend(EditLog *log, const EditOperation *ops, int count, size_t *off);
+// decode the group at off into g; free it with editGroupFree. Returns -1
+// if there is no intact group at off, as in a damaged attached log
+int editLogRead(const EditLog *log, size_t off, EditGroup *g);
+void editGroupFree(EditGroup *g);
+void editLogStats(const EditLog *log, EditLogStats *st);
+// in-memory bytes the log may use before spilling, 0 for no limit
+void editLogSetMemoryCap(size_t bytes);
+// the snapshot stays valid after the log changes, as long as it is not
+// freed; the records come out in offset order, so a log attached from
+// the written bytes finds them at the same offsets
+int editLogSnapshot(const EditLog *log, EditLogSnapshot *s);
+int editLogWriteSnapshot(const EditLogSnapshot *s, int fd);
+void editLogReleaseSnapshot(EditLogSnapshot *s);
+
+#endif
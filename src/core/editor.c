@@ -1,10 +1,15 @@
 #include "editor.h"
 #include "common.h"
+#include "document.h"
 #include "terminal.h"
+#include "screen.h"
 #include "fileio.h"
 #include "autocomplete.h"
 #include "syntax.h"
+#include "symbols.h"
+#include "project.h"
 #include "history.h"
+#include "loader.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -22,6 +27,69 @@ static int int_to_str(int v, char *out) {
     return n;
 }
 
+// output for one frame, kept between refreshes so its memory is reused
+static struct abuf g_frame = ABUF_INIT;
+
+static int row_size(int at) {
+    erow *row = docRow(&E.doc, at);
+    return row ? row->size : 0;
+}
+
+// rows aren't NUL terminated when they point into a mapped file, so
+// search them by length
+static char *find_in_row(const erow *row, const char *q, int qlen) {
+    char *p = row->chars, *end = row->chars + row->size;
+    while (end - p >= qlen && (p = memchr(p, q[0], end - p - qlen + 1)) != NULL) {
+        if (memcmp(p, q, qlen) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+// Keys arrive in batches; reparsing and refreshing suggestions wait until
+// the whole batch is handled (see editorFinishInput).
+static bool g_reparse_pending = false;
+static bool g_complete_pending = false;
+
+static void sync_syntax(void) {
+    // a partly loaded file is parsed once, when loading completes
+    if (!g_reparse_pending || loaderActive()) return;
+    syntaxReparse();
+    if (E.debug_tree) syntaxDebugDumpTree();
+    g_reparse_pending = false;
+}
+
+// copy the word before the cursor into word, returns its length
+static int word_before_cursor(char *word) {
+    erow *row = docRow(&E.doc, E.cy);
+    if (!row) return 0;
+    int start = E.cx;
+    while (start > 0) {
+        unsigned char ch = (unsigned char) row->chars[start - 1];
+        if (!(isalnum(ch) || ch == '_')) break;
+        start--;
+    }
+
+    int wordLen = E.cx - start;
+    if (wordLen <= 0 || wordLen >= MAX_WORD_LENGTH) return 0;
+    memcpy(word, &row->chars[start], wordLen);
+    word[wordLen] = '\0';
+    return wordLen;
+}
+
+// suggest completions for the word being typed
+static void update_completion(void) {
+    g_complete_pending = false;
+    char word[MAX_WORD_LENGTH];
+    if (word_before_cursor(word) >= 2) {
+        sync_syntax();
+        autocompleteUpdateSuggestions(word, E.cy, E.cx);
+        autocompleteShowSuggestions();
+    } else if (autocompleteIsActive()) {
+        autocompleteHideSuggestions();
+    }
+}
+
 /*** editor functions ***/
 
 void editorSearchStart(void) {
@@ -52,17 +120,21 @@ void editorSearchCommit(void) {
 
 void editorSearchUpdate(void) {
     if (E.search_len == 0) return;
-    for (int i = 0; i < E.numrows; i++){
-        erow *row = &E.row[i];
-        char *match = strstr(row->chars, E.search_query);
-        if (match) {
-            int match_col = (int)(match - row->chars);
-            E.cy = i;
-            E.cx = match_col + E.search_len;
-            E.search_match_row = i;
-            E.search_match_col = match_col;
-            E.search_match_len = E.search_len;
-            return;
+    int numrows = docNumRows(&E.doc);
+    erow *rows[256];
+    for (int first = 0; first < numrows; first += 256){
+        int n = docRows(&E.doc, first, 256, rows);
+        for (int i = 0; i < n; i++){
+            char *match = find_in_row(rows[i], E.search_query, E.search_len);
+            if (match) {
+                int match_col = (int)(match - rows[i]->chars);
+                E.cy = first + i;
+                E.cx = match_col + E.search_len;
+                E.search_match_row = first + i;
+                E.search_match_col = match_col;
+                E.search_match_len = E.search_len;
+                return;
+            }
         }
     }
     E.search_match_row = -1;
@@ -101,6 +173,7 @@ void editorSaveAsCommit(void) {
 
 void editorGotoStart(void) {
     E.goto_active = 1;
+    E.goto_history = 0;
     E.goto_len = 0;
     E.goto_buf[0] = '\0';
     E.goto_saved_cx = E.cx;
@@ -115,97 +188,192 @@ void editorGotoCancel(void) {
     E.cy = E.goto_saved_cy;
 }
 
+// the same prompt, for a state of the undo history instead of a line
+void editorGotoHistoryStart(void) {
+    editorGotoStart();
+    E.goto_history = 1;
+}
+
 void editorGotoCommit(void) {
     E.goto_active = 0;
+    if (E.goto_history && E.goto_len > 0) historyJump(atoi(E.goto_buf));
 }
 
 void editorGotoUpdate(void) {
-    if (E.goto_len == 0) return;
+    // moving through history is too heavy to do on every digit
+    if (E.goto_len == 0 || E.goto_history) return;
     int line = atoi(E.goto_buf) - 1;
     if (line < 0) line = 0;
-    if (line >= E.numrows) line = E.numrows - 1;
+    if (line >= docNumRows(&E.doc)) line = docNumRows(&E.doc) - 1;
     E.cy = line;
-    if (E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+    if (E.cx > row_size(E.cy)) E.cx = row_size(E.cy);
+}
+
+// jump to where the name under the cursor is declared at file scope
+void editorGotoDefinition(void) {
+    erow *row = docRow(&E.doc, E.cy);
+    if (!row) return;
+    int start = E.cx, end = E.cx;
+    while (start > 0 && (isalnum((unsigned char) row->chars[start - 1]) || row->chars[start - 1] == '_')) start--;
+    while (end < row->size && (isalnum((unsigned char) row->chars[end]) || row->chars[end] == '_')) end++;
+    if (end == start || end - start >= MAX_WORD_LENGTH) return;
+    char name[MAX_WORD_LENGTH];
+    memcpy(name, &row->chars[start], end - start);
+    name[end - start] = '\0';
+
+    sync_syntax();
+    const Symbol *sym = symbolsFind(name);
+    if (!sym) {
+        // there is no opening another file yet, so just say where it is
+        char path[256];
+        int drow, dcol;
+        if (projectFind(name, path, sizeof(path), &drow, &dcol) == 0) {
+            editorSetStatusMessage("%s is declared in %s:%d:%d", name, path, drow + 1, dcol + 1);
+        } else {
+            editorSetStatusMessage("No declaration of %s", name);
+        }
+        return;
+    }
+    int col = 0;
+    E.cy = docRowAtByte(&E.doc, sym->byte, &col);
+    E.cx = col;
 }
 
 void editorAllocateNewRow(void){
-    E.row = malloc(sizeof(erow));
-    E.row[0].size = 0;
-    E.row[0].chars = malloc(1);
-    E.row[0].chars[0] = '\0';
-    E.numrows = 1;
+    docFree(&E.doc);
+    docInsertRow(&E.doc, 0, "", 0);
     E.cy = 0;
     E.cx = 0;
     return;
 }
 
 void editorInsertChar(int c){
-    if (E.numrows == 0) {
+    if (docNumRows(&E.doc) == 0) {
         // Create first row if none exists
         editorAllocateNewRow();
     }
 
     // Ensure cursor is within bounds
-    if (E.cy >= E.numrows) E.cy = E.numrows - 1;
+    if (E.cy >= docNumRows(&E.doc)) E.cy = docNumRows(&E.doc) - 1;
     if (E.cy < 0) E.cy = 0;
 
     int insertPos = E.cx;
-    erow *row = &E.row[E.cy];
+    int size = row_size(E.cy);
 
     // Ensure cursor position is within row bounds
-    if (insertPos > row->size) insertPos = row->size;
+    if (insertPos > size) insertPos = size;
     if (insertPos < 0) insertPos = 0;
 
-    int oldSize = row->size;
-    char* new_chars = realloc(row->chars, oldSize + 2);
-    if (!new_chars){
+    char ch = (char)c;
+    if (docRowInsert(&E.doc, E.cy, insertPos, &ch, 1) != 0){
         return;
     }
-    row->chars = new_chars;
-    memmove(&row->chars[insertPos + 1], &row->chars[insertPos], oldSize - insertPos + 1);
-    row = &E.row[E.cy];
-    row->chars[insertPos] = (char)c;
-    row->size = oldSize + 1;
-    row->chars[row->size] = '\0';
     E.cx = insertPos + 1;
-    E.dirty = 1;
+    E.dirty++;
+}
+
+void editorInsertString(const char *s, int len){
+    if (len <= 0) return;
+    if (docNumRows(&E.doc) == 0) editorAllocateNewRow();
+
+    if (E.cy >= docNumRows(&E.doc)) E.cy = docNumRows(&E.doc) - 1;
+    if (E.cy < 0) E.cy = 0;
+    if (E.cx > row_size(E.cy)) E.cx = row_size(E.cy);
+    if (E.cx < 0) E.cx = 0;
+
+    // terminals send line breaks as \r; turn \r and \r\n into \n and drop
+    // other control characters in the same pass
+    char *text = malloc(len);
+    if (!text) return;
+    int n = 0;
+    for (int i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char) s[i];
+        if (ch == '\r') {
+            if (i + 1 < len && s[i + 1] == '\n') i++;
+            ch = '\n';
+        } else if (ch < 0x20 && ch != '\n' && ch != '\t') {
+            continue;
+        }
+        text[n++] = (char) ch;
+    }
+
+    int end_row, end_col;
+    if (n == 0 || docInsertText(&E.doc, E.cy, E.cx, text, n, &end_row, &end_col) != 0) {
+        free(text);
+        return;
+    }
+
+    EditOperation op = {
+        .kind = OP_INSERT_TEXT,
+        .row = E.cy,
+        .col = E.cx,
+        .text = text,
+        .len = n,
+        .end_row = end_row,
+        .end_col = end_col
+    };
+    historyRecord(op);
+    free(text);
+
+    E.cy = end_row;
+    E.cx = end_col;
+    E.dirty++;
+}
+
+void editorDeleteInRow(int col, int len){
+    if (E.cy < 0 || E.cy >= docNumRows(&E.doc)) return;
+    erow *row = docRow(&E.doc, E.cy);
+    if (col < 0) col = 0;
+    if (col > row->size) col = row->size;
+    if (len > row->size - col) len = row->size - col;
+    if (len <= 0) return;
+
+    char *text = malloc(len);
+    if (!text) return;
+    memcpy(text, &row->chars[col], len);
+    if (docRowDelete(&E.doc, E.cy, col, len) != 0) {
+        free(text);
+        return;
+    }
+
+    EditOperation op = {
+        .kind = OP_DELETE_TEXT,
+        .row = E.cy,
+        .col = col,
+        .text = text,
+        .len = len,
+        .end_row = E.cy,
+        .end_col = col + len
+    };
+    historyRecord(op);
+    free(text);
+
+    E.cx = col;
+    E.dirty++;
 }
 
 void editorDeleteChar(void) {
-    if (E.numrows == 0) return;
+    if (docNumRows(&E.doc) == 0) return;
 
     // if we're at the beginning of the file
     if (E.cy == 0 && E.cx == 0) return;
 
-    erow *row = &E.row[E.cy];
-
     // case 1: delete character within line
     if (E.cx > 0) {
-        memmove(&row->chars[E.cx - 1], &row->chars[E.cx], row->size - E.cx + 1);
-        row = &E.row[E.cy];
-        row->size--;
+        if (docRowDelete(&E.doc, E.cy, E.cx - 1, 1) != 0){
+            return;
+        }
         E.cx--;
-        E.dirty = 1;
+        E.dirty++;
     }
 
     // case 2: at beginning of line -> merge with previous
     else if (E.cx == 0) {
-        int prev_size = E.row[E.cy - 1].size;
-        char* new_chars = realloc(E.row[E.cy - 1].chars, prev_size + row->size + 1);
-        if (!new_chars){
+        int prev_size = row_size(E.cy - 1);
+        if (docJoinRow(&E.doc, E.cy - 1) != 0){
             return;
         }
-        E.row[E.cy - 1].chars = new_chars;
-        memcpy(&E.row[E.cy - 1].chars[prev_size], row->chars, row->size + 1);
-        E.row[E.cy - 1].size = prev_size + row->size;
-        E.dirty = 1;
-
-        // free current row
-        free(row->chars);
-
-        // shift rows up
-        memmove(&E.row[E.cy], &E.row[E.cy + 1], sizeof(erow) * (E.numrows - E.cy - 1));
-        E.numrows--;
+        E.dirty++;
 
         E.cy--;
         E.cx = prev_size;  // move cursor to end of previous line
@@ -215,7 +383,7 @@ void editorDeleteChar(void) {
 
 void editorInsertNewline(void) {
 
-    if (E.numrows == 0) {
+    if (docNumRows(&E.doc) == 0) {
         // Create first row if none exists
         editorAllocateNewRow();
         return;
@@ -223,48 +391,22 @@ void editorInsertNewline(void) {
 
     // Ensure cursor is within bounds
     if (E.cy < 0) E.cy = 0;
-    if (E.cy >= E.numrows) E.cy = E.numrows - 1;
+    if (E.cy >= docNumRows(&E.doc)) E.cy = docNumRows(&E.doc) - 1;
 
-    erow *row = &E.row[E.cy];
     int split = E.cx;
 
     // Ensure split position is within bounds
-    if (split > row->size) split = row->size;
+    if (split > row_size(E.cy)) split = row_size(E.cy);
     if (split < 0) split = 0;
 
-    // Allocate space for new line
-    erow* new_row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    if (!new_row){
-        return;
-    }
-    E.row = new_row;
-
-    // Shift existing rows below current line down by one
-    memmove(&E.row[E.cy + 1], &E.row[E.cy],
-            sizeof(erow) * (E.numrows - E.cy));
-
-    // reaquire new row pointer
-    row = &E.row[E.cy];
-
-    // Create the new line below current one
-    E.row[E.cy + 1].size = row->size - split;
-    E.row[E.cy + 1].chars = malloc(E.row[E.cy + 1].size + 1);
-    memcpy(E.row[E.cy + 1].chars, &row->chars[split], E.row[E.cy + 1].size);
-    E.row[E.cy + 1].chars[E.row[E.cy + 1].size] = '\0';
-
-    // Truncate the current line at cursor position
-    row->size = split;
-    char* new_chars = realloc(row->chars, split + 1);
-    if (!new_chars){
+    // The rest of the line moves to a new row below the cursor
+    if (docSplitRow(&E.doc, E.cy, split) != 0){
         return;
     }
-    row->chars = new_chars;
-    row->chars[split] = '\0';
 
-    E.numrows++;
     E.cy++;
     E.cx = 0;
-    E.dirty = 1;
+    E.dirty++;
 }
 
 void editorMoveCursor(int key) {
@@ -274,13 +416,13 @@ void editorMoveCursor(int key) {
                 E.cx--;
             } else if (E.cy > 0) {
                 E.cy--;
-                E.cx = E.row[E.cy].size;
+                E.cx = row_size(E.cy);
             } else if (E.coloff > 0) {
                 E.coloff--;
             }
             break;
         case ARROW_RIGHT:
-            if (E.numrows > 0 && E.cy < E.numrows && E.cx < E.row[E.cy].size) {
+            if (E.cy < docNumRows(&E.doc) && E.cx < row_size(E.cy)) {
                 E.cx++;
             }
             break;
@@ -292,7 +434,7 @@ void editorMoveCursor(int key) {
             }
             break;
         case ARROW_DOWN:
-            if (E.cy < E.numrows - 1) {
+            if (E.cy < docNumRows(&E.doc) - 1) {
                 E.cy++;
             }
             break;
@@ -300,9 +442,9 @@ void editorMoveCursor(int key) {
             break;
         }
 
-    if (E.numrows > 0 && E.cy >= 0 && E.cy < E.numrows) {
-        if (E.cx > E.row[E.cy].size) {
-            E.cx = E.row[E.cy].size;
+    if (E.cy >= 0 && E.cy < docNumRows(&E.doc)) {
+        if (E.cx > row_size(E.cy)) {
+            E.cx = row_size(E.cy);
         }
         if (E.cx < 0) {
             E.cx = 0;
@@ -311,35 +453,39 @@ void editorMoveCursor(int key) {
         E.cx = 0;
     }
     // Keep cursor in view
-    if (E.cy < E.rowoff) {
-        E.rowoff = E.cy;
-    }
-    if (E.cy >= E.rowoff + E.screenrows) {
-        E.rowoff = E.cy - E.screenrows + 1;
-    }
-    if (E.cx < E.coloff) {
-        E.coloff = E.cx;
-    }
-    if (E.cx >= E.coloff + E.screencols) {
-        E.coloff = E.cx - E.screencols + 1;
-    }
+    editorScroll();
 }
 
-void editorProcessKey(void){
+void editorProcessKey(int c){
     int prev_cx = E.cx;
     int prev_cy = E.cy;
-    int c = editorReadKey();
     int buffer_changed = 0;
-    int did_reparse = 0;
-    if (E.cy >= E.numrows) E.cy = E.numrows - 1;
+    if (E.cy >= docNumRows(&E.doc)) E.cy = docNumRows(&E.doc) - 1;
     if (E.cy < 0) E.cy = 0;
-    if (E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+    if (E.cx > row_size(E.cy)) E.cx = row_size(E.cy);
     if (E.cx < 0) E.cx = 0;
 
+    // typing more characters supersedes a pending suggestion update, other
+    // keys need the suggestions for the text so far
+    if (g_complete_pending && !isprint((unsigned char) c)) {
+        if (c == '\x1b' || c == NEWLINE_KEY || c == PASTE_KEY) g_complete_pending = false;
+        else update_completion();
+    }
+
     if (c == '\x1b'){
         if (autocompleteIsActive()) autocompleteHideSuggestions();
     }
 
+    // prompts take pasted text as if it were typed
+    if (c == PASTE_KEY && (E.search_active || E.goto_active || E.save_as_active)) {
+        int len;
+        const char *text = terminalPasteText(&len);
+        for (int i = 0; i < len; i++) {
+            if (isprint((unsigned char) text[i])) editorProcessKey((unsigned char) text[i]);
+        }
+        return;
+    }
+
     if (E.search_active) {
         if (c == '\x1b') {
             if (autocompleteIsActive()){
@@ -374,6 +520,7 @@ void editorProcessKey(void){
             editorGotoCancel();
             return;
         } else if (c == NEWLINE_KEY || c == ENTER){
+            if (E.goto_history) g_reparse_pending = true;
             editorGotoCommit();
             autocompleteCancelIfCursorMoved(prev_cx, prev_cy);
             return;
@@ -427,17 +574,26 @@ void editorProcessKey(void){
         case CTRL_KEY('j'):
             editorGotoStart();
             break;
+        case CTRL_KEY('t'):
+            editorGotoHistoryStart();
+            break;
         case CTRL_KEY('d'):
             E.debug_tree = !E.debug_tree;
             break;
+        case CTRL_KEY(']'):
+            editorGotoDefinition();
+            break;
         case CTRL_KEY('q'):
         case CTRL_KEY('c'):
             if (!E.filename) {editorSaveAsStart(); return;}
-            else editorSave();
+            else if (editorSave() != 0 || editorSaveWait() != 0) break;
             editorFree();
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
+            projectStop();
             syntaxFree();
+            screenFree();
+            abFree(&g_frame);
             exit(0);
             break;
         case CTRL_KEY('a'):
@@ -446,8 +602,8 @@ void editorProcessKey(void){
             autocompleteCancelIfCursorMoved(prev_cx, prev_cy);
             break;
         case CTRL_KEY('e'):
-            if (E.numrows > 0 && E.cy >= 0 && E.cy < E.numrows) {
-                E.cx = E.row[E.cy].size;
+            if (E.cy >= 0 && E.cy < docNumRows(&E.doc)) {
+                E.cx = row_size(E.cy);
             } else {
                 E.cx = 0;
             }
@@ -455,20 +611,18 @@ void editorProcessKey(void){
             break;
         case CTRL_KEY('k'):
 
-            if (E.numrows > 0){
-                erow *row = &E.row[E.cy];
-                if (E.cx < row->size){
-                    row->chars[E.cx] = '\0';
-                    row->size = E.cx;
-                    E.dirty = 1;
+            if (docNumRows(&E.doc) > 0){
+                int size = row_size(E.cy);
+                if (E.cx < size){
+                    editorDeleteInRow(E.cx, size - E.cx);
                     buffer_changed = 1;
-                } else if (E.cx == row->size && E.cy < E.numrows - 1){
+                } else if (E.cx == size && E.cy < docNumRows(&E.doc) - 1){
                     E.cy++;
                     E.cx = 0;
                     historyRecord((EditOperation){
                         .kind = OP_JOIN_LINE,
                         .row = E.cy - 1,
-                        .col = E.row[E.cy - 1].size,
+                        .col = row_size(E.cy - 1),
                         .ch = 0
                     });
                     editorDeleteChar();
@@ -494,16 +648,25 @@ void editorProcessKey(void){
             break;
         case CTRL_KEY('z'):
             historyUndo();
+            buffer_changed = 1;
             break;
         case CTRL_KEY('y'):
             historyRedo();
+            buffer_changed = 1;
+            break;
+        case CTRL_KEY('g'): {
+            int count;
+            int branch = historyNextBranch(&count);
+            if (branch) editorSetStatusMessage("Redo branch %d of %d", branch, count);
+            else editorSetStatusMessage("No redo branch here");
             break;
+        }
         case HOME_KEY:
             E.cx = 0;
             break;
         case END_KEY:
-            if (E.numrows > 0 && E.cy >= 0 && E.cy < E.numrows) {
-                E.cx = E.row[E.cy].size;
+            if (E.cy >= 0 && E.cy < docNumRows(&E.doc)) {
+                E.cx = row_size(E.cy);
             } else {
                 E.cx = 0;
             }
@@ -553,13 +716,13 @@ void editorProcessKey(void){
                         .kind = OP_DELETE_CHAR,
                         .row = E.cy,
                         .col = E.cx - 1,
-                        .ch = E.row[E.cy].chars[E.cx - 1]
+                        .ch = docRow(&E.doc, E.cy)->chars[E.cx - 1]
                     });
                 } else {
                     historyRecord((EditOperation){
                         .kind = OP_JOIN_LINE,
                         .row = E.cy - 1,
-                        .col = E.row[E.cy - 1].size,
+                        .col = row_size(E.cy - 1),
                         .ch = 0
                     });
                 }
@@ -567,28 +730,23 @@ void editorProcessKey(void){
             editorDeleteChar();
             buffer_changed = 1;
             break;
+        case PASTE_KEY:
+            {
+                if (autocompleteIsActive()) autocompleteHideSuggestions();
+                int len;
+                const char *text = terminalPasteText(&len);
+                editorInsertString(text, len);
+                buffer_changed = 1;
+            }
+            break;
         case TAB_KEY:
             if (autocompleteIsActive()){
                 autocompleteAcceptSuggestion();
                 buffer_changed = 1;
             } else {
-                erow* row = &E.row[E.cy];
-                int start = E.cx;
-                while (start > 0) {
-                    unsigned char ch = (unsigned char) row->chars[start - 1];
-                    if (!(isalnum(ch) || ch == '_')) break;
-                    start--;
-                }
-
-
-                int wordLen = E.cx - start;
                 char word[MAX_WORD_LENGTH];
-                if (wordLen > 0 && wordLen < MAX_WORD_LENGTH){
-                    memcpy(word, &row->chars[start], wordLen);
-                    word[wordLen] = '\0';
-                    syntaxReparseFull();
-                    if (E.debug_tree) syntaxDebugDumpTree();
-                    did_reparse = 1;
+                if (word_before_cursor(word) > 0){
+                    sync_syntax();
                     autocompleteUpdateSuggestions(word, E.cy, E.cx);
                     autocompleteShowSuggestions();
                 }
@@ -604,39 +762,37 @@ void editorProcessKey(void){
             editorInsertChar(c);
             buffer_changed = 1;
 
-            // after inserting, recompute current word and update suggestions
-            erow* row = &E.row[E.cy];
-            int start = E.cx;
-            while (start > 0) {
-                unsigned char ch = (unsigned char) row->chars[start - 1];
-                if (!(isalnum(ch) || ch == '_')) break;
-                start--;
-            }
-
-            int wordLen = E.cx - start;
-            char word[MAX_WORD_LENGTH];
-            if (wordLen >= 2 && wordLen < MAX_WORD_LENGTH){
-                memcpy(word, &row->chars[start], wordLen);
-                word[wordLen] = '\0';
-                syntaxReparseFull();
-                if (E.debug_tree) syntaxDebugDumpTree();
-                did_reparse = 1;
-                autocompleteUpdateSuggestions(word, E.cy, E.cx);
-                autocompleteShowSuggestions();
-            } else if (autocompleteIsActive()) {
-                autocompleteHideSuggestions();
-            }
+            // suggestions for the current word are refreshed once the batch
+            // of keys is done
+            g_complete_pending = true;
             break;
     }
 
-    if (buffer_changed && !did_reparse) {
-        syntaxReparseFull();
-        if (E.debug_tree) syntaxDebugDumpTree();
-        buffer_changed = 0;
+    if (buffer_changed) g_reparse_pending = true;
+}
+
+void editorFinishInput(void) {
+    if (g_complete_pending) update_completion();
+    sync_syntax();
+}
+
+int editorRowCxToRx(const erow *row, int cx) {
+    int rx = 0;
+    for (int i = 0; i < cx && i < row->size; i++) {
+        // the rest of a UTF-8 sequence is in the cell of its first byte
+        if ((row->chars[i] & 0xc0) == 0x80) continue;
+        rx += row->chars[i] == '\t' ? TAB_STOP - rx % TAB_STOP : 1;
     }
+    return rx;
+}
+
+static int cursor_rx(void) {
+    erow *row = docRow(&E.doc, E.cy);
+    return row ? editorRowCxToRx(row, E.cx) : 0;
 }
 
 void editorScroll(void) {
+    E.rx = cursor_rx();
     if (E.cy < E.rowoff) {
         E.rowoff = E.cy;
     }
@@ -644,177 +800,182 @@ void editorScroll(void) {
         E.rowoff = E.cy - E.screenrows + 1;
     }
 
-    if (E.cx < E.coloff) {
-        E.coloff = E.cx;
+    // columns scroll in screen columns, so a tab is never half in view
+    if (E.rx < E.coloff) {
+        E.coloff = E.rx;
     }
-    if (E.cx >= E.coloff + E.screencols) {
-        E.coloff = E.cx - E.screencols + 1;
+    if (E.rx >= E.coloff + E.screencols) {
+        E.coloff = E.rx - E.screencols + 1;
     }
 }
 
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows(void) {
     int y;
-    HighlightSpan spans[1024];
-    int nspans = syntaxQueryVisible(E.rowoff, E.rowoff + E.screenrows - 1, spans, 1024);
+    syntaxHighlightRows(E.rowoff, E.rowoff + E.screenrows - 1);
 
     for (y = 0; y < E.screenrows; y++) {
         int filerow = y + E.rowoff;
-        if (filerow >= E.numrows) {
-            abAppend(ab, "~\x1b[K\r\n", 6);
+        if (filerow >= docNumRows(&E.doc)) {
+            screenPut(y, 0, "~", 1, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, 0);
             continue;
         }
 
-        erow *row = &E.row[filerow];
-        int len = row->size - E.coloff;
-        if (len < 0) len = 0;
-        if (len > E.screencols) len = E.screencols;
-
-        // Reset to default color at the start of each line
-        abAppend(ab, "\x1b[39m", 5);
-
-        int last_color = 39;
-        for (int i = 0; i < len; i++) {
-            // Find color for this character
-            int color = 39;
-            for (int s = 0; s < nspans; s++) {
-                if (spans[s].row == filerow &&
-                    i + E.coloff >= spans[s].start_col &&
-                    i + E.coloff < spans[s].end_col) {
-                    color = spans[s].color_id;
-                    break;
-                }
-            }
+        erow *row = docRow(&E.doc, filerow);
 
-            if (color != last_color) {
-                char buf[32];
-                if (color >= 0){
-                    snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                } else {
-                    int palette = -color;
-                    snprintf(buf, sizeof(buf), "\x1b[38;5;%dm", palette);
-                }
-                abAppend(ab, buf, strlen(buf));
-                last_color = color;
-            }
+        // spans are sorted and disjoint, so one forward sweep finds the
+        // color of every run of characters
+        int nspans = 0;
+        const HighlightSpan *spans = syntaxRowSpans(filerow, &nspans);
+        int s = 0;
 
-            int screen_col = i + E.coloff;
+        int search_start = -1, search_end = -1;
+        if (E.search_active && E.search_match_row == filerow && E.search_match_col >= 0){
+            search_start = E.search_match_col;
+            search_end = search_start + E.search_match_len;
+        }
 
-            int in_search = 0;
-            if (E.search_active && E.search_match_row == filerow && E.search_match_col >= 0){
-                int start = E.search_match_col;
-                int end = start + E.search_match_len;
-                if (screen_col >= start && screen_col < end){
-                    in_search = 1;
-                }
+        // bytes left of the window are walked too, tabs there decide where
+        // the visible ones land
+        int col = 0, rx = 0;
+        int end = row->size;
+        while (col < end && rx - E.coloff < E.screencols) {
+            while (s < nspans && spans[s].end_col <= col) s++;
+
+            // the run ends at the next span or search match boundary
+            int color = SCREEN_FG_DEFAULT;
+            int next = end;
+            if (s < nspans && spans[s].start_col <= col) {
+                color = spans[s].color_id;
+                if (spans[s].end_col < next) next = spans[s].end_col;
+            } else if (s < nspans && spans[s].start_col < next) {
+                next = spans[s].start_col;
             }
 
-            if (in_search) {
-                abAppend(ab, "\x1b[48;5;238m", 11);
+            int bg = SCREEN_BG_DEFAULT;
+            if (col >= search_start && col < search_end) {
+                bg = -238;
+                if (search_end < next) next = search_end;
+            } else if (col < search_start && search_start < next) {
+                next = search_start;
             }
-            abAppend(ab, &row->chars[screen_col], 1);
 
-            if (in_search) {
-                abAppend(ab, "\x1b[49m", 5); // reset
-            }
+            rx = screenPutText(y, rx, E.coloff, &row->chars[col], next - col, color, bg, 0);
+            col = next;
         }
-
-        abAppend(ab, "\x1b[39m", 5);  // reset color
-        abAppend(ab, "\x1b[K\r\n", 5);
     }
 }
 
 
-void editorDrawStatusBar(struct abuf *ab) {
-    abAppend(ab, "\x1b[7m", 4); // invert colors
+void editorDrawStatusBar(void) {
     char status[80];
     int len;
     if (E.goto_active) {
-        const char *prefix = "Go to line (current ";
-        len = 0;
-
-        abAppend(ab, prefix, (int)strlen(prefix));
-        len += (int)strlen(prefix);
-
-        char num_buf[16];
-        int num_len = int_to_str(E.cy + 1, num_buf);
-        abAppend(ab, num_buf, num_len);
-        len += num_len;
+        const char *prefix = E.goto_history ? "Go to edit (current " : "Go to line (current ";
+        len = (int)strlen(prefix);
+        memcpy(status, prefix, len);
+
+        if (E.goto_history) {
+            HistoryStats hs;
+            historyStats(&hs);
+            len += int_to_str(hs.current, status + len);
+            memcpy(status + len, " of ", 4);
+            len += 4;
+            len += int_to_str(hs.states - 1, status + len);
+        } else {
+            len += int_to_str(E.cy + 1, status + len);
+        }
 
-        abAppend(ab, "): ", 3);
+        memcpy(status + len, "): ", 3);
         len += 3;
 
-        abAppend(ab, E.goto_buf, E.goto_len);
+        memcpy(status + len, E.goto_buf, E.goto_len);
         len += E.goto_len;
-
-        while (len < E.screencols) { abAppend(ab, " ", 1); len++; }
-        abAppend(ab, "\x1b[m", 3);
-        return;
-    }
-
-    if (E.search_active){
-        len = snprintf(status, sizeof(status), "Search %s (ESC to cancel)", E.search_query);
     } else {
-        char* filename = E.filename;
-        if (!filename) filename = "";
-        len = snprintf(status, sizeof(status), "L%d %.20s - %d lines %s", E.cy + 1,
-                       filename, E.numrows, E.dirty ? "(modified)" : "");
-    }
+        if (E.search_active){
+            len = snprintf(status, sizeof(status), "Search %s (ESC to cancel)", E.search_query);
+        } else {
+            char* filename = E.filename;
+            if (!filename) filename = "";
+            len = snprintf(status, sizeof(status), "L%d %.20s - %d lines %s", E.cy + 1,
+                           filename, docNumRows(&E.doc), E.dirty ? "(modified)" : "");
+            if (loaderActive() && len < (int)sizeof(status)) {
+                if (!E.dirty) len--; // drop the space left for "(modified)"
+                len += snprintf(status + len, sizeof(status) - len, " [loading %d%%]",
+                                loaderProgress());
+            }
+            if (E.debug_tree && len < (int)sizeof(status)) {
+                // history footprint, to check the undo log stays compact
+                HistoryStats hs;
+                historyStats(&hs);
+                size_t spilled = hs.log.spilled_bytes;
+                size_t bytes = hs.log.mem_bytes + spilled + hs.pending_bytes;
+                len += snprintf(status + len, sizeof(status) - len, " | hist %.1f B/edit %zuK (%zuK on disk)",
+                                hs.edits ? (double)bytes / hs.edits : 0.0, bytes >> 10, spilled >> 10);
+            }
+            if (E.statusmsg[0] && time(NULL) - E.statusmsg_time < 5 &&
+                len < (int)sizeof(status)) {
+                len += snprintf(status + len, sizeof(status) - len, " | %s", E.statusmsg);
+            }
+        }
 
-    if (E.save_as_active) {
-        len = snprintf(status, sizeof(status), "Save file as %s (ESC to cancel)", E.save_as_buf);
-    }
-    if (len > E.screencols) len = E.screencols;
-    abAppend(ab, status, len);
-    while (len < E.screencols) {
-        abAppend(ab, " ", 1);
-        len++;
+        if (E.save_as_active) {
+            len = snprintf(status, sizeof(status), "Save file as %s (ESC to cancel)", E.save_as_buf);
+        }
+        if (len >= (int)sizeof(status)) len = sizeof(status) - 1;
     }
-    abAppend(ab, "\x1b[m", 3); // reset
+
+    // inverted colors across the whole bar
+    screenFill(E.screenrows, 0, E.screencols, ' ', SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, SCREEN_ATTR_REVERSE);
+    screenPut(E.screenrows, 0, status, len, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, SCREEN_ATTR_REVERSE);
 }
 
 void editorRefreshScreen(void) {
     editorScroll();
-    struct abuf ab = ABUF_INIT;
-
-    abAppend(&ab, "\x1b[?25l", 6);
-    abAppend(&ab, "\x1b[H", 3);
+    screenClear();
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    autocompleteDrawSuggestions(&ab);
+    editorDrawRows();
+    editorDrawStatusBar();
+    autocompleteDrawSuggestions();
 
     // Ensure cursor is within bounds before positioning
-    if (E.numrows == 0) {
+    if (docNumRows(&E.doc) == 0) {
         E.cy = 0;
         E.cx = 0;
     } else {
-        if (E.cy >= E.numrows) E.cy = E.numrows - 1;
+        if (E.cy >= docNumRows(&E.doc)) E.cy = docNumRows(&E.doc) - 1;
         if (E.cy < 0) E.cy = 0;
-        if (E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+        if (E.cx > row_size(E.cy)) E.cx = row_size(E.cy);
         if (E.cx < 0) E.cx = 0;
     }
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.cx - E.coloff) + 1);
-    abAppend(&ab, buf, strlen(buf));
+    // only the cells that differ from the last frame are written
+    abReset(&g_frame);
+    E.rx = cursor_rx();
+    screenFlush(&g_frame, E.cy - E.rowoff, E.rx - E.coloff);
 
-    abAppend(&ab, "\x1b[?25h", 6);
+    if (g_frame.len > 0) write(STDOUT_FILENO, g_frame.b, g_frame.len);
+}
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+void editorResize(void) {
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) return;
+    E.screenrows = rows - 1;
+    E.screencols = cols;
+    screenResize(E.screenrows + 1, E.screencols);
 }
 
 void initEditor(void) {
     E.cx = 0;
     E.cy = 0;
     E.rowoff = 0;
+    E.rx = 0;
     E.coloff = 0;
-    E.numrows = 0;
-    E.row = NULL;
+    docInit(&E.doc);
     E.dirty = 0;
     E.debug_tree = 0;
   if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
   E.screenrows -= 1;
-  historyInit();
+  screenResize(E.screenrows + 1, E.screencols);
+  historyInit(NULL, NULL);
   autocompleteInit();
 }
@@ -7,22 +7,34 @@
 /*** editor functions ***/
 void editorAllocateNewRow(void);
 void editorInsertChar(int c);
+// insert text that may contain line breaks, as one undoable edit
+void editorInsertString(const char *s, int len);
+// delete len bytes of the cursor row from col on, as one undoable edit
+void editorDeleteInRow(int col, int len);
 void editorDeleteChar(void);
 void editorInsertNewline(void);
 void editorMoveCursor(int key);
-void editorProcessKey(void);
+void editorProcessKey(int c);
+// apply work deferred while a batch of keys was processed
+void editorFinishInput(void);
+void editorResize(void);
+// the screen column of byte cx in row, with tabs expanded and a UTF-8
+// sequence taking one column
+int editorRowCxToRx(const erow *row, int cx);
 void editorScroll(void);
-void editorDrawRows(struct abuf *ab);
-void editorDrawStatusBar(struct abuf *ab);
+void editorDrawRows(void);
+void editorDrawStatusBar(void);
 void editorRefreshScreen(void);
 void editorSearchStart(void);
 void editorSearchCancel(void);
 void editorSearchCommit(void);
 void editorSearchUpdate(void);
 void editorGotoStart(void);
+void editorGotoHistoryStart(void);
 void editorGotoCancel(void);
 void editorGotoCommit(void);
 void editorGotoUpdate(void);
+void editorGotoDefinition(void);
 void initEditor(void);
 
 #endif
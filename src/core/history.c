@@ -1,105 +1,685 @@
 #include "history.h"
 #include "common.h"
 #include "editor.h"
+#include "document.h"
+#include "journal.h"
+#include "editlog.h"
+#include "loader.h"
+#include "undofile.h"
+#include <sys/mman.h>
 
-static int stackPush(EditStack *s, EditOperation op) {
-    if (s->len == s->cap) {
-        int new_cap = s->cap ? s->cap * 2 : 128;
-        EditOperation *p = realloc(s->items, (size_t)new_cap * sizeof(EditOperation));
-        if (!p) return 0;
-        s->items = p;
-        s->cap = new_cap;
-    }
-    s->items[s->len++] = op;
-    return 1;
+// Undo entries are text edits: keystrokes are stored as one-byte inserts
+// and deletes, and a run of them at consecutive positions grows a single
+// entry, so undo takes back a whole run at once. A run ends at a line
+// break, at an undo/redo, or when anything else is recorded. An entry
+// with chained set belongs to the same step as the one before it.
+//
+// The step being recorded is kept decoded in g_pending. Once it is
+// complete it is appended to the edit log and becomes a node of the undo
+// tree (see UndoTree), a child of the current state.
+//
+// Each save writes the tree and the log next to the file (undofile.h),
+// without the checkpoints.
+// Opening the file again maps that undo file and continues from the
+// saved state; its nodes are checked and its groups decoded only when
+// undo reaches them, and checkpoints are taken again as jumps pass the
+// depths they belong at.
+
+// a checkpoint is taken every this many steps down the tree, and when
+// undo or a jump lands this far below the nearest checkpointed ancestor,
+// if the text is small enough to keep around. Checkpoints live in memory
+// only, at most HISTORY_CHECKPOINT_SLOTS of them holding at most
+// HISTORY_CHECKPOINT_BUDGET bytes. The state the file was opened in needs
+// none, its text is the document's backing text.
+#define HISTORY_CHECKPOINT_EVERY 1024
+#define HISTORY_CHECKPOINT_MAX_BYTES (8u << 20)
+// replaying this many steps costs about as much as restoring a checkpoint
+#define HISTORY_RESTORE_COST 64
+
+static EditOperation *g_pending = NULL; // entries of the step being recorded
+static int g_npending = 0, g_pending_cap = 0;
+static int g_run_cap = 0;       // bytes allocated for the last entry's text
+static bool g_run_open = false; // the last entry is a run that may grow
+static int g_group_depth = 0;
+static bool g_group_used = false; // the open group has an entry already
+static size_t g_edits = 0;      // entries recorded, before merging runs
+static size_t g_steps = 0;      // steps applied by undo, redo and jumps
+static bool g_checkpoint_due = false; // the current state wants a checkpoint
+
+#define T (E.undo)
+
+/*** replay ***/
+// Undo, redo and jumps apply their entries straight to the document
+// inside one batch (docBeginBatch), so syntax hears about the whole step
+// as a single edit, and the cursor and the modified count are set once at
+// the end. Single-line entries that touch each other on the same line, as
+// a typed run undone in pieces or many small edits to one line do, are
+// merged here and reach the document as one edit.
+
+typedef struct {
+    bool active;
+    bool insert;
+    int row, col, end_col; // end_col only for deletes
+    char *text;            // inserts only
+    int len, cap;
+} MergedEdit;
+
+static MergedEdit g_merged;
+static bool g_replayed;            // something was applied in this replay
+static int g_replay_cy, g_replay_cx; // where the cursor goes afterwards
+
+static void replay_begin(void) {
+    E.replaying_history = 1;
+    g_replayed = false;
+    docBeginBatch(&E.doc);
 }
 
-static int stackPop(EditStack *s, EditOperation *op) {
-    if (s->len == 0) return 0;
-    *op = s->items[--s->len];
-    return 1;
+static void apply_insert(int row, int col, const char *text, int len) {
+    if (docInsertText(&E.doc, row, col, text, len, NULL, NULL) == 0) g_replayed = true;
 }
 
-static void stackClear(EditStack *s) { s->len = 0;}
+static void apply_delete(int row, int col, int end_row, int end_col) {
+    if (docDeleteRange(&E.doc, row, col, end_row, end_col) == 0) g_replayed = true;
+}
 
-static void applyInsertCharAt(int row, int col, char c) {
-    E.cy = row;
-    E.cx = col;
-    editorInsertChar((unsigned char) c);
+static void flush_merged(void) {
+    if (!g_merged.active) return;
+    g_merged.active = false;
+    if (g_merged.insert) apply_insert(g_merged.row, g_merged.col, g_merged.text, g_merged.len);
+    else apply_delete(g_merged.row, g_merged.col, g_merged.row, g_merged.end_col);
 }
 
-static void applyDeleteCharAt(int row, int col) {
-    E.cy = row;
-    E.cx = col + 1; // backspace deletes col
-    editorDeleteChar();
+static int reserve_merged(int len) {
+    if (len <= g_merged.cap) return 0;
+    int cap = g_merged.cap ? g_merged.cap * 2 : 256;
+    while (cap < len) cap *= 2;
+    char *text = realloc(g_merged.text, cap);
+    if (!text) return -1;
+    g_merged.text = text;
+    g_merged.cap = cap;
+    return 0;
 }
 
-static void applySplitLine(int row, int col) {
-    E.cy = row;
-    E.cx = col;
-    editorInsertNewline();
+// start merging from the single-line edit op
+static bool start_merged(bool insert, const EditOperation *op) {
+    if (insert && reserve_merged(op->len) != 0) return false;
+    g_merged.active = true;
+    g_merged.insert = insert;
+    g_merged.row = op->row;
+    g_merged.col = op->col;
+    g_merged.end_col = op->end_col;
+    g_merged.len = 0;
+    if (insert) {
+        memcpy(g_merged.text, op->text, op->len);
+        g_merged.len = op->len;
+    }
+    return true;
 }
 
-static void applyJoinLine(int row) {
-    E.cy = row + 1;
-    E.cx = 0;
-    editorDeleteChar();
+// fold the single-line edit op into the merged one if they touch: text
+// inserted right after or before the merged insert, or deleted right
+// before or at the start of the merged delete
+static bool merge_op(bool insert, const EditOperation *op) {
+    if (g_merged.active && (g_merged.insert != insert || g_merged.row != op->row)) flush_merged();
+    if (!g_merged.active) return start_merged(insert, op);
+
+    if (insert) {
+        bool after = op->col == g_merged.col + g_merged.len;
+        if ((!after && op->col != g_merged.col) || reserve_merged(g_merged.len + op->len) != 0) {
+            flush_merged();
+            return start_merged(insert, op);
+        }
+        if (after) {
+            memcpy(g_merged.text + g_merged.len, op->text, op->len);
+        } else {
+            memmove(g_merged.text + op->len, g_merged.text, g_merged.len);
+            memcpy(g_merged.text, op->text, op->len);
+        }
+        g_merged.len += op->len;
+    } else if (op->end_col == g_merged.col) {
+        g_merged.col = op->col;
+    } else if (op->col == g_merged.col) {
+        g_merged.end_col += op->end_col - op->col;
+    } else {
+        flush_merged();
+        return start_merged(insert, op);
+    }
+    return true;
 }
 
-static void historyApply(const EditOperation *op, int inverse) {
+// apply op, or take it back
+static void replay_op(const EditOperation *op, int inverse) {
+    bool insert = (op->kind == OP_INSERT_TEXT) != !!inverse;
+    g_replay_cy = insert ? op->end_row : op->row;
+    g_replay_cx = insert ? op->end_col : op->col;
+    if (op->row == op->end_row && op->len > 0 && merge_op(insert, op)) return;
+
+    flush_merged();
+    if (insert) apply_insert(op->row, op->col, op->text, op->len);
+    else apply_delete(op->row, op->col, op->end_row, op->end_col);
+}
+
+static void replay_end(void) {
+    flush_merged();
+    docEndBatch(&E.doc);
+    E.replaying_history = 0;
+    if (!g_replayed) return;
+    E.cy = g_replay_cy;
+    E.cx = g_replay_cx;
+    E.dirty++;
+}
+
+// the text edit an entry stands for; keystroke text is kept in *byte
+static void to_text(const EditOperation *op, EditOperation *t, char *byte) {
+    *t = *op;
+    t->ch = 0;
     switch (op->kind) {
-        case OP_INSERT_CHAR:
-            if (inverse) applyDeleteCharAt(op->row, op->col);
-            else applyInsertCharAt(op->row, op->col, op->ch);
-            break;
-        case OP_DELETE_CHAR:
-            if (inverse) applyInsertCharAt(op->row, op->col, op->ch);
-            else applyDeleteCharAt(op->row, op->col);
-            break;
-        case OP_SPLIT_LINE:
-            if (inverse) applyJoinLine(op->row);
-            else applySplitLine(op->row, op->col);
-            break;
-        case OP_JOIN_LINE:
-            if (inverse) applySplitLine(op->row, op->col);
-            else applyJoinLine(op->row);
-            break;
-    }
-}
-
-void historyInit(void) {
-    E.undo_stack.items = NULL; E.undo_stack.len = 0; E.undo_stack.cap = 0;
-    E.redo_stack.items = NULL; E.redo_stack.len = 0; E.redo_stack.cap = 0;
+        case OP_INSERT_CHAR: t->kind = OP_INSERT_TEXT; *byte = op->ch; break;
+        case OP_DELETE_CHAR: t->kind = OP_DELETE_TEXT; *byte = op->ch; break;
+        case OP_SPLIT_LINE: t->kind = OP_INSERT_TEXT; *byte = '\n'; break;
+        case OP_JOIN_LINE: t->kind = OP_DELETE_TEXT; *byte = '\n'; break;
+        default: return;
+    }
+    t->text = byte;
+    t->len = 1;
+    t->end_row = *byte == '\n' ? op->row + 1 : op->row;
+    t->end_col = *byte == '\n' ? 0 : op->col + 1;
+}
+
+/*** the undo tree ***/
+
+static HistoryNode *node(int id) {
+    return id < T.base_count ? &T.base[id] : &T.nodes[id - T.base_count];
+}
+
+// whether id is a node every walk through it can trust: links only to
+// other nodes, parents before children and older siblings after newer
+// ones, so every walk ends. A saved node is checked the first time a walk
+// reaches it, and its saved checkpoint index is dropped then.
+static bool usable(int id) {
+    if (id < 0 || id >= T.count) return false;
+    if (id >= T.base_count || (T.base_checked[id / 8] & (1u << id % 8))) return true;
+    HistoryNode *n = &T.base[id];
+    if (id == 0 ? n->parent != -1 || n->depth != 0
+                : n->parent < 0 || n->parent >= id || n->depth != T.base[n->parent].depth + 1) {
+        return false;
+    }
+    if (n->first_child != -1 && (n->first_child <= id || n->first_child >= T.count ||
+                                 node(n->first_child)->parent != id)) {
+        return false;
+    }
+    if (n->redo_child != -1 && (n->redo_child <= id || n->redo_child >= T.count ||
+                                node(n->redo_child)->parent != id)) {
+        return false;
+    }
+    if (n->next_sibling != -1 && (n->next_sibling < 0 || n->next_sibling >= id ||
+                                  T.base[n->next_sibling].parent != n->parent)) {
+        return false;
+    }
+    n->checkpoint = -1;
+    T.base_checked[id / 8] |= (unsigned char)(1u << id % 8);
+    return true;
+}
+
+static int new_node(size_t group) {
+    if (T.count - T.base_count == T.cap) {
+        int cap = T.cap ? T.cap * 2 : 256;
+        HistoryNode *nodes = realloc(T.nodes, sizeof(HistoryNode) * (size_t)cap);
+        if (!nodes) return -1;
+        T.nodes = nodes;
+        T.cap = cap;
+    }
+    int id = T.count++;
+    HistoryNode *n = node(id);
+    n->group = group;
+    n->parent = -1;
+    n->first_child = n->next_sibling = n->redo_child = -1;
+    n->depth = 0;
+    n->checkpoint = -1;
+    return id;
+}
+
+static bool has_checkpoint(int id) {
+    return node(id)->checkpoint >= 0 || id == T.opened;
+}
+
+// forget checkpoint k; the last one moves into its slot
+static void drop_checkpoint(int k) {
+    HistoryCheckpoint *c = &T.checkpoints[k];
+    node(c->node)->checkpoint = -1;
+    T.checkpoint_bytes -= c->len;
+    free(c->text);
+    *c = T.checkpoints[--T.ncheckpoints];
+    if (k < T.ncheckpoints) node(c->node)->checkpoint = k;
+}
+
+// forget the oldest checkpoint
+static void drop_oldest(void) {
+    int oldest = 0;
+    for (int k = 1; k < T.ncheckpoints; k++) {
+        if (T.checkpoints[k].taken < T.checkpoints[oldest].taken) oldest = k;
+    }
+    drop_checkpoint(oldest);
+}
+
+// keep the text of state id, which the document is at, dropping the
+// oldest checkpoints to make room for it
+static void take_checkpoint(int id) {
+    size_t len = docLength(&E.doc);
+    if (loaderActive() || len > HISTORY_CHECKPOINT_MAX_BYTES || len > HISTORY_CHECKPOINT_BUDGET) return;
+    if (!T.checkpoints) {
+        T.checkpoints = malloc(sizeof(HistoryCheckpoint) * HISTORY_CHECKPOINT_SLOTS);
+        if (!T.checkpoints) return;
+    }
+
+    char *text = malloc(len ? len : 1);
+    if (!text) return;
+    size_t at = 0;
+    erow *rows[256];
+    int numrows = docNumRows(&E.doc);
+    for (int first = 0; first < numrows; first += 256) {
+        int n = docRows(&E.doc, first, 256, rows);
+        for (int i = 0; i < n; i++) {
+            memcpy(text + at, rows[i]->chars, rows[i]->size);
+            at += rows[i]->size;
+            if (first + i < numrows - 1) text[at++] = '\n';
+        }
+    }
+    while (T.ncheckpoints > 0 && (T.ncheckpoints == HISTORY_CHECKPOINT_SLOTS ||
+                                  T.checkpoint_bytes + at > HISTORY_CHECKPOINT_BUDGET)) {
+        drop_oldest();
+    }
+    T.checkpoints[T.ncheckpoints] = (HistoryCheckpoint){ id, text, at, ++T.checkpoints_taken };
+    node(id)->checkpoint = T.ncheckpoints++;
+    T.checkpoint_bytes += at;
+}
+
+// keep the text of the current state if the nearest checkpoint above it
+// is far enough away that replaying from there would be slow
+static void maybe_checkpoint(void) {
+    int id = T.current;
+    for (int up = 0; up < HISTORY_CHECKPOINT_EVERY; up++) {
+        if (!usable(id)) break;
+        if (has_checkpoint(id)) return;
+        id = node(id)->parent;
+    }
+    take_checkpoint(T.current);
+}
+
+static void clear_pending(void) {
+    for (int i = 0; i < g_npending; i++) free(g_pending[i].text);
+    g_npending = 0;
+    g_run_open = false;
+}
+
+// turn the step being recorded into a child of the current state.
+// at_state is whether the document is at that state; it is already past
+// it when the edit starting the next step was made before being recorded,
+// and a checkpoint due then waits for the next commit that is at_state.
+static void commit_pending(bool at_state) {
+    if (g_npending > 0) {
+        size_t group;
+        int id = -1;
+        if (editLogAppend(&T.log, g_pending, g_npending, &group) == 0) id = new_node(group);
+        clear_pending();
+        if (id < 0) return; // out of memory, the step can't be undone
+
+        HistoryNode *parent = node(T.current);
+        HistoryNode *n = node(id);
+        n->parent = T.current;
+        n->depth = parent->depth + 1;
+        n->next_sibling = parent->first_child;
+        parent->first_child = id;
+        parent->redo_child = id;
+        T.current = id;
+        if (n->depth % HISTORY_CHECKPOINT_EVERY == 0) g_checkpoint_due = true;
+    }
+    if (g_checkpoint_due && at_state) {
+        g_checkpoint_due = false;
+        if (!has_checkpoint(T.current)) take_checkpoint(T.current);
+    }
+}
+
+static int reserve_run(EditOperation *op, int len) {
+    if (len <= g_run_cap) return 0;
+    int cap = g_run_cap ? g_run_cap * 2 : 64;
+    while (cap < len) cap *= 2;
+    char *text = realloc(op->text, cap);
+    if (!text) return -1;
+    op->text = text;
+    g_run_cap = cap;
+    return 0;
+}
+
+// add a one-byte edit to the open run if it continues it: typing right
+// after the inserted text, or backspacing right before the deleted text
+static bool extend_run(const EditOperation *op) {
+    if (!g_run_open) return false;
+    EditOperation *run = &g_pending[g_npending - 1];
+    if (op->kind != run->kind) return false;
+    bool insert = op->kind == OP_INSERT_TEXT;
+    if (insert && (op->row != run->end_row || op->col != run->end_col)) return false;
+    if (!insert && (op->end_row != run->row || op->end_col != run->col)) return false;
+    if (reserve_run(run, run->len + 1) != 0) return false;
+
+    char ch = op->text[0];
+    if (insert) {
+        run->text[run->len] = ch;
+        run->end_row = op->end_row;
+        run->end_col = op->end_col;
+    } else {
+        memmove(run->text + 1, run->text, run->len);
+        run->text[0] = ch;
+        run->row = op->row;
+        run->col = op->col;
+    }
+    run->len++;
+    if (ch == '\n') g_run_open = false;
+    return true;
+}
+
+// add a text edit to the step being recorded, or start a new step;
+// applied is whether op is in the document already
+static void record_op(const EditOperation *op, bool typed, bool applied) {
+    g_edits++;
+    if (typed && extend_run(op)) return;
+    g_run_open = false;
+    if (!op->chained) commit_pending(!applied);
+
+    if (g_npending == g_pending_cap) {
+        int cap = g_pending_cap ? g_pending_cap * 2 : 8;
+        EditOperation *p = realloc(g_pending, sizeof(EditOperation) * (size_t)cap);
+        if (!p) return;
+        g_pending = p;
+        g_pending_cap = cap;
+    }
+    EditOperation copy = *op;
+    g_run_cap = op->len > 16 ? op->len : 16;
+    copy.text = malloc(g_run_cap);
+    if (!copy.text) return;
+    memcpy(copy.text, op->text, op->len);
+    g_pending[g_npending++] = copy;
+    g_run_open = typed && op->text[0] != '\n';
+}
+
+// mark op as part of the open group, if there is one
+static void join_group(EditOperation *op) {
+    op->chained = g_group_depth > 0 && g_group_used;
+    if (g_group_depth > 0) g_group_used = true;
+}
+
+static bool is_keystroke(const EditOperation *op) {
+    return op->kind != OP_INSERT_TEXT && op->kind != OP_DELETE_TEXT;
+}
+
+// apply the step that leads to node id, or take it back; between
+// replay_begin and replay_end
+static void apply_step(int id, int inverse) {
+    EditGroup g;
+    if (editLogRead(&T.log, node(id)->group, &g) != 0) return;
+    g_steps++;
+    if (inverse) {
+        for (int i = g.count - 1; i >= 0; i--) replay_op(&g.ops[i], 1);
+    } else {
+        for (int i = 0; i < g.count; i++) replay_op(&g.ops[i], 0);
+    }
+    editGroupFree(&g);
+}
+
+// while a jump replays, keep the text of state id, which the document is
+// at, if a checkpoint belongs at its depth and it has none: one dropped
+// for the budget, or not saved with the history
+static void checkpoint_on_the_way(int id) {
+    if (node(id)->depth % HISTORY_CHECKPOINT_EVERY != 0 || has_checkpoint(id)) return;
+    flush_merged();
+    take_checkpoint(id);
+}
+
+// replace the document with the text checkpointed at node id; between
+// replay_begin and replay_end. The opened state gets its rows back from
+// the backing text, as they were indexed when the file was opened.
+static int restore_checkpoint(int id) {
+    flush_merged();
+    int last = docNumRows(&E.doc) - 1;
+    if (last >= 0 && docDeleteRange(&E.doc, 0, 0, last, docRow(&E.doc, last)->size) != 0) return -1;
+    if (docNumRows(&E.doc) == 0 && docInsertRow(&E.doc, 0, "", 0) != 0) return -1;
+    if (id == T.opened) {
+        if (E.doc.map_len > 0 &&
+            (docAppendBorrowed(&E.doc, E.doc.map, E.doc.map_len) != 0 || docDeleteRow(&E.doc, 0) != 0)) {
+            return -1;
+        }
+    } else {
+        const HistoryCheckpoint *c = &T.checkpoints[node(id)->checkpoint];
+        if (docInsertText(&E.doc, 0, 0, c->text, (int)c->len, NULL, NULL) != 0) return -1;
+    }
+    g_replayed = true;
+    g_replay_cy = g_replay_cx = 0;
+    return 0;
+}
+
+// continue the history saved with the file, if it was saved for the
+// contents the file has now
+static int load_saved(const char *filename, const struct stat *st) {
+    char *path = sidecarPath(filename, "undo");
+    if (!path) return -1;
+    UndoFile u;
+    int rc = undoFileOpen(path, filename, st, &u);
+    free(path);
+    if (rc != 0) return -1;
+
+    // which saved nodes have been checked, a bit each
+    T.base_checked = calloc((size_t)u.count / 8 + 1, 1);
+    T.base = u.nodes;
+    T.base_count = T.count = u.count;
+    if (!T.base_checked || !usable(u.current)) {
+        free(T.base_checked);
+        T.base_checked = NULL;
+        T.base = NULL;
+        T.base_count = T.count = 0;
+        undoFileClose(&u);
+        return -1;
+    }
+    T.saved_map = u.map;
+    T.saved_len = u.len;
+    T.current = u.current;
+    editLogAttach(&T.log, u.log, u.log_len);
+    return 0;
+}
+
+void historyInit(const char *filename, const struct stat *st) {
+    memset(&E.undo, 0, sizeof(E.undo));
+    editLogInit(&T.log);
+    if (!filename || load_saved(filename, st) != 0) T.current = new_node(0); // the file as opened
+    T.opened = T.current;
+    g_checkpoint_due = false;
     E.replaying_history = 0;
 }
 
 void historyFree(void) {
-    free(E.undo_stack.items);
-    free(E.redo_stack.items);
-    E.undo_stack.items = NULL; E.redo_stack.items = NULL;
-    E.undo_stack.len = 0; E.undo_stack.cap = 0;
-    E.redo_stack.len = 0; E.redo_stack.cap = 0;
+    clear_pending();
+    free(g_pending);
+    g_pending = NULL;
+    g_pending_cap = 0;
+    free(g_merged.text);
+    memset(&g_merged, 0, sizeof(g_merged));
+    while (T.ncheckpoints > 0) drop_checkpoint(T.ncheckpoints - 1);
+    free(T.checkpoints);
+    free(T.nodes);
+    free(T.base_checked);
+    editLogFree(&T.log);
+    if (T.saved_map) munmap(T.saved_map, T.saved_len);
+    memset(&E.undo, 0, sizeof(E.undo));
+    g_edits = 0;
+    g_steps = 0;
 }
 
 void historyRecord(EditOperation op) {
     if (E.replaying_history) return;
-    if (stackPush(&E.undo_stack, op)) stackClear(&E.redo_stack);
+    join_group(&op);
+    journalRecord(JOURNAL_EDIT, &op);
+    EditOperation t;
+    char byte;
+    to_text(&op, &t, &byte);
+    record_op(&t, is_keystroke(&op), !is_keystroke(&op));
+}
+
+void historyReplay(const EditOperation *op) {
+    EditOperation t;
+    char byte;
+    to_text(op, &t, &byte);
+    replay_begin();
+    replay_op(&t, 0);
+    replay_end();
+    record_op(&t, is_keystroke(op), true);
+}
+
+void historyBeginGroup(void) {
+    if (g_group_depth++ == 0) g_group_used = false;
+    g_run_open = false;
+}
+
+void historyEndGroup(void) {
+    if (g_group_depth > 0) g_group_depth--;
 }
 
 void historyUndo(void) {
-    EditOperation op;
-    if (!stackPop(&E.undo_stack, &op)) return;
-    E.replaying_history = 1;
-    historyApply(&op, 1);
-    E.replaying_history = 0;
-    (void)stackPush(&E.redo_stack, op);
+    commit_pending(true);
+    int id = T.current;
+    int parent = node(id)->parent;
+    if (!usable(parent)) return;
+    journalRecord(JOURNAL_UNDO, NULL);
+    replay_begin();
+    apply_step(id, 1);
+    replay_end();
+    node(parent)->redo_child = id;
+    T.current = parent;
+    maybe_checkpoint();
 }
 
 void historyRedo(void) {
-    EditOperation op;
-    if (!stackPop(&E.redo_stack, &op)) return;
-    E.replaying_history = 1;
-    historyApply(&op, 0);
-    E.replaying_history = 0;
-    (void)stackPush(&E.undo_stack, op);
+    commit_pending(true);
+    int id = node(T.current)->redo_child;
+    if (!usable(id)) return;
+    journalRecord(JOURNAL_REDO, NULL);
+    replay_begin();
+    apply_step(id, 0);
+    replay_end();
+    T.current = id;
+    maybe_checkpoint();
+}
+
+int historyNextBranch(int *count) {
+    commit_pending(true);
+    HistoryNode *n = node(T.current);
+    if (!usable(n->redo_child)) return 0;
+    journalRecord(JOURNAL_BRANCH, NULL);
+    int next = node(n->redo_child)->next_sibling;
+    n->redo_child = next >= 0 ? next : n->first_child;
+
+    // children are kept newest first; number them oldest first
+    int index = 0, total = 0;
+    for (int c = n->first_child; usable(c); c = node(c)->next_sibling) {
+        total++;
+        if (c == n->redo_child) index = total;
+    }
+    *count = total;
+    return total - index + 1;
+}
+
+void historyJump(int state) {
+    commit_pending(true);
+    if (!usable(state) || state == T.current) return;
+
+    // the closest common ancestor of where we are and where we go; a jump
+    // that meets a damaged saved node goes nowhere
+    int a = T.current, b = state;
+    while (a != b) {
+        if (node(a)->depth >= node(b)->depth) a = node(a)->parent;
+        else b = node(b)->parent;
+        if (!usable(a) || !usable(b)) return;
+    }
+    int common = a;
+    journalRecord(JOURNAL_JUMP, &(EditOperation){ .row = state });
+    int target_depth = node(state)->depth;
+    int direct = node(T.current)->depth + target_depth - 2 * node(common)->depth;
+
+    // a checkpoint above the target is worth it if it saves enough steps
+    int from = state;
+    while (!has_checkpoint(from) && target_depth - node(from)->depth + HISTORY_RESTORE_COST < direct &&
+           usable(node(from)->parent)) {
+        from = node(from)->parent;
+    }
+    bool restored = has_checkpoint(from) && target_depth - node(from)->depth + HISTORY_RESTORE_COST < direct;
+    // the whole file has to be in before it is replaced
+    if (restored) loaderFinish();
+
+    replay_begin();
+    if (restored && restore_checkpoint(from) != 0) restored = false;
+    if (!restored) {
+        for (int id = T.current; id != common; id = node(id)->parent) {
+            apply_step(id, 1);
+            node(node(id)->parent)->redo_child = id;
+            checkpoint_on_the_way(node(id)->parent);
+        }
+        from = common;
+    }
+
+    // walk down to the target, leaving redo pointing along the way
+    int steps = target_depth - node(from)->depth;
+    int *path = malloc(sizeof(int) * (size_t)(steps ? steps : 1));
+    if (path) {
+        int k = steps;
+        for (int id = state; id != from; id = node(id)->parent) path[--k] = id;
+        for (k = 0; k < steps; k++) {
+            apply_step(path[k], 0);
+            node(node(path[k])->parent)->redo_child = path[k];
+            checkpoint_on_the_way(path[k]);
+        }
+        free(path);
+        T.current = state;
+    } else {
+        T.current = from;
+    }
+    replay_end();
+    maybe_checkpoint();
+}
+
+int historySnapshot(HistorySnapshot *s) {
+    // the saved state has to be a node of the tree
+    commit_pending(true);
+    memset(s, 0, sizeof(*s));
+    s->log.spill_fd = -1;
+    s->nodes = malloc(sizeof(HistoryNode) * (size_t)T.count);
+    if (!s->nodes || editLogSnapshot(&T.log, &s->log) != 0) {
+        historyReleaseSnapshot(s);
+        return -1;
+    }
+    if (T.base_count) memcpy(s->nodes, T.base, sizeof(HistoryNode) * (size_t)T.base_count);
+    if (T.nodes) {
+        memcpy(s->nodes + T.base_count, T.nodes, sizeof(HistoryNode) * (size_t)(T.count - T.base_count));
+    }
+    // checkpoints stay behind, they are only a cache
+    for (int k = 0; k < T.ncheckpoints; k++) s->nodes[T.checkpoints[k].node].checkpoint = -1;
+    s->count = T.count;
+    s->current = T.current;
+    return 0;
+}
+
+void historyReleaseSnapshot(HistorySnapshot *s) {
+    free(s->nodes);
+    editLogReleaseSnapshot(&s->log);
+    memset(s, 0, sizeof(*s));
+    s->log.spill_fd = -1;
+}
+
+void historyStats(HistoryStats *st) {
+    editLogStats(&T.log, &st->log);
+    st->edits = g_edits;
+    st->states = T.count;
+    st->current = T.current;
+    st->checkpoints = T.ncheckpoints;
+    st->checkpoint_bytes = T.checkpoint_bytes;
+    st->steps = g_steps;
+    st->pending_bytes = 0;
+    for (int i = 0; i < g_npending; i++) st->pending_bytes += (size_t)g_pending[i].len;
 }
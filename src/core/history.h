@@ -2,11 +2,58 @@
 #define HISTORY_H
 
 #include "common.h"
+#include "editlog.h"
+#include <sys/stat.h>
 
-void historyInit(void);
+#ifndef HISTORY_CHECKPOINT_BUDGET
+#define HISTORY_CHECKPOINT_BUDGET (32u << 20) // bytes of text all checkpoints hold
+#endif
+#define HISTORY_CHECKPOINT_SLOTS 64
+
+typedef struct {
+    size_t edits;        // entries recorded since startup
+    int states;          // nodes in the undo tree
+    int current;
+    int checkpoints;
+    size_t checkpoint_bytes;
+    size_t steps;        // undo steps applied since startup
+    size_t pending_bytes; // text of the step being recorded, not encoded yet
+    EditLogStats log;
+} HistoryStats;
+
+// the undo tree as of one point, for writing out on another thread;
+// checkpoints are left out
+typedef struct {
+    HistoryNode *nodes;
+    int count;
+    int current;
+    EditLogSnapshot log;
+} HistorySnapshot;
+
+// start an empty history, or with filename (whose state is st) continue
+// the one saved with it if it matches
+void historyInit(const char *filename, const struct stat *st);
 void historyFree(void);
+// record an edit about to be made (keystroke kinds) or just made (text
+// kinds); op.text is copied
 void historyRecord(EditOperation op);
+// apply op as if it had just been made and recorded; op->text is copied
+void historyReplay(const EditOperation *op);
+// entries recorded between these are undone and redone as one
+void historyBeginGroup(void);
+void historyEndGroup(void);
 void historyUndo(void);
 void historyRedo(void);
+// make redo follow the next branch at the current state; returns the
+// branch now selected (from 1) and sets *count, or 0 if there is none
+int historyNextBranch(int *count);
+// move the document to state n (states are numbered in the order they
+// were made, 0 is the file as opened)
+void historyJump(int state);
+void historyStats(HistoryStats *st);
+// the current state becomes a node of its own, so it can be saved as the
+// state of the file being written
+int historySnapshot(HistorySnapshot *s);
+void historyReleaseSnapshot(HistorySnapshot *s);
 
 #endif
@@ -0,0 +1,107 @@
+#include "lineindex.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LINEINDEX_X86 1
+#include <immintrin.h>
+#endif
+
+size_t lineScanScalar(const char *buf, size_t len, size_t *ends, size_t max) {
+    size_t n = 0;
+    const char *p = buf, *end = buf + len;
+    while (n < max && p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        ends[n++] = (size_t)(p - buf);
+        p++;
+    }
+    return n;
+}
+
+#ifdef LINEINDEX_X86
+
+// record the set bits of mask as offsets from base; returns the new count
+static inline size_t take_bits(unsigned int mask, size_t base,
+                               size_t *ends, size_t n, size_t max) {
+    while (mask && n < max) {
+        ends[n++] = base + (size_t)__builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+__attribute__((target("sse2")))
+size_t lineScanSSE2(const char *buf, size_t len, size_t *ends, size_t max) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0, i = 0;
+    for (; i + 16 <= len && n < max; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask) n = take_bits(mask, i, ends, n, max);
+    }
+    if (n < max && i < len) {
+        size_t first = n;
+        n += lineScanScalar(buf + i, len - i, ends + n, max - n);
+        for (size_t k = first; k < n; k++) ends[k] += i;
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+size_t lineScanAVX2(const char *buf, size_t len, size_t *ends, size_t max) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0, i = 0;
+    // two vectors per step; most 64 byte blocks of text hold at most one line end
+    for (; i + 64 <= len && n < max; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+        unsigned int ma = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl));
+        unsigned int mb = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl));
+        if (ma) n = take_bits(ma, i, ends, n, max);
+        if (mb) n = take_bits(mb, i + 32, ends, n, max);
+    }
+    if (n < max && i < len) {
+        size_t first = n;
+        n += lineScanScalar(buf + i, len - i, ends + n, max - n);
+        for (size_t k = first; k < n; k++) ends[k] += i;
+    }
+    return n;
+}
+
+#else
+
+size_t lineScanSSE2(const char *buf, size_t len, size_t *ends, size_t max) {
+    return lineScanScalar(buf, len, ends, max);
+}
+
+size_t lineScanAVX2(const char *buf, size_t len, size_t *ends, size_t max) {
+    return lineScanScalar(buf, len, ends, max);
+}
+
+#endif
+
+typedef size_t (*LineScanFn)(const char *, size_t, size_t *, size_t);
+
+static LineScanFn g_scan = NULL;
+static const char *g_scan_name = "scalar";
+
+static void pick_scan(void) {
+    g_scan = lineScanScalar;
+#ifdef LINEINDEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        g_scan = lineScanAVX2;
+        g_scan_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        g_scan = lineScanSSE2;
+        g_scan_name = "sse2";
+    }
+#endif
+}
+
+size_t lineScan(const char *buf, size_t len, size_t *ends, size_t max) {
+    if (!g_scan) pick_scan();
+    return g_scan(buf, len, ends, max);
+}
+
+const char *lineScanImpl(void) {
+    if (!g_scan) pick_scan();
+    return g_scan_name;
+}
@@ -0,0 +1,21 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include "common.h"
+
+/*** line indexing ***/
+// Finds the '\n' bytes in buf[0..len) and stores their offsets in ends[],
+// stopping after max of them; returns how many were stored. To continue
+// after a full table, scan again from ends[max - 1] + 1.
+//
+// lineScan uses AVX2 or SSE2 when the CPU has them and falls back to
+// memchr otherwise. The variants are exported for benchmarking.
+size_t lineScan(const char *buf, size_t len, size_t *ends, size_t max);
+size_t lineScanScalar(const char *buf, size_t len, size_t *ends, size_t max);
+size_t lineScanSSE2(const char *buf, size_t len, size_t *ends, size_t max);
+size_t lineScanAVX2(const char *buf, size_t len, size_t *ends, size_t max);
+
+// name of the variant lineScan dispatches to
+const char *lineScanImpl(void);
+
+#endif
@@ -1,4 +1,9 @@
 #include "autocomplete.h"
+#include "document.h"
+#include "editor.h"
+#include "history.h"
+#include "project.h"
+#include "screen.h"
 
 void autocompleteInit(void){
     E.autocomplete.count = 0;
@@ -40,6 +45,16 @@ void autocompleteUpdateSuggestions(const char* word, int row, int col){
         E.autocomplete.suggestions[out_count][MAX_WORD_LENGTH - 1] = '\0';
         out_count++;
     }
+    // then names declared in the rest of the project, unless already there
+    char project[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+    int project_count = projectComplete(word, project, MAX_SUGGESTIONS - out_count);
+    for (int i = 0; i < project_count && out_count < MAX_SUGGESTIONS; i++){
+        bool seen = false;
+        for (int j = 0; j < out_count && !seen; j++) seen = strcmp(E.autocomplete.suggestions[j], project[i]) == 0;
+        if (seen) continue;
+        memcpy(E.autocomplete.suggestions[out_count], project[i], MAX_WORD_LENGTH);
+        out_count++;
+    }
     strncpy(E.autocomplete.current_word, word, MAX_WORD_LENGTH - 1);
     E.autocomplete.current_word[MAX_WORD_LENGTH - 1] = '\0';
 
@@ -110,8 +125,8 @@ void autocompleteAcceptSuggestion(void){
     int suggestionLen = (int) strlen(suggestion);
     int wordLen = (int) strlen(E.autocomplete.current_word);
 
-    if (E.cy < 0 || E.cy >= E.numrows) return;
-    erow* row = &E.row[E.cy];
+    if (E.cy < 0 || E.cy >= docNumRows(&E.doc)) return;
+    erow* row = docRow(&E.doc, E.cy);
 
     int start = E.autocomplete.start_col;
     if (start < 0) start = 0;
@@ -120,36 +135,28 @@ void autocompleteAcceptSuggestion(void){
     int end = start + wordLen;
     if (end > row->size) end = row->size;
 
-    // new size = current - wordLen + suggestionLen
-    int newSize = row->size - (end - start) + suggestionLen;
-    char* newChars = malloc(newSize + 1);
-    if (!newChars) return;
-
-    memcpy(newChars, row->chars, start);
-    memcpy(newChars + start, suggestion, suggestionLen);
-    memcpy(newChars + start + suggestionLen, row->chars + end, row->size - end);
-
-    newChars[newSize] = '\0';
-    free(row->chars);
-    row->chars = newChars;
-    row->size = newSize;
-
-    E.cx = start + suggestionLen;
+    // replace the typed word with the suggestion
+    historyBeginGroup();
+    editorDeleteInRow(start, end - start);
+    E.cx = start;
+    editorInsertString(suggestion, suggestionLen);
+    historyEndGroup();
 
     E.autocomplete.is_active = false;
     E.autocomplete.count = 0;
-    E.dirty = 1;
 }
 
 bool autocompleteIsActive(void){
     return E.autocomplete.is_active && E.autocomplete.count > 0;
 }
 
-void autocompleteDrawSuggestions(struct abuf *ab){
+void autocompleteDrawSuggestions(void){
     if (!autocompleteIsActive()) return;
 
     int drawRow = (E.autocomplete.start_row - E.rowoff) + 2;
-    int drawCol = (E.autocomplete.start_col - E.coloff) + 1;
+    erow *start = docRow(&E.doc, E.autocomplete.start_row);
+    int start_rx = start ? editorRowCxToRx(start, E.autocomplete.start_col) : E.autocomplete.start_col;
+    int drawCol = (start_rx - E.coloff) + 1;
 
     // keep within screen bounds
     if (drawRow < 1) drawRow = 1;
@@ -164,30 +171,20 @@ void autocompleteDrawSuggestions(struct abuf *ab){
         int r = drawRow + i;
         if (r > E.screenrows) break;
 
-        char move[32];
         int col = drawCol;
         if (col < 1) col = 1;
         if (col > E.screencols) col = E.screencols;
 
-        snprintf(move, sizeof(move), "\x1b[%d;%dH", r, col);
-        abAppend(ab, move, (int)strlen(move));
-
         // clear to end of line
-        abAppend(ab, "\x1b[K", 3);
+        screenFill(r - 1, col - 1, E.screencols - col + 1, ' ',
+                   SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, 0);
 
         // select highlight
-        if (i == E.autocomplete.selected){
-            abAppend(ab, "\x1b[7m", 4);
-        }
+        int attr = i == E.autocomplete.selected ? SCREEN_ATTR_REVERSE : 0;
 
         const char* s = E.autocomplete.suggestions[i];
         int len = (int) strlen(s);
         if (len > E.screencols - col + 1) len = E.screencols - col + 1;
-        if (len > 0) abAppend(ab, s, len);
-
-        if (i == E.autocomplete.selected){
-            abAppend(ab, "\x1b[m", 3); // reset
-        }
+        if (len > 0) screenPut(r - 1, col - 1, s, len, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, attr);
     }
 }
-
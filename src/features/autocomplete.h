@@ -4,7 +4,6 @@
 #include "common.h"
 #include "autocomplete/Trie.h"
 #include "common.h"
-#include "buffer.h"
 #include "syntax.h"
 
 // Autocomplete functions
@@ -18,6 +17,6 @@ void autocompleteSelectPrev(void);
 void autocompleteAcceptSuggestion(void);
 bool autocompleteIsActive(void);
 void autocompleteCancelIfCursorMoved(int prev_cx, int prev_cy);
-void autocompleteDrawSuggestions(struct abuf *ab);
+void autocompleteDrawSuggestions(void);
 
 #endif
@@ -0,0 +1,787 @@
+#include "project.h"
+#include "symbols.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tree_sitter/api.h>
+
+extern const TSLanguage *tree_sitter_c(void);
+
+#define PROJECT_SHARDS 64           // one bit each in ProjectFile.shards
+#define PROJECT_MAX_THREADS 8
+#define PROJECT_MAX_FILE (4u << 20) // anything bigger is most likely generated
+#define PROJECT_MAX_DEPTH 32
+
+// On disk, in the project root: a CacheHeader, a CacheFile for every file indexed,
+// sorted by path, the CacheEntry records of one file after another, then
+// the paths and names, each ending in a NUL. Files whose size and mtime
+// match their record are filled in from the mapping on the first pass
+// instead of being parsed, and their names are used from it in place.
+
+#define CACHE_NAME ".textedit.index"
+#define CACHE_MAGIC "teindx1"
+
+typedef struct {
+    char magic[8];
+    uint32_t file_size;  // sizeof(CacheFile) and sizeof(CacheEntry) when
+    uint32_t entry_size; // written, so another build's cache is ignored
+    uint32_t nfiles;
+    uint32_t nentries;
+    uint64_t strings_len;
+} CacheHeader;
+
+typedef struct {
+    uint64_t path; // offset into the strings
+    uint64_t size;
+    int64_t mtime_sec, mtime_nsec;
+    uint32_t first, count; // its entries
+} CacheFile;
+
+typedef struct {
+    uint64_t name;
+    int32_t row, col;
+    int32_t kind;
+    int32_t unused;
+} CacheEntry;
+
+typedef struct {
+    const char *name; // owned, unless it is in the cache mapping
+    const char *path; // owned by the file's ProjectFile
+    int row, col;
+    SymbolKind kind;
+} ProjectEntry;
+
+typedef struct {
+    pthread_rwlock_t lock; // lookups, and swapping in a new entries array
+    pthread_mutex_t write; // one writer at a time builds the next array
+    ProjectEntry *entries; // sorted by name
+    int count;
+} ProjectShard;
+
+typedef struct {
+    char *path;
+    struct timespec mtime;
+    off_t size;
+    uint64_t shards; // shards holding entries from this file
+} ProjectFile;
+
+typedef struct {
+    ProjectFile *files;
+    int count;
+    int cap;
+} FileList;
+
+static ProjectShard g_shards[PROJECT_SHARDS];
+static bool g_running = false;
+static char *g_root = NULL;
+static int g_max_depth = 0; // of directories under the root to look in
+static pthread_t g_scanner;
+static pthread_t g_workers[PROJECT_MAX_THREADS];
+static int g_nworkers = 0;
+static bool g_have_scanner = false;
+
+// shared with the threads, guarded by g_lock
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_work = PTHREAD_COND_INITIALIZER;  // jobs queued, or stop
+static pthread_cond_t g_done = PTHREAD_COND_INITIALIZER;  // no job in progress any more
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;  // rescan asked, or stop
+static int *g_jobs = NULL; // indexes into g_files for this pass
+static int g_njobs = 0, g_next_job = 0;
+static int g_busy = 0;     // jobs taken but not finished
+static bool g_stop = false, g_rescan = false;
+static bool g_scanning = false; // a pass is under way
+static unsigned g_passes = 0;
+
+// the scanner's; only changed between passes, while no worker looks at it
+static FileList g_files = {0};
+
+// the cache as it was at start, mapped until projectStop; no path when
+// there is no project root to keep it in
+static char *g_cache_path = NULL;
+static const char *g_cache = NULL;
+static size_t g_cache_len = 0;
+static CacheHeader g_cache_hdr;
+
+static int shard_of(const char *name){
+    return (unsigned char) name[0] % PROJECT_SHARDS;
+}
+
+static bool stopping(void){
+    pthread_mutex_lock(&g_lock);
+    bool stop = g_stop;
+    pthread_mutex_unlock(&g_lock);
+    return stop;
+}
+
+static void free_name(const char *name){
+    if (name >= g_cache && name < g_cache + g_cache_len) return;
+    free((char *) name);
+}
+
+static int cmp_entry(const void *a, const void *b){
+    const ProjectEntry *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+    if (c == 0) c = strcmp(x->path, y->path);
+    if (c == 0) c = (x->row > y->row) - (x->row < y->row);
+    return c;
+}
+
+static int cmp_shard_entry(const void *a, const void *b){
+    int x = shard_of(((const ProjectEntry *) a)->name);
+    int y = shard_of(((const ProjectEntry *) b)->name);
+    return x != y ? x - y : cmp_entry(a, b);
+}
+
+// replace what path has in the shard by add, which is sorted; add's names
+// now belong to the shard
+static void shard_replace(ProjectShard *s, const char *path, ProjectEntry *add, int nadd){
+    pthread_mutex_lock(&s->write);
+    int keep = 0;
+    for (int i = 0; i < s->count; i++) {
+        if (s->entries[i].path != path) keep++;
+    }
+    int n = keep + nadd;
+    ProjectEntry *next = n ? malloc(sizeof(ProjectEntry) * (size_t) n) : NULL;
+    ProjectEntry *old = s->entries;
+    int nold = s->count;
+
+    if (n && !next) {
+        // out of memory: the file's old entries still have to go, since
+        // its path may be freed next
+        for (int j = 0; j < nadd; j++) free_name(add[j].name);
+        pthread_rwlock_wrlock(&s->lock);
+        int k = 0;
+        for (int i = 0; i < nold; i++) {
+            if (old[i].path != path) old[k++] = old[i];
+            else free_name(old[i].name);
+        }
+        s->count = k;
+        pthread_rwlock_unlock(&s->lock);
+        pthread_mutex_unlock(&s->write);
+        return;
+    }
+
+    int i = 0, j = 0, k = 0;
+    while (i < nold || j < nadd) {
+        if (i < nold && old[i].path == path) { i++; continue; }
+        if (j == nadd || (i < nold && cmp_entry(&old[i], &add[j]) <= 0)) next[k++] = old[i++];
+        else next[k++] = add[j++];
+    }
+
+    pthread_rwlock_wrlock(&s->lock);
+    s->entries = next;
+    s->count = n;
+    pthread_rwlock_unlock(&s->lock);
+
+    for (i = 0; i < nold; i++) {
+        if (old[i].path == path) free_name(old[i].name);
+    }
+    free(old);
+    pthread_mutex_unlock(&s->write);
+}
+
+// make entries, n of them, all the index has for f
+static void file_replace(ProjectFile *f, ProjectEntry *entries, int n){
+    qsort(entries, (size_t) n, sizeof(ProjectEntry), cmp_shard_entry);
+    uint64_t mask = 0;
+    for (int i = 0; i < n; i++) mask |= (uint64_t) 1 << shard_of(entries[i].name);
+
+    int i = 0;
+    for (int s = 0; s < PROJECT_SHARDS; s++) {
+        int j = i;
+        while (j < n && shard_of(entries[j].name) == s) j++;
+        if ((f->shards | mask) & ((uint64_t) 1 << s)) shard_replace(&g_shards[s], f->path, entries + i, j - i);
+        i = j;
+    }
+    f->shards = mask;
+}
+
+static char *read_file(const char *path, uint32_t *len){
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    struct stat st;
+    char *text = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size <= (off_t) PROJECT_MAX_FILE) text = malloc((size_t) st.st_size + 1);
+    size_t have = 0;
+    while (text && have < (size_t) st.st_size) {
+        ssize_t got = read(fd, text + have, (size_t) st.st_size - have);
+        if (got == -1 && errno == EINTR) continue;
+        if (got <= 0) break;
+        have += (size_t) got;
+    }
+    close(fd);
+    if (!text) return NULL;
+    text[have] = '\0';
+    *len = (uint32_t) have;
+    return text;
+}
+
+static void index_file(TSParser *parser, ProjectFile *f){
+    uint32_t len = 0;
+    char *text = read_file(f->path, &len);
+    // gone or unreadable; the next scan drops it if it is really gone
+    if (!text) return;
+
+    Symbol *syms = NULL;
+    int n = -1;
+    TSTree *tree = ts_parser_parse_string(parser, NULL, text, len);
+    if (tree) {
+        n = symbolsRead(ts_tree_root_node(tree), text, &syms);
+        ts_tree_delete(tree);
+    }
+    ProjectEntry *entries = n >= 0 ? malloc(sizeof(ProjectEntry) * (size_t) (n ? n : 1)) : NULL;
+    if (!entries) {
+        if (n > 0) symbolsFreeList(syms, n);
+        free(text);
+        return;
+    }
+
+    // symbols come in document order, so rows can be counted as we go
+    uint32_t at = 0, line = 0;
+    int row = 0;
+    for (int i = 0; i < n; i++) {
+        if (syms[i].byte < line) at = line = 0, row = 0;
+        for (; at < syms[i].byte && at < len; at++) {
+            if (text[at] == '\n') {
+                row++;
+                line = at + 1;
+            }
+        }
+        entries[i] = (ProjectEntry) {
+            .name = syms[i].name,
+            .path = f->path,
+            .row = row,
+            .col = (int) (syms[i].byte - line),
+            .kind = syms[i].kind,
+        };
+    }
+    free(syms);
+    free(text);
+    file_replace(f, entries, n);
+    free(entries);
+}
+
+static void *index_worker(void *arg){
+    (void) arg;
+    TSParser *parser = ts_parser_new();
+    if (parser && !ts_parser_set_language(parser, tree_sitter_c())) {
+        ts_parser_delete(parser);
+        parser = NULL;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    while (!g_stop) {
+        if (g_next_job == g_njobs) {
+            pthread_cond_wait(&g_work, &g_lock);
+            continue;
+        }
+        int job = g_jobs[g_next_job++];
+        g_busy++;
+        pthread_mutex_unlock(&g_lock);
+
+        if (parser) index_file(parser, &g_files.files[job]);
+
+        pthread_mutex_lock(&g_lock);
+        // the scanner waits for this after a stop too
+        if (--g_busy == 0) pthread_cond_signal(&g_done);
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    if (parser) ts_parser_delete(parser);
+    return NULL;
+}
+
+static bool is_source(const char *name){
+    const char *dot = strrchr(name, '.');
+    return dot && (strcmp(dot, ".c") == 0 || strcmp(dot, ".h") == 0);
+}
+
+static void scan_dir(FileList *l, const char *dir, int depth){
+    if (depth > g_max_depth || stopping()) return;
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        // also skips . and .., and .git and the like
+        if (ent->d_name[0] == '.') continue;
+        size_t size = strlen(dir) + strlen(ent->d_name) + 2;
+        char *path = malloc(size);
+        if (!path) break;
+        if (strcmp(dir, "/") == 0) snprintf(path, size, "/%s", ent->d_name);
+        else snprintf(path, size, "%s/%s", dir, ent->d_name);
+
+        struct stat st;
+        if (stat(path, &st) == -1) {
+            // a dangling link, or gone already
+        } else if (S_ISDIR(st.st_mode)) {
+            scan_dir(l, path, depth + 1);
+        } else if (S_ISREG(st.st_mode) && is_source(ent->d_name) &&
+                   st.st_size <= (off_t) PROJECT_MAX_FILE) {
+            if (l->count == l->cap) {
+                int cap = l->cap ? l->cap * 2 : 64;
+                ProjectFile *files = realloc(l->files, sizeof(ProjectFile) * (size_t) cap);
+                if (!files) break;
+                l->files = files;
+                l->cap = cap;
+            }
+            l->files[l->count++] = (ProjectFile) { path, st.st_mtim, st.st_size, 0 };
+            continue;
+        }
+        free(path);
+    }
+    closedir(d);
+}
+
+static int cmp_file(const void *a, const void *b){
+    return strcmp(((const ProjectFile *) a)->path, ((const ProjectFile *) b)->path);
+}
+
+static bool same_time(struct timespec a, struct timespec b){
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static void cache_open(void){
+    if (!g_cache_path) return;
+    int fd = open(g_cache_path, O_RDONLY);
+    if (fd == -1) return;
+    CacheHeader hdr;
+    struct stat st;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr) || fstat(fd, &st) == -1) {
+        close(fd);
+        return;
+    }
+    size_t len = sizeof(hdr) + sizeof(CacheFile) * (size_t) hdr.nfiles +
+                 sizeof(CacheEntry) * (size_t) hdr.nentries + (size_t) hdr.strings_len;
+    bool valid = memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) == 0 &&
+                 hdr.file_size == sizeof(CacheFile) && hdr.entry_size == sizeof(CacheEntry) &&
+                 hdr.strings_len > 0 && (off_t) len == st.st_size;
+    void *map = valid ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) return;
+    // every string can be read up to a NUL without leaving the mapping
+    if (((const char *) map)[len - 1] != '\0') {
+        munmap(map, len);
+        return;
+    }
+    g_cache = map;
+    g_cache_len = len;
+    g_cache_hdr = hdr;
+}
+
+static const CacheFile *cache_files(void){
+    return (const CacheFile *) (g_cache + sizeof(CacheHeader));
+}
+
+static const CacheEntry *cache_entries(void){
+    return (const CacheEntry *) (cache_files() + g_cache_hdr.nfiles);
+}
+
+// a string in the cache, or NULL if off is out of range
+static const char *cache_string(uint64_t off){
+    if (off >= g_cache_hdr.strings_len) return NULL;
+    return (const char *) (cache_entries() + g_cache_hdr.nentries) + off;
+}
+
+// the record for f if it is still up to date
+static const CacheFile *cache_find(const ProjectFile *f){
+    if (!g_cache) return NULL;
+    const CacheFile *files = cache_files();
+    int lo = 0, hi = (int) g_cache_hdr.nfiles;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const char *path = cache_string(files[mid].path);
+        if (!path) return NULL;
+        int c = strcmp(path, f->path);
+        if (c == 0) {
+            const CacheFile *cf = &files[mid];
+            bool fresh = cf->size == (uint64_t) f->size && cf->mtime_sec == (int64_t) f->mtime.tv_sec &&
+                         cf->mtime_nsec == (int64_t) f->mtime.tv_nsec &&
+                         (uint64_t) cf->first + cf->count <= g_cache_hdr.nentries;
+            return fresh ? cf : NULL;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+// fill in f from its record; -1 if it has to be parsed after all
+static int cache_load(ProjectFile *f, const CacheFile *cf){
+    ProjectEntry *entries = malloc(sizeof(ProjectEntry) * (size_t) (cf->count ? cf->count : 1));
+    if (!entries) return -1;
+    const CacheEntry *ce = cache_entries() + cf->first;
+    for (uint32_t i = 0; i < cf->count; i++) {
+        const char *name = cache_string(ce[i].name);
+        if (!name || !name[0] || ce[i].kind < 0 || ce[i].kind > SYMBOL_MACRO) {
+            free(entries);
+            return -1;
+        }
+        entries[i] = (ProjectEntry) {
+            .name = name,
+            .path = f->path,
+            .row = ce[i].row,
+            .col = ce[i].col,
+            .kind = (SymbolKind) ce[i].kind,
+        };
+    }
+    file_replace(f, entries, (int) cf->count);
+    free(entries);
+    return 0;
+}
+
+static int cmp_path_entry(const void *a, const void *b){
+    const ProjectEntry *x = a, *y = b;
+    int c = strcmp(x->path, y->path);
+    if (c == 0) c = (x->row > y->row) - (x->row < y->row);
+    if (c == 0) c = (x->col > y->col) - (x->col < y->col);
+    return c;
+}
+
+// write what is in the index now, between passes
+static void cache_write(void){
+    if (!g_cache_path) return;
+    // no worker is running, so the shards cannot change under us
+    size_t total = 0;
+    for (int s = 0; s < PROJECT_SHARDS; s++) total += (size_t) g_shards[s].count;
+    ProjectEntry *all = malloc(sizeof(ProjectEntry) * (total ? total : 1));
+    if (!all) return;
+    size_t k = 0;
+    for (int s = 0; s < PROJECT_SHARDS; s++) {
+        memcpy(all + k, g_shards[s].entries, sizeof(ProjectEntry) * (size_t) g_shards[s].count);
+        k += (size_t) g_shards[s].count;
+    }
+    // g_files is sorted by path as well
+    qsort(all, total, sizeof(ProjectEntry), cmp_path_entry);
+
+    size_t strings_len = 0;
+    for (int i = 0; i < g_files.count; i++) strings_len += strlen(g_files.files[i].path) + 1;
+    for (k = 0; k < total; k++) strings_len += strlen(all[k].name) + 1;
+    size_t len = sizeof(CacheHeader) + sizeof(CacheFile) * (size_t) g_files.count +
+                 sizeof(CacheEntry) * total + strings_len;
+    char *buf = calloc(1, len);
+    size_t tmp_size = strlen(g_cache_path) + 8;
+    char *tmp = malloc(tmp_size);
+    if (!buf || !tmp || total > UINT32_MAX) {
+        free(buf);
+        free(tmp);
+        free(all);
+        return;
+    }
+
+    CacheHeader *hdr = (CacheHeader *) buf;
+    memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->file_size = sizeof(CacheFile);
+    hdr->entry_size = sizeof(CacheEntry);
+    hdr->nfiles = (uint32_t) g_files.count;
+    hdr->nentries = (uint32_t) total;
+    hdr->strings_len = strings_len;
+    CacheFile *files = (CacheFile *) (hdr + 1);
+    CacheEntry *entries = (CacheEntry *) (files + g_files.count);
+    char *strings = (char *) (entries + total);
+    size_t at = 0;
+    k = 0;
+    for (int i = 0; i < g_files.count; i++) {
+        const ProjectFile *f = &g_files.files[i];
+        files[i] = (CacheFile) {
+            .path = at,
+            .size = (uint64_t) f->size,
+            .mtime_sec = (int64_t) f->mtime.tv_sec,
+            .mtime_nsec = (int64_t) f->mtime.tv_nsec,
+            .first = (uint32_t) k,
+        };
+        size_t n = strlen(f->path) + 1;
+        memcpy(strings + at, f->path, n);
+        at += n;
+        for (; k < total && all[k].path == f->path; k++) {
+            entries[k] = (CacheEntry) { at, all[k].row, all[k].col, (int32_t) all[k].kind, 0 };
+            n = strlen(all[k].name) + 1;
+            memcpy(strings + at, all[k].name, n);
+            at += n;
+        }
+        files[i].count = (uint32_t) k - files[i].first;
+    }
+    free(all);
+
+    // written next to the old cache, which stays mapped
+    snprintf(tmp, tmp_size, "%s.XXXXXX", g_cache_path);
+    int fd = mkstemp(tmp);
+    if (fd != -1) {
+        int rc = writeFully(fd, buf, len);
+        if (close(fd) == -1) rc = -1;
+        if (rc == 0 && rename(tmp, g_cache_path) == 0) {
+            // nothing left to clean up
+        } else {
+            unlink(tmp);
+        }
+    }
+    free(tmp);
+    free(buf);
+}
+
+// find what changed since the last pass and have the workers read it
+static void scan_pass(void){
+    FileList found = {0};
+    scan_dir(&found, g_root, 0);
+    qsort(found.files, (size_t) found.count, sizeof(ProjectFile), cmp_file);
+    int *jobs = malloc(sizeof(int) * (size_t) (found.count ? found.count : 1));
+    if (!jobs) {
+        for (int i = 0; i < found.count; i++) free(found.files[i].path);
+        free(found.files);
+        return;
+    }
+
+    // both lists are sorted by path: walk them side by side
+    int njobs = 0, removed = 0, cached = 0, i = 0, j = 0;
+    while (i < g_files.count || j < found.count) {
+        int c = i == g_files.count ? 1 : j == found.count ? -1 :
+                strcmp(g_files.files[i].path, found.files[j].path);
+        if (c < 0) {
+            ProjectFile *f = &g_files.files[i++];
+            file_replace(f, NULL, 0);
+            free(f->path);
+            removed++;
+            continue;
+        }
+        if (c == 0) {
+            // entries point at the old copy of the path, so that one stays
+            ProjectFile *f = &g_files.files[i++];
+            free(found.files[j].path);
+            found.files[j].path = f->path;
+            found.files[j].shards = f->shards;
+            if (same_time(f->mtime, found.files[j].mtime) && f->size == found.files[j].size) {
+                j++;
+                continue;
+            }
+        } else {
+            // new to this run, perhaps not to the cache
+            const CacheFile *cf = cache_find(&found.files[j]);
+            if (cf && cache_load(&found.files[j], cf) == 0) {
+                cached++;
+                j++;
+                continue;
+            }
+        }
+        jobs[njobs++] = j++;
+    }
+    free(g_files.files);
+    g_files = found;
+
+    pthread_mutex_lock(&g_lock);
+    free(g_jobs);
+    g_jobs = jobs;
+    g_njobs = njobs;
+    g_next_job = 0;
+    pthread_cond_broadcast(&g_work);
+    while (!g_stop && (g_next_job < g_njobs || g_busy > 0)) pthread_cond_wait(&g_done, &g_lock);
+    // after a stop, wait for the jobs already taken all the same, the
+    // workers use g_files until they are done
+    while (g_busy > 0) pthread_cond_wait(&g_done, &g_lock);
+    bool stop = g_stop;
+    pthread_mutex_unlock(&g_lock);
+
+    // a pass cut short would record files it never read; the cache only
+    // needs writing if something was parsed or dropped, or it still lists
+    // files that are gone
+    bool changed = njobs > 0 || removed > 0 || (cached > 0 && (uint32_t) cached != g_cache_hdr.nfiles);
+    if (!stop && changed) cache_write();
+}
+
+static void *scan_worker(void *arg){
+    (void) arg;
+    cache_open();
+    for (;;) {
+        scan_pass();
+
+        // the files are only looked at again when asked to, after a save
+        pthread_mutex_lock(&g_lock);
+        g_passes++;
+        g_scanning = false;
+        while (!g_stop && !g_rescan) pthread_cond_wait(&g_wake, &g_lock);
+        g_rescan = false;
+        g_scanning = true;
+        bool stop = g_stop;
+        pthread_mutex_unlock(&g_lock);
+        if (stop) return NULL;
+    }
+}
+
+// the directory of the project filename is in, the nearest one above it
+// holding .git; if there is none, the file's own directory and *found is
+// false. NULL if filename can't be resolved
+static char *find_root(const char *filename, bool *found){
+    char *dir = realpath(filename, NULL);
+    if (!dir) return NULL;
+    char *probe = malloc(strlen(dir) + sizeof("/.git"));
+    if (!probe) {
+        free(dir);
+        return NULL;
+    }
+
+    // dir[0..end) is the directory looked at, empty for /
+    size_t file_dir = (size_t) (strrchr(dir, '/') - dir);
+    *found = false;
+    for (size_t end = file_dir;;) {
+        memcpy(probe, dir, end);
+        memcpy(probe + end, "/.git", sizeof("/.git"));
+        if (access(probe, F_OK) == 0) {
+            *found = true;
+            file_dir = end;
+            break;
+        }
+        if (end == 0) break;
+        while (end > 0 && dir[end - 1] != '/') end--;
+        end--;
+    }
+    free(probe);
+    if (file_dir == 0) strcpy(dir, "/");
+    else dir[file_dir] = '\0';
+    return dir;
+}
+
+int projectStart(const char *filename){
+    if (g_running) return -1;
+    bool found;
+    if (!(g_root = find_root(filename, &found))) return -1;
+    // outside a project only the file's own directory is read, and nothing
+    // is left behind in it
+    g_max_depth = found ? PROJECT_MAX_DEPTH : 0;
+    g_cache_path = NULL;
+    if (found) {
+        size_t size = strlen(g_root) + sizeof(CACHE_NAME) + 1;
+        if (!(g_cache_path = malloc(size))) {
+            free(g_root);
+            g_root = NULL;
+            return -1;
+        }
+        snprintf(g_cache_path, size, "%s/%s", g_root, CACHE_NAME);
+    }
+    for (int s = 0; s < PROJECT_SHARDS; s++) {
+        pthread_rwlock_init(&g_shards[s].lock, NULL);
+        pthread_mutex_init(&g_shards[s].write, NULL);
+        g_shards[s].entries = NULL;
+        g_shards[s].count = 0;
+    }
+    g_stop = g_rescan = false;
+    g_scanning = true;
+    g_passes = 0;
+
+    // leave a core to the editor itself
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = cores > 2 ? (int) cores - 1 : 1;
+    if (want > PROJECT_MAX_THREADS) want = PROJECT_MAX_THREADS;
+    for (g_nworkers = 0; g_nworkers < want; g_nworkers++) {
+        if (pthread_create(&g_workers[g_nworkers], NULL, index_worker, NULL) != 0) break;
+    }
+    g_have_scanner = g_nworkers > 0 && pthread_create(&g_scanner, NULL, scan_worker, NULL) == 0;
+    g_running = true;
+    if (!g_have_scanner) {
+        projectStop();
+        return -1;
+    }
+    return 0;
+}
+
+void projectStop(void){
+    if (!g_running) return;
+    pthread_mutex_lock(&g_lock);
+    g_stop = true;
+    pthread_cond_broadcast(&g_work);
+    pthread_cond_broadcast(&g_wake);
+    pthread_cond_broadcast(&g_done);
+    pthread_mutex_unlock(&g_lock);
+
+    if (g_have_scanner) pthread_join(g_scanner, NULL);
+    g_have_scanner = false;
+    for (int i = 0; i < g_nworkers; i++) pthread_join(g_workers[i], NULL);
+    g_nworkers = 0;
+
+    for (int s = 0; s < PROJECT_SHARDS; s++) {
+        for (int i = 0; i < g_shards[s].count; i++) free_name(g_shards[s].entries[i].name);
+        free(g_shards[s].entries);
+        g_shards[s].entries = NULL;
+        g_shards[s].count = 0;
+        pthread_rwlock_destroy(&g_shards[s].lock);
+        pthread_mutex_destroy(&g_shards[s].write);
+    }
+    for (int i = 0; i < g_files.count; i++) free(g_files.files[i].path);
+    free(g_files.files);
+    memset(&g_files, 0, sizeof(g_files));
+    free(g_jobs);
+    g_jobs = NULL;
+    g_njobs = g_next_job = g_busy = 0;
+    if (g_cache) munmap((void *) g_cache, g_cache_len);
+    g_cache = NULL;
+    g_cache_len = 0;
+    free(g_cache_path);
+    g_cache_path = NULL;
+    free(g_root);
+    g_root = NULL;
+    g_running = false;
+}
+
+unsigned projectRescan(void){
+    if (!g_running) return 0;
+    pthread_mutex_lock(&g_lock);
+    g_rescan = true;
+    pthread_cond_signal(&g_wake);
+    // a pass under way may have looked at the files already
+    unsigned target = g_passes + (g_scanning ? 2 : 1);
+    pthread_mutex_unlock(&g_lock);
+    return target;
+}
+
+unsigned projectPasses(void){
+    pthread_mutex_lock(&g_lock);
+    unsigned passes = g_passes;
+    pthread_mutex_unlock(&g_lock);
+    return passes;
+}
+
+// the first entry whose name is not before prefix
+static int lower_bound(const ProjectShard *s, const char *prefix){
+    int lo = 0, hi = s->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(s->entries[mid].name, prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int projectComplete(const char *prefix, char out[][MAX_WORD_LENGTH], int max){
+    if (!g_running || !prefix[0]) return 0;
+    ProjectShard *s = &g_shards[shard_of(prefix)];
+    // a worker is swapping the shard; the next keystroke will see it
+    if (pthread_rwlock_tryrdlock(&s->lock) != 0) return 0;
+    size_t plen = strlen(prefix);
+    int count = 0;
+    for (int i = lower_bound(s, prefix); i < s->count && count < max; i++) {
+        const ProjectEntry *e = &s->entries[i];
+        if (strncmp(e->name, prefix, plen) != 0) break;
+        if (e->kind == SYMBOL_FIELD) continue;
+        if (count > 0 && strcmp(out[count - 1], e->name) == 0) continue;
+        snprintf(out[count++], MAX_WORD_LENGTH, "%s", e->name);
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return count;
+}
+
+int projectFind(const char *name, char *path, size_t pathlen, int *row, int *col){
+    if (!g_running || !name[0]) return -1;
+    ProjectShard *s = &g_shards[shard_of(name)];
+    if (pthread_rwlock_tryrdlock(&s->lock) != 0) return -1;
+    const ProjectEntry *best = NULL;
+    for (int i = lower_bound(s, name); i < s->count && strcmp(s->entries[i].name, name) == 0; i++) {
+        if (!best || symbolKindRank(s->entries[i].kind) < symbolKindRank(best->kind)) best = &s->entries[i];
+    }
+    if (best) {
+        snprintf(path, pathlen, "%s", best->path);
+        *row = best->row;
+        *col = best->col;
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return best ? 0 : -1;
+}
@@ -0,0 +1,38 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include "common.h"
+
+/*** project index ***/
+// The names declared at file scope in every .c and .h file of a project,
+// for completing and finding names from other files. The project is the
+// nearest directory above the file being edited that holds .git; without
+// one only the file's own directory is read. Files are parsed in the
+// background by a pool of threads, one tree-sitter parser each, and those
+// whose modification time or size changed are read again on
+// projectRescan, which saving a file asks for. The index is split into
+// shards by the first byte of a name; lookups only try to take a shard's
+// lock and come back empty rather than wait for it. In a project what was
+// found is kept in .textedit.index in its root, so the next start only
+// parses the files that changed since.
+
+// start indexing the project filename is in; 0 on success, -1 if it is
+// already running, filename can't be resolved or no thread could be started
+int projectStart(const char *filename);
+// stop the threads and free the index
+void projectStop(void);
+// look at the files again now rather than at the next periodic rescan;
+// returns what projectPasses will be once the files as they are now
+// have been read
+unsigned projectRescan(void);
+// scans completed so far
+unsigned projectPasses(void);
+
+// up to max distinct names starting with prefix, in name order, leaving
+// out fields; returns how many were written to out
+int projectComplete(const char *prefix, char out[][MAX_WORD_LENGTH], int max);
+// where name is declared, a definition over a prototype; the file's path
+// goes into path. Returns 0, or -1 if it is not known (yet)
+int projectFind(const char *name, char *path, size_t pathlen, int *row, int *col);
+
+#endif
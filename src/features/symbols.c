@@ -0,0 +1,446 @@
+#include "symbols.h"
+#include "document.h"
+
+// The same symbols twice: g_by_pos in document order, g_by_name sorted
+// by name. Each symbol is allocated on its own so both can point at it.
+static Symbol **g_by_pos = NULL;
+static Symbol **g_by_name = NULL;
+static int g_count = 0;  // entries in g_by_pos
+static int g_named = 0;  // entries in g_by_name, the same once an update is done
+static int g_cap = 0;
+static bool g_built = false;
+
+// The bytes edited since the last update are [g_dirty_start, g_dirty_end]
+// now and were [g_dirty_start, g_dirty_old_end] then; symbols after them
+// move by the difference.
+static bool g_dirty = false;
+static uint32_t g_dirty_start, g_dirty_end, g_dirty_old_end;
+
+// symbols found in a stretch of the tree, before they go into the index;
+// names are read from text, or from the document if that is NULL
+typedef struct {
+    Symbol *syms;
+    int count;
+    int cap;
+    const char *text;
+} SymbolList;
+
+static int reserve(int count){
+    if (count <= g_cap) return 0;
+    int cap = g_cap ? g_cap : 256;
+    while (cap < count) cap *= 2;
+    Symbol **by_pos = realloc(g_by_pos, sizeof(Symbol *) * (size_t) cap);
+    if (!by_pos) return -1;
+    g_by_pos = by_pos;
+    Symbol **by_name = realloc(g_by_name, sizeof(Symbol *) * (size_t) cap);
+    if (!by_name) return -1;
+    g_by_name = by_name;
+    g_cap = cap;
+    return 0;
+}
+
+// first index in g_by_name whose name is not below name
+static int name_lower_bound(const char *name){
+    int lo = 0, hi = g_named;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(g_by_name[mid]->name, name) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// first index in g_by_pos at or after byte
+static int pos_lower_bound(uint32_t byte){
+    int lo = 0, hi = g_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (g_by_pos[mid]->byte < byte) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void name_insert(Symbol *s){
+    int i = name_lower_bound(s->name);
+    memmove(g_by_name + i + 1, g_by_name + i, sizeof(Symbol *) * (size_t) (g_named - i));
+    g_by_name[i] = s;
+    g_named++;
+}
+
+static void name_remove(const Symbol *s){
+    for (int i = name_lower_bound(s->name); i < g_named && strcmp(g_by_name[i]->name, s->name) == 0; i++) {
+        if (g_by_name[i] != s) continue;
+        memmove(g_by_name + i, g_by_name + i + 1, sizeof(Symbol *) * (size_t) (g_named - i - 1));
+        g_named--;
+        return;
+    }
+}
+
+static int cmp_name(const void *a, const void *b){
+    return strcmp((*(Symbol *const *) a)->name, (*(Symbol *const *) b)->name);
+}
+
+/*** reading symbols from the tree ***/
+
+// Top-level nodes are walked one at a time. Preprocessor conditionals are
+// looked through, so a header guard doesn't make the whole file one node.
+static bool is_conditional(const char *type){
+    return strcmp(type, "preproc_if") == 0 || strcmp(type, "preproc_ifdef") == 0 ||
+           strcmp(type, "preproc_else") == 0 || strcmp(type, "preproc_elif") == 0 ||
+           strcmp(type, "preproc_elifdef") == 0;
+}
+
+// move c down from a conditional to the first node in it
+static void item_enter(TSTreeCursor *c){
+    while (is_conditional(ts_node_type(ts_tree_cursor_current_node(c)))) {
+        if (!ts_tree_cursor_goto_first_child(c)) break;
+    }
+}
+
+// move c to the top-level node after the one it is on
+static bool item_next(TSTreeCursor *c){
+    while (!ts_tree_cursor_goto_next_sibling(c)) {
+        if (!ts_tree_cursor_goto_parent(c)) return false;
+    }
+    item_enter(c);
+    return true;
+}
+
+// move c to the first top-level node that ends at or after byte
+static bool item_seek(TSTreeCursor *c, uint32_t byte){
+    uint32_t goal = byte > 0 ? byte - 1 : 0;
+    if (ts_tree_cursor_goto_first_child_for_byte(c, goal) < 0) return false;
+    while (is_conditional(ts_node_type(ts_tree_cursor_current_node(c)))) {
+        if (ts_tree_cursor_goto_first_child_for_byte(c, goal) < 0) break;
+    }
+    return true;
+}
+
+static int list_add(SymbolList *l, TSNode n, SymbolKind kind){
+    uint32_t start = ts_node_start_byte(n);
+    uint32_t len = ts_node_end_byte(n) - start;
+    if (len == 0 || len >= MAX_WORD_LENGTH) return 0;
+    const char *chars = l->text ? l->text + start : NULL;
+    if (!chars) {
+        int col = 0;
+        int row = docRowAtByte(&E.doc, start, &col);
+        erow *r = docRow(&E.doc, row);
+        if (!r || col + (int) len > r->size) return 0;
+        chars = r->chars + col;
+    }
+
+    if (l->count == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 16;
+        Symbol *syms = realloc(l->syms, sizeof(Symbol) * (size_t) cap);
+        if (!syms) return -1;
+        l->syms = syms;
+        l->cap = cap;
+    }
+    char *name = malloc(len + 1);
+    if (!name) return -1;
+    memcpy(name, chars, len);
+    name[len] = '\0';
+    l->syms[l->count++] = (Symbol){ .name = name, .byte = start, .kind = kind };
+    return 0;
+}
+
+// what a node of type declares, given the field it is in and its parent;
+// -1 if nothing
+static int classify(const char *type, const char *field, TSNode parent, bool definition){
+    const char *ptype = ts_node_type(parent);
+    if (strcmp(field, "declarator") == 0) {
+        if (strcmp(type, "field_identifier") == 0) return SYMBOL_FIELD;
+        if (strcmp(type, "type_identifier") == 0) return SYMBOL_TYPE;
+        if (strcmp(type, "identifier") != 0) return -1;
+        if (strcmp(ptype, "function_declarator") != 0) return SYMBOL_VARIABLE;
+        return definition ? SYMBOL_FUNCTION : SYMBOL_PROTOTYPE;
+    }
+    if (strcmp(field, "name") == 0) {
+        // struct foo *p; only mentions the tag, the one with a body declares it
+        if (strcmp(type, "type_identifier") == 0) {
+            return ts_node_is_null(ts_node_child_by_field_name(parent, "body", 4)) ? -1 : SYMBOL_TYPE;
+        }
+        if (strcmp(type, "identifier") != 0) return -1;
+        if (strcmp(ptype, "enumerator") == 0) return SYMBOL_ENUMERATOR;
+        if (strcmp(ptype, "preproc_def") == 0 || strcmp(ptype, "preproc_function_def") == 0) {
+            return SYMBOL_MACRO;
+        }
+    }
+    return -1;
+}
+
+// collect what the node under c and its children declare; function
+// bodies, parameters and initializers declare nothing at file scope
+static int extract(SymbolList *l, TSTreeCursor *c, TSNode parent, bool definition){
+    TSNode n = ts_tree_cursor_current_node(c);
+    const char *type = ts_node_type(n);
+    const char *field = ts_tree_cursor_current_field_name(c);
+    if (field) {
+        int kind = classify(type, field, parent, definition);
+        if (kind >= 0 && list_add(l, n, (SymbolKind) kind) != 0) return -1;
+        if (strcmp(field, "value") == 0) return 0;
+    }
+    if (strcmp(type, "compound_statement") == 0 || strcmp(type, "parameter_list") == 0) return 0;
+    if (strcmp(type, "function_definition") == 0) definition = true;
+    if (!ts_tree_cursor_goto_first_child(c)) return 0;
+    int rc = 0;
+    do {
+        rc = extract(l, c, n, definition);
+    } while (rc == 0 && ts_tree_cursor_goto_next_sibling(c));
+    ts_tree_cursor_goto_parent(c);
+    return rc;
+}
+
+static int extract_item(SymbolList *l, TSNode item){
+    TSNode none = {0};
+    TSTreeCursor c = ts_tree_cursor_new(item);
+    int rc = extract(l, &c, none, false);
+    ts_tree_cursor_delete(&c);
+    return rc;
+}
+
+static void list_free(SymbolList *l){
+    for (int i = 0; i < l->count; i++) free(l->syms[i].name);
+    free(l->syms);
+    memset(l, 0, sizeof(*l));
+}
+
+// every top-level node under root
+static int read_all(SymbolList *l, TSNode root){
+    TSTreeCursor c = ts_tree_cursor_new(root);
+    bool more = ts_tree_cursor_goto_first_child(&c);
+    if (more) item_enter(&c);
+    int rc = 0;
+    while (more && rc == 0) {
+        rc = extract_item(l, ts_tree_cursor_current_node(&c));
+        more = item_next(&c);
+    }
+    ts_tree_cursor_delete(&c);
+    return rc;
+}
+
+int symbolsRead(TSNode root, const char *text, Symbol **out){
+    SymbolList l = { .text = text };
+    if (read_all(&l, root) != 0) {
+        list_free(&l);
+        return -1;
+    }
+    *out = l.syms;
+    return l.count;
+}
+
+void symbolsFreeList(Symbol *syms, int count){
+    for (int i = 0; i < count; i++) free(syms[i].name);
+    free(syms);
+}
+
+/*** keeping the index up to date ***/
+
+void symbolsNoteEdit(uint32_t start, uint32_t old_end, uint32_t new_end){
+    if (!g_built) return;
+    if (!g_dirty) {
+        g_dirty = true;
+        g_dirty_start = start;
+        g_dirty_end = new_end;
+        g_dirty_old_end = old_end;
+        return;
+    }
+    if (start < g_dirty_start) g_dirty_start = start;
+    if (old_end > g_dirty_end) {
+        // reaches past what was edited before; the rest of it is unmoved
+        g_dirty_old_end += old_end - g_dirty_end;
+        g_dirty_end = new_end;
+    } else {
+        g_dirty_end = g_dirty_end + new_end - old_end;
+    }
+}
+
+static int build(TSNode root){
+    SymbolList l = {0};
+    if (read_all(&l, root) != 0 || reserve(l.count) != 0) {
+        list_free(&l);
+        return -1;
+    }
+
+    for (int i = 0; i < l.count; i++) {
+        Symbol *s = malloc(sizeof(Symbol));
+        if (!s) {
+            for (int j = i; j < l.count; j++) free(l.syms[j].name);
+            l.count = i;
+            break;
+        }
+        *s = l.syms[i];
+        g_by_pos[i] = g_by_name[i] = s;
+    }
+    g_count = g_named = l.count;
+    free(l.syms);
+    qsort(g_by_name, (size_t) g_named, sizeof(Symbol *), cmp_name);
+    g_built = true;
+    return 0;
+}
+
+static void drop(Symbol *s){
+    name_remove(s);
+    free(s->name);
+    free(s);
+}
+
+static bool same(const Symbol *a, const Symbol *b){
+    return a->kind == b->kind && strcmp(a->name, b->name) == 0;
+}
+
+// Replace the symbols g_by_pos[lo, hi) with those in l. Most edits leave
+// the names alone, so old symbols that match up with new ones are kept and
+// only move; the name order then doesn't change.
+static int splice(int lo, int hi, SymbolList *l){
+    if (reserve(g_count + l->count) != 0) return -1;
+    Symbol **keep = malloc(sizeof(Symbol *) * (size_t) (l->count ? l->count : 1));
+    if (!keep) return -1;
+
+    int j = lo, n = 0;
+    for (int i = 0; i < l->count; i++) {
+        Symbol *s = &l->syms[i];
+        Symbol *old = NULL;
+        if (j < hi && same(g_by_pos[j], s)) {
+            old = g_by_pos[j++];
+        } else if (j + 1 < hi && same(g_by_pos[j + 1], s)) {
+            drop(g_by_pos[j]);
+            j++;
+            old = g_by_pos[j++];
+        }
+        if (old) {
+            old->byte = s->byte;
+            free(s->name);
+        } else {
+            old = malloc(sizeof(Symbol));
+            if (!old) {
+                free(s->name);
+                continue;
+            }
+            *old = *s;
+            name_insert(old);
+        }
+        keep[n++] = old;
+    }
+    for (; j < hi; j++) drop(g_by_pos[j]);
+    l->count = 0;
+
+    memmove(g_by_pos + lo + n, g_by_pos + hi, sizeof(Symbol *) * (size_t) (g_count - hi));
+    memcpy(g_by_pos + lo, keep, sizeof(Symbol *) * (size_t) n);
+    g_count += n - (hi - lo);
+    free(keep);
+    return 0;
+}
+
+void symbolsUpdate(TSNode root, const TSRange *changed, uint32_t nchanged){
+    if (!g_built) {
+        if (build(root) != 0) symbolsClear();
+        g_dirty = false;
+        return;
+    }
+
+    // syntax can change away from the edits too, say when a comment is
+    // opened; those ranges are in the new tree's bytes
+    for (uint32_t i = 0; i < nchanged; i++) {
+        if (!g_dirty) {
+            g_dirty = true;
+            g_dirty_start = changed[i].start_byte;
+            g_dirty_end = g_dirty_old_end = changed[i].end_byte;
+            continue;
+        }
+        if (changed[i].start_byte < g_dirty_start) g_dirty_start = changed[i].start_byte;
+        if (changed[i].end_byte > g_dirty_end) {
+            g_dirty_old_end += changed[i].end_byte - g_dirty_end;
+            g_dirty_end = changed[i].end_byte;
+        }
+    }
+    if (!g_dirty) return;
+    g_dirty = false;
+
+    // read again the top-level nodes touching the edits, [start, end)
+    SymbolList l = {0};
+    uint32_t start = g_dirty_start, end = g_dirty_end;
+    TSTreeCursor c = ts_tree_cursor_new(root);
+    bool more = item_seek(&c, g_dirty_start);
+    int rc = 0;
+    while (more && rc == 0) {
+        TSNode item = ts_tree_cursor_current_node(&c);
+        uint32_t s = ts_node_start_byte(item), e = ts_node_end_byte(item);
+        if (s > g_dirty_end) break;
+        if (s < start) start = s;
+        if (e > end) end = e;
+        rc = extract_item(&l, item);
+        more = item_next(&c);
+    }
+    ts_tree_cursor_delete(&c);
+
+    // in the old bytes the same stretch is [start, old_end)
+    int64_t delta = (int64_t) g_dirty_end - (int64_t) g_dirty_old_end;
+    uint32_t old_end = (uint32_t) ((int64_t) end - delta);
+    int lo = pos_lower_bound(start);
+    int hi = pos_lower_bound(old_end);
+    for (int i = hi; i < g_count; i++) {
+        g_by_pos[i]->byte = (uint32_t) ((int64_t) g_by_pos[i]->byte + delta);
+    }
+    if (rc != 0 || splice(lo, hi, &l) != 0) symbolsClear();
+    list_free(&l);
+}
+
+void symbolsClear(void){
+    for (int i = 0; i < g_count; i++) {
+        free(g_by_pos[i]->name);
+        free(g_by_pos[i]);
+    }
+    g_count = g_named = 0;
+    g_built = false;
+    g_dirty = false;
+}
+
+void symbolsFree(void){
+    symbolsClear();
+    free(g_by_pos);
+    free(g_by_name);
+    g_by_pos = g_by_name = NULL;
+    g_cap = 0;
+}
+
+/*** lookups ***/
+
+int symbolsComplete(const char *prefix, const Symbol **out, int max){
+    size_t len = strlen(prefix);
+    int n = 0;
+    for (int i = name_lower_bound(prefix); i < g_named && n < max; i++) {
+        const Symbol *s = g_by_name[i];
+        if (strncmp(s->name, prefix, len) != 0) break;
+        if (s->kind == SYMBOL_FIELD) continue;
+        if (n > 0 && strcmp(out[n - 1]->name, s->name) == 0) continue;
+        out[n++] = s;
+    }
+    return n;
+}
+
+int symbolKindRank(SymbolKind kind){
+    if (kind == SYMBOL_FIELD) return 2;
+    return kind == SYMBOL_PROTOTYPE ? 1 : 0;
+}
+
+const Symbol *symbolsFind(const char *name){
+    const Symbol *best = NULL;
+    for (int i = name_lower_bound(name); i < g_named && strcmp(g_by_name[i]->name, name) == 0; i++) {
+        const Symbol *s = g_by_name[i];
+        if (!best || symbolKindRank(s->kind) < symbolKindRank(best->kind) ||
+            (symbolKindRank(s->kind) == symbolKindRank(best->kind) && s->byte < best->byte)) {
+            best = s;
+        }
+    }
+    return best;
+}
+
+int symbolsCount(void){
+    return g_count;
+}
+
+const Symbol *symbolsAt(int i){
+    return i >= 0 && i < g_count ? g_by_pos[i] : NULL;
+}
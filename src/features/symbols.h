@@ -0,0 +1,59 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "common.h"
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+/*** symbol index ***/
+// The names declared at file scope: functions, globals, typedefs, tags,
+// struct fields, enum constants and macros, with where they are declared.
+// It is kept sorted by name for prefix lookups and in document order for
+// an outline. After a reparse only the top-level declarations around the
+// edits are walked again; everything else keeps its entries and, past the
+// edits, has its positions moved.
+
+typedef enum {
+    SYMBOL_FUNCTION,
+    SYMBOL_PROTOTYPE, // a function declared without a body
+    SYMBOL_VARIABLE,
+    SYMBOL_TYPE,      // typedef, struct, union or enum tag
+    SYMBOL_FIELD,
+    SYMBOL_ENUMERATOR,
+    SYMBOL_MACRO
+} SymbolKind;
+
+typedef struct {
+    char *name;
+    uint32_t byte; // where the name is, in the document
+    SymbolKind kind;
+} Symbol;
+
+// an edit to the document, in bytes, before the next symbolsUpdate
+void symbolsNoteEdit(uint32_t start, uint32_t old_end, uint32_t new_end);
+// bring the index up to date with the tree rooted at root, given the
+// ranges tree-sitter reported as changed since the last update
+void symbolsUpdate(TSNode root, const TSRange *changed, uint32_t nchanged);
+// forget everything; the next update reads the whole tree
+void symbolsClear(void);
+void symbolsFree(void);
+
+// the file-scope symbols of a tree parsed from text rather than the
+// document, in document order; safe on any thread. Returns how many were
+// put in *out, to be freed with symbolsFreeList, or -1
+int symbolsRead(TSNode root, const char *text, Symbol **out);
+void symbolsFreeList(Symbol *syms, int count);
+
+// up to max symbols with distinct names starting with prefix, in name
+// order, leaving out fields; returns how many were written to out
+int symbolsComplete(const char *prefix, const Symbol **out, int max);
+// the declaration name most likely refers to: a definition over a
+// prototype, anything over a field; NULL if there is none
+const Symbol *symbolsFind(const char *name);
+// how a declaration of this kind ranks in that choice, lower first
+int symbolKindRank(SymbolKind kind);
+// all symbols in document order, for an outline
+int symbolsCount(void);
+const Symbol *symbolsAt(int i);
+
+#endif
@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "syntax.h"
+#include "symbols.h"
+#include "document.h"
 
 extern const TSLanguage *tree_sitter_c(void);
 
@@ -12,39 +15,46 @@ static TSQuery          *g_query = NULL;
 static TSQueryCursor    *g_cursor = NULL;
 static const TSLanguage *g_lang = NULL;
 
-//static const char *k_ident_query = "(identifier) @id";
-
-// Tier 1: locals + params
-static const char *k_query_locals =
-"(parameter_declaration declarator: (identifier) @id) "
-"(declaration declarator: (init_declarator declarator: (identifier) @id))";
-
-
-
-// // Tier 2: struct/union fields
-// static const char *k_query_fields = 
-// "(field_declaration declarator: (field_identifier) @field_id)";
-
-// // Tier 3: file-scope globals/types/functions/enums
-// static const char *k_query_globals =
-// "(declaration declarator: (init_declarator declarator: (identifier) @global_id))"
-// "(type_definition declarator: (type_identifier) @global_id)"
-// "(function_definition declarator: (function_declarator declarator: (identifier) @global_id))"
-// "(enum_specifier name: (identifier) @global_id)"
-// "(preproc_def name: (identifier) @global_id)";
-
-// static const char *k_query_locals = "(identifier) @id";
-static const char *k_query_fields = "(field_identifier) @id";
-static const char *k_query_globals = "(identifier) @id";
-
-
-// full source code texts with lines separated by \n and len of buffer
-static char *g_full_text = NULL;
-static size_t g_full_len = 0;
-
-// Byte offset at the start of each row (converting from editor rows, cols to byte mapping in flat buffer)
-static size_t *g_row_byte_offsets = NULL;
-static int g_row_offsets_count = 0;
+// Completion candidates come from one walk outward from the cursor: the
+// innermost block first, then the blocks around it and the function, up to
+// the top-level declaration. Each level walks its subtree except the child
+// the walk came up from, so no node is visited twice, and the walk stops
+// as soon as it has MAX_SUGGESTIONS names. What is declared at file scope
+// comes from the symbol index after that.
+
+// slots of the set of names found so far; a power of two well over
+// MAX_SUGGESTIONS so probes stay short
+#define NAME_SLOTS 32
+
+typedef struct {
+    const char *prefix;
+    size_t prefix_len;
+    uint32_t cursor_byte;
+    char (*out)[MAX_WORD_LENGTH];
+    int count;
+    signed char slots[NAME_SLOTS]; // index into out, -1 if empty
+} ScopeWalk;
+
+// nodes from the root down to the one at the cursor, kept between calls
+static TSNode *g_scope_path = NULL;
+static int g_scope_path_cap = 0;
+
+// set when the buffer was edited after the last parse
+static bool g_tree_stale = false;
+
+// Highlight spans cached per row for a window of rows around the viewport.
+// g_hl_rows[i] holds the spans of row g_hl_first + i, sorted by start column
+// and not overlapping.
+typedef struct {
+    HighlightSpan *spans;
+    int count;
+    int cap;
+    bool valid;
+} RowSpans;
+
+static RowSpans *g_hl_rows = NULL;
+static int g_hl_first = 0;
+static int g_hl_len = 0;
 
 // Function to debug syntax tree
 void syntaxDebugDumpTree(void) {
@@ -82,142 +92,54 @@ static char *read_file_to_string(const char *path, size_t *output_len){
     return buf;
 }
 
-static int prefix_match(const char* s, const char* prefix){
-    int n = strlen(prefix);
-    return n == 0 || strncmp(s, prefix, n) == 0;
-}
-
-static int append_unique(char out[][MAX_WORD_LENGTH], int max_out,
-                            int *count, const char* s)
-{
-    for (int i = 0; i < *count; i++){
-        if (strcmp(out[i], s) == 0) return 0;
-    }
-
-    if (*count >= max_out) return 0;
-    strncpy(out[*count], s, MAX_WORD_LENGTH - 1);
-    out[*count][MAX_WORD_LENGTH - 1] = '\0';
-    (*count)++;
+// copy len bytes starting at byte offset start into out, which must hold
+// len + 1 bytes. Only single-row ranges are supported, which covers identifiers
+static int copy_text(uint32_t start, uint32_t len, char *out){
+    int col = 0;
+    int row = docRowAtByte(&E.doc, start, &col);
+    erow *r = docRow(&E.doc, row);
+    if (!r || col + (int) len > r->size) return 0;
+    memcpy(out, r->chars + col, len);
+    out[len] = '\0';
     return 1;
 }
 
-static TSNode find_enclosing_type(TSNode node, const char* type_name){
-    while (!ts_node_is_null(node)){
-        const char *type = ts_node_type(node);
-        if (strcmp(type, type_name) == 0) return node;
-        node = ts_node_parent(node);
-    }
-    TSNode null_node = {0};
-    return null_node;
-}
-
-static TSNode node_at_byte(TSNode root, uint32_t b){
-    return ts_node_descendant_for_byte_range(root, b, b);
-}
-
-
-static int collect_ids(TSNode scope, const char *qsrc,
-                        const char *prefix,
-                        char out[][MAX_WORD_LENGTH], int max_out, uint32_t cursor_byte)
-{
-    if (ts_node_is_null(scope)) return 0;
-
-    TSQueryError err;
-    uint32_t err_offset = 0;
-    TSQuery *q = ts_query_new(g_lang, qsrc, (uint32_t)strlen(qsrc), &err_offset, &err);
-
-    if (!q) {
-        fprintf(stderr, "query err=%d offset=%u\n", err, err_offset);
-        return 0;
-    }
-
-
-    TSQueryCursor *cur = ts_query_cursor_new();
-    ts_query_cursor_exec(cur, q, scope);
-
-    int count = 0;
-    TSQueryMatch m;
-    while (ts_query_cursor_next_match(cur, &m) && count < max_out){
-        for (uint32_t i = 0; i < m.capture_count; i++){
-            TSNode id = m.captures[i].node;
-            uint32_t s = ts_node_start_byte(id);
-            uint32_t e = ts_node_end_byte(id);
-            if (cursor_byte >= s && cursor_byte < e) continue;
-            uint32_t len = e > s ? e - s : 0;
-            if (len == 0 || len >= MAX_WORD_LENGTH) continue;
-
-            char tmp[MAX_WORD_LENGTH];
-            memcpy(tmp, g_full_text + s, len);
-            tmp[len] = '\0';
-
-            if (!prefix_match(tmp, prefix)) continue;
-            append_unique(out, max_out, &count, tmp);
-            if (count >= max_out) break;
-        }
-    }
-
-    ts_query_cursor_delete(cur);
-    ts_query_delete(q);
-
-    return count;
-
-}
-
-// build g_full_text and g_row_byte_offsets from E
-static void rebuild_full_text(void){
-    //free old
-    free(g_full_text); g_full_text = NULL; g_full_len = 0;
-    free(g_row_byte_offsets); g_row_byte_offsets = NULL; g_row_offsets_count = 0;
-
-    if (E.numrows <= 0){
-        g_full_text = strdup("");
-        g_full_len = 0;
-        g_row_offsets_count = 0;
-        return;
+// TSInput callback: hand tree-sitter the rest of the row holding byte_index,
+// or the '\n' that ends it, straight from the document without copying
+static const char *read_document(void *payload, uint32_t byte_index,
+                                 TSPoint position, uint32_t *bytes_read){
+    (void) payload;
+    (void) position;
+    if (byte_index >= docLength(&E.doc)) {
+        *bytes_read = 0;
+        return "";
     }
 
-    // total bytes with \n joins
-    size_t total = 0;
-    for (int i = 0; i < E.numrows; i++) total += (size_t) E.row[i].size + 1; // +1 for \n
-
-    if (total > 0) total -= 1; // get rid of newline
-
-    g_full_text = malloc(total + 1);
-    if (!g_full_text) { g_full_len = 0; return;}
-
-    g_row_byte_offsets = malloc(sizeof(size_t) * (size_t)E.numrows);
-    if (!g_row_byte_offsets) { free(g_full_text); g_full_len = 0; return;}
-
-    size_t pos = 0;
-
-    for (int i = 0; i < E.numrows; i++){
-        g_row_byte_offsets[i] = pos;
-        memcpy(g_full_text + pos, E.row[i].chars, (size_t)E.row[i].size);
-        pos += (size_t) E.row[i].size;
-        if (i < E.numrows - 1){
-            g_full_text[pos++] = '\n';
-        }
+    int col = 0;
+    int row = docRowAtByte(&E.doc, byte_index, &col);
+    erow *r = docRow(&E.doc, row);
+    if (col < r->size) {
+        *bytes_read = (uint32_t) (r->size - col);
+        return r->chars + col;
     }
-
-    g_full_text[pos] = '\0';
-    g_full_len = pos;
-    g_row_offsets_count = E.numrows;
+    *bytes_read = 1;
+    return "\n";
 }
 
 // convert (row, col) -> byte offset
 static size_t row_col_to_byte(int row, int col){
-    if (row < 0 || row >= g_row_offsets_count) return 0;
+    erow *r = docRow(&E.doc, row);
+    if (!r) return 0;
 
-    size_t base = g_row_byte_offsets[row];
-    size_t line_len = (size_t) E.row[row].size;
+    size_t base = docRowOffset(&E.doc, row);
     if (col < 0) col = 0;
-    if ((size_t) col > line_len) col = (int) line_len;
+    if (col > r->size) col = r->size;
     return base + (size_t) col;
 }
 
 bool syntaxCursorOnDeclaratorName(int row, int col) {
     if (col > 0) col -= 1;
-    if (!g_tree || !g_row_byte_offsets) return false;
+    if (!g_tree) return false;
 
     uint32_t b = (uint32_t) row_col_to_byte(row, col);
     TSNode root = ts_tree_root_node(g_tree);
@@ -241,6 +163,153 @@ bool syntaxCursorOnDeclaratorName(int row, int col) {
 
 
 
+/*** highlight cache ***/
+
+static void hl_reset(void){
+    for (int i = 0; i < g_hl_len; i++) free(g_hl_rows[i].spans);
+    free(g_hl_rows);
+    g_hl_rows = NULL;
+    g_hl_first = 0;
+    g_hl_len = 0;
+}
+
+static void hl_invalidate(int first_row, int last_row){
+    if (first_row < g_hl_first) first_row = g_hl_first;
+    if (last_row >= g_hl_first + g_hl_len) last_row = g_hl_first + g_hl_len - 1;
+    for (int row = first_row; row <= last_row; row++){
+        g_hl_rows[row - g_hl_first].count = 0;
+        g_hl_rows[row - g_hl_first].valid = false;
+    }
+}
+
+// Move the cache to rows [first, first + len). Cached row r is kept as row r
+// when r < edit_start, as row r + delta when r > edit_old_end, and dropped
+// when it lies inside the edit.
+static void hl_remap(int first, int len, int edit_start, int edit_old_end, int delta){
+    RowSpans *rows = calloc((size_t) len, sizeof(RowSpans));
+    if (!rows) { hl_reset(); return; }
+
+    for (int i = 0; i < g_hl_len; i++){
+        int r = g_hl_first + i;
+        if (r >= edit_start) r = r > edit_old_end ? r + delta : -1;
+        if (r >= first && r < first + len) rows[r - first] = g_hl_rows[i];
+        else free(g_hl_rows[i].spans);
+    }
+    free(g_hl_rows);
+    g_hl_rows = rows;
+    g_hl_first = first;
+    g_hl_len = len;
+}
+
+// make sure [first_row, last_row] is inside the cache window, keeping a
+// screenful of margin on both sides so scrolling reuses cached rows
+static void hl_cover(int first_row, int last_row){
+    if (g_hl_rows && first_row >= g_hl_first && last_row < g_hl_first + g_hl_len) return;
+    int height = last_row - first_row + 1;
+    int first = first_row - height;
+    if (first < 0) first = 0;
+    hl_remap(first, last_row + height + 1 - first, INT_MAX, INT_MAX, 0);
+}
+
+// rows [start_row, old_end_row] were replaced by [start_row, new_end_row]
+static void hl_apply_edit(int start_row, int old_end_row, int new_end_row){
+    if (!g_hl_rows || start_row >= g_hl_first + g_hl_len) return;
+    int delta = new_end_row - old_end_row;
+    if (delta == 0) {
+        hl_invalidate(start_row, old_end_row);
+    } else {
+        hl_remap(g_hl_first, g_hl_len, start_row, old_end_row, delta);
+    }
+}
+
+static void hl_push(RowSpans *rs, HighlightSpan hs){
+    if (rs->count == rs->cap){
+        int cap = rs->cap ? rs->cap * 2 : 8;
+        HighlightSpan *spans = realloc(rs->spans, sizeof(HighlightSpan) * (size_t) cap);
+        if (!spans) return;
+        rs->spans = spans;
+        rs->cap = cap;
+    }
+    rs->spans[rs->count++] = hs;
+}
+
+static int cmp_int(const void *a, const void *b){
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+// Turn the spans of a row, in query match order, into sorted runs that do
+// not overlap. Where captures overlap the earliest match wins, same as the
+// old per-character scan did.
+static void hl_flatten(RowSpans *rs){
+    bool sorted = true;
+    for (int i = 1; i < rs->count && sorted; i++){
+        sorted = rs->spans[i].start_col >= rs->spans[i - 1].end_col;
+    }
+    if (sorted) return;
+
+    int nbounds = rs->count * 2;
+    int *bounds = malloc(sizeof(int) * (size_t) nbounds);
+    HighlightSpan *runs = malloc(sizeof(HighlightSpan) * (size_t) nbounds);
+    if (!bounds || !runs) { free(bounds); free(runs); return; }
+
+    for (int i = 0; i < rs->count; i++){
+        bounds[2 * i] = rs->spans[i].start_col;
+        bounds[2 * i + 1] = rs->spans[i].end_col;
+    }
+    qsort(bounds, (size_t) nbounds, sizeof(int), cmp_int);
+
+    int nruns = 0;
+    for (int b = 0; b + 1 < nbounds; b++){
+        int start = bounds[b], end = bounds[b + 1];
+        if (start == end) continue;
+
+        int color = 39;
+        for (int i = 0; i < rs->count; i++){
+            if (rs->spans[i].start_col <= start && rs->spans[i].end_col >= end){
+                color = rs->spans[i].color_id;
+                break;
+            }
+        }
+        if (color == 39) continue;
+
+        if (nruns > 0 && runs[nruns - 1].end_col == start && runs[nruns - 1].color_id == color){
+            runs[nruns - 1].end_col = end;
+        } else {
+            runs[nruns].row = rs->spans[0].row;
+            runs[nruns].start_col = start;
+            runs[nruns].end_col = end;
+            runs[nruns].color_id = color;
+            nruns++;
+        }
+    }
+
+    free(bounds);
+    free(rs->spans);
+    rs->spans = runs;
+    rs->count = nruns;
+    rs->cap = nbounds;
+}
+
+// keep g_tree in step with the buffer so the next parse can reuse it
+static void on_doc_edit(const DocEdit *e, void *ctx){
+    (void) ctx;
+    g_tree_stale = true;
+    hl_apply_edit(e->start_row, e->old_end_row, e->new_end_row);
+    symbolsNoteEdit((uint32_t) e->start_byte, (uint32_t) e->old_end_byte, (uint32_t) e->new_end_byte);
+    if (!g_tree) return;
+
+    TSInputEdit edit = {
+        .start_byte = (uint32_t) e->start_byte,
+        .old_end_byte = (uint32_t) e->old_end_byte,
+        .new_end_byte = (uint32_t) e->new_end_byte,
+        .start_point = { (uint32_t) e->start_row, (uint32_t) e->start_col },
+        .old_end_point = { (uint32_t) e->old_end_row, (uint32_t) e->old_end_col },
+        .new_end_point = { (uint32_t) e->new_end_row, (uint32_t) e->new_end_col },
+    };
+    ts_tree_edit(g_tree, &edit);
+}
+
 int syntaxInit(const char *lang_name, const char *query_path){
     (void) lang_name;
     g_parser = ts_parser_new();
@@ -273,6 +342,8 @@ int syntaxInit(const char *lang_name, const char *query_path){
     g_cursor = ts_query_cursor_new();
     if (!g_cursor) return -4;
 
+    docSetEditListener(&E.doc, on_doc_edit, NULL);
+
     // Don't parse initially - tree will be NULL until first reparse
 
     return 0;
@@ -280,22 +351,53 @@ int syntaxInit(const char *lang_name, const char *query_path){
 
 }
 
-int syntaxReparseFull(void) {
+int syntaxReparse(void) {
     if (!g_parser) return -1;
-
-    rebuild_full_text();
+    if (g_tree && !g_tree_stale) return 0;
 
     // reset query cursor to ensure it uses current tree
     if (g_cursor) ts_query_cursor_delete(g_cursor);
     g_cursor = ts_query_cursor_new();
-    TSTree *new_tree = ts_parser_parse_string(g_parser, NULL, g_full_text, (uint32_t)g_full_len);
+
+    // g_tree has already been adjusted by every edit since the last parse,
+    // so tree-sitter only re-lexes the regions those edits touched
+    TSInput input = {
+        .payload = NULL,
+        .read = read_document,
+        .encoding = TSInputEncodingUTF8,
+    };
+    TSTree *new_tree = ts_parser_parse(g_parser, g_tree, input);
     if (!new_tree) return -2;
-    if (g_tree) ts_tree_delete(g_tree);
+
+    // rows whose syntax changed lose their cached highlights; rows touched
+    // by the edits themselves were already dropped in on_doc_edit. The
+    // symbol index reads again what changed the same way.
+    if (g_tree) {
+        uint32_t nranges = 0;
+        TSRange *ranges = ts_tree_get_changed_ranges(g_tree, new_tree, &nranges);
+        for (uint32_t i = 0; i < nranges; i++){
+            hl_invalidate((int) ranges[i].start_point.row, (int) ranges[i].end_point.row);
+        }
+        symbolsUpdate(ts_tree_root_node(new_tree), ranges, nranges);
+        free(ranges);
+        ts_tree_delete(g_tree);
+    } else {
+        hl_reset();
+        symbolsClear();
+        symbolsUpdate(ts_tree_root_node(new_tree), NULL, 0);
+    }
     g_tree = new_tree;
+    g_tree_stale = false;
 
     return 0;
 }
 
+int syntaxReparseFull(void) {
+    if (!g_parser) return -1;
+    if (g_tree) ts_tree_delete(g_tree), g_tree = NULL;
+    return syntaxReparse();
+}
+
 
 // simple mappings of names to color ids
 int syntaxColorForCapture(const char *name){
@@ -327,21 +429,23 @@ int syntaxColorForCapture(const char *name){
 
 }
 
-int syntaxQueryVisible(int first_row, int last_row, HighlightSpan *spans_out, int max_spans){
-    if (!g_tree || !g_query || !g_cursor || !spans_out || max_spans <= 0) return -1;
-
-    if (first_row < 0) first_row = 0;
-    if (last_row >= E.numrows) last_row = E.numrows - 1;
-    if (last_row < first_row) return 0;
+// run the highlights query over rows [first_row, last_row] and store the
+// spans in the cache
+static void hl_query_rows(int first_row, int last_row){
+    for (int row = first_row; row <= last_row; row++){
+        RowSpans *rs = &g_hl_rows[row - g_hl_first];
+        rs->count = 0;
+        rs->valid = true;
+    }
 
     size_t start_byte = row_col_to_byte(first_row, 0);
-    size_t end_byte = row_col_to_byte(last_row, E.row[last_row].size);
+    size_t end_byte = row_col_to_byte(last_row, docRow(&E.doc, last_row)->size);
 
     ts_query_cursor_set_byte_range(g_cursor, (uint32_t) start_byte, (uint32_t) end_byte);
     ts_query_cursor_exec(g_cursor, g_query, ts_tree_root_node(g_tree));
 
-    int count = 0;
     TSQueryMatch match;
+    uint32_t capture_count = ts_query_capture_count(g_query);
 
     while (ts_query_cursor_next_match(g_cursor, &match)){
 
@@ -349,7 +453,6 @@ int syntaxQueryVisible(int first_row, int last_row, HighlightSpan *spans_out, in
             TSQueryCapture cap = match.captures[i];
 
             // ---- SAFETY CHECK START ----
-            uint32_t capture_count = ts_query_capture_count(g_query);
             if (cap.index >= capture_count) {
                 continue;
             }
@@ -368,33 +471,17 @@ int syntaxQueryVisible(int first_row, int last_row, HighlightSpan *spans_out, in
             uint32_t sbyte = ts_node_start_byte(node);
             uint32_t ebyte = ts_node_end_byte(node);
 
-            int srow = first_row;
-            int erow = last_row;
-
-            // derive srow
-            {
-                int lo = first_row, hi = last_row;
-                while (lo <= hi){
-                    int mid = (lo + hi) / 2;
-                    size_t base = g_row_byte_offsets[mid];
-                    if (base <= sbyte){ srow = mid; lo = mid + 1; } else { hi = mid - 1; }
-                }
-            }
-
-            // derive erow
-            {
-                int lo = srow, hi = last_row;
-                while (lo <= hi){
-                    int mid = (lo + hi) / 2;
-                    size_t base = g_row_byte_offsets[mid];
-                    if (base <= ebyte) { erow = mid; lo = mid + 1; } else { hi = mid - 1; }
-                }
-            }
+            // rows holding the first and last byte, clamped to the queried range
+            int srow = docRowAtByte(&E.doc, sbyte, NULL);
+            int erow = docRowAtByte(&E.doc, ebyte, NULL);
+            if (srow < first_row) srow = first_row;
+            if (erow > last_row) erow = last_row;
 
             //emit spans per affected row
-            for (int row = srow; row <= erow && count < max_spans; row++){
-                size_t row_base = g_row_byte_offsets[row];
-                size_t row_end = row_base + (size_t) E.row[row].size;
+            size_t row_base = docRowOffset(&E.doc, srow);
+            for (int row = srow; row <= erow; row++){
+                size_t row_len = (size_t) docRow(&E.doc, row)->size;
+                size_t row_end = row_base + row_len;
 
                 size_t seg_start = sbyte > row_base ? sbyte : row_base;
                 size_t seg_end = ebyte < row_end ? ebyte : row_end;
@@ -405,68 +492,195 @@ int syntaxQueryVisible(int first_row, int last_row, HighlightSpan *spans_out, in
                     hs.start_col = (int) (seg_start - row_base);
                     hs.end_col = (int) (seg_end - row_base);
                     hs.color_id = color;
-                    spans_out[count++] = hs;
-                    if (count >= max_spans) break;
+                    hl_push(&g_hl_rows[row - g_hl_first], hs);
                 }
+                row_base = row_end + 1;
             }
+        }
+    }
 
-            if (count >= max_spans) break;
+    for (int row = first_row; row <= last_row; row++){
+        hl_flatten(&g_hl_rows[row - g_hl_first]);
+    }
+}
 
-        }
-        if (count >= max_spans) break;
+int syntaxHighlightRows(int first_row, int last_row){
+    if (!g_tree || !g_query || !g_cursor) return -1;
+
+    if (first_row < 0) first_row = 0;
+    if (last_row >= docNumRows(&E.doc)) last_row = docNumRows(&E.doc) - 1;
+    if (last_row < first_row) return 0;
+
+    hl_cover(first_row, last_row);
+    if (!g_hl_rows) return -1;
+
+    // only query the runs of rows that are not cached yet
+    for (int row = first_row; row <= last_row; ){
+        if (g_hl_rows[row - g_hl_first].valid) { row++; continue; }
+        int end = row;
+        while (end < last_row && !g_hl_rows[end + 1 - g_hl_first].valid) end++;
+        hl_query_rows(row, end);
+        row = end + 1;
+    }
+    return 0;
+}
+
+const HighlightSpan *syntaxRowSpans(int row, int *count){
+    *count = 0;
+    if (!g_hl_rows || row < g_hl_first || row >= g_hl_first + g_hl_len) return NULL;
+    RowSpans *rs = &g_hl_rows[row - g_hl_first];
+    if (!rs->valid) return NULL;
+    *count = rs->count;
+    return rs->spans;
+}
+
+int syntaxQueryVisible(int first_row, int last_row, HighlightSpan *spans_out, int max_spans){
+    if (!spans_out || max_spans <= 0) return -1;
+    if (syntaxHighlightRows(first_row, last_row) != 0) return -1;
+
+    int count = 0;
+    for (int row = first_row; row <= last_row && count < max_spans; row++){
+        int n = 0;
+        const HighlightSpan *spans = syntaxRowSpans(row, &n);
+        if (n > max_spans - count) n = max_spans - count;
+        if (n > 0) memcpy(spans_out + count, spans, sizeof(HighlightSpan) * (size_t) n);
+        count += n;
     }
 
     return count;
 }
 
+static uint32_t name_hash(const char *s){
+    uint32_t h = 2166136261u;
+    for (; *s; s++) h = (h ^ (unsigned char) *s) * 16777619u;
+    return h;
+}
+
+// add name to the results unless it is there already
+static void walk_add(ScopeWalk *w, const char *name){
+    uint32_t i = name_hash(name) & (NAME_SLOTS - 1);
+    for (; w->slots[i] >= 0; i = (i + 1) & (NAME_SLOTS - 1)) {
+        if (strcmp(w->out[w->slots[i]], name) == 0) return;
+    }
+    memcpy(w->out[w->count], name, strlen(name) + 1);
+    w->slots[i] = (signed char) w->count++;
+}
+
+// n is a candidate if it is the name a declaration, parameter, field,
+// typedef, tag, enumerator or macro introduces
+static void walk_visit(ScopeWalk *w, TSNode n, const char *field){
+    if (!field || (strcmp(field, "declarator") != 0 && strcmp(field, "name") != 0)) return;
+    const char *type = ts_node_type(n);
+    if (strcmp(type, "identifier") != 0 && strcmp(type, "field_identifier") != 0 &&
+        strcmp(type, "type_identifier") != 0) return;
+
+    uint32_t s = ts_node_start_byte(n);
+    uint32_t e = ts_node_end_byte(n);
+    if (w->cursor_byte >= s && w->cursor_byte < e) return;
+    uint32_t len = e > s ? e - s : 0;
+    if (len == 0 || len < w->prefix_len || len >= MAX_WORD_LENGTH) return;
+
+    char name[MAX_WORD_LENGTH];
+    if (!copy_text(s, len, name)) return;
+    if (strncmp(name, w->prefix, w->prefix_len) != 0) return;
+    walk_add(w, name);
+}
+
+// Field lists of other structs are not in scope anywhere. Outside a
+// function, bodies and parameter lists aren't either.
+static bool walk_descends(TSNode n, bool in_function){
+    const char *type = ts_node_type(n);
+    if (strcmp(type, "field_declaration_list") == 0) return false;
+    return in_function || (strcmp(type, "compound_statement") != 0 &&
+                           strcmp(type, "parameter_list") != 0);
+}
+
+// visit the subtree of scope in document order, except skip
+static void walk_level(ScopeWalk *w, TSNode scope, const TSNode *skip, bool in_function){
+    TSTreeCursor c = ts_tree_cursor_new(scope);
+    bool more = ts_tree_cursor_goto_first_child(&c);
+    while (more && w->count < MAX_SUGGESTIONS) {
+        TSNode n = ts_tree_cursor_current_node(&c);
+        bool descend = false;
+        if (!skip || !ts_node_eq(n, *skip)) {
+            walk_visit(w, n, ts_tree_cursor_current_field_name(&c));
+            descend = walk_descends(n, in_function);
+        }
+        if (descend && ts_tree_cursor_goto_first_child(&c)) continue;
+        while (!(more = ts_tree_cursor_goto_next_sibling(&c)) && ts_tree_cursor_goto_parent(&c)) {}
+    }
+    ts_tree_cursor_delete(&c);
+}
+
+// fill g_scope_path with the nodes from the root down to byte b; returns
+// how many there are
+static int scope_path(TSNode root, uint32_t b){
+    TSTreeCursor c = ts_tree_cursor_new(root);
+    TSNode n = root;
+    int len = 0;
+    for (;;) {
+        if (len == g_scope_path_cap) {
+            int cap = g_scope_path_cap ? g_scope_path_cap * 2 : 32;
+            TSNode *path = realloc(g_scope_path, sizeof(TSNode) * (size_t) cap);
+            if (!path) break;
+            g_scope_path = path;
+            g_scope_path_cap = cap;
+        }
+        g_scope_path[len++] = n;
+        if (ts_tree_cursor_goto_first_child_for_byte(&c, b) < 0) break;
+        n = ts_tree_cursor_current_node(&c);
+        if (ts_node_start_byte(n) > b) break;
+    }
+    ts_tree_cursor_delete(&c);
+    return len;
+}
+
 int syntaxCollectIdentifiersInScope(const char* prefix, int row, int col, 
                                         char out[][MAX_WORD_LENGTH])
 {
     if (col > 0) col -= 1;
-    if (!g_tree || !g_row_byte_offsets || !g_full_text) return 0;
+    if (!g_tree) return 0;
     if (!prefix) prefix = "";
 
-    uint32_t b = (uint32_t) row_col_to_byte(row, col);
-    TSNode root = ts_tree_root_node(g_tree);
-    TSNode node = node_at_byte(root, b);
-    TSNode func = find_enclosing_type(node, "function_definition");
-    TSNode strt = find_enclosing_type(node, "struct_specifier");
-    TSNode un = find_enclosing_type(node, "union_specifier");
-
-    char locals[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
-    char str_fields[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
-    char un_fields[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
-    char globals[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
-    int out_count = 0;
-
-    int n1 = collect_ids(func, k_query_locals, prefix, locals, MAX_SUGGESTIONS, b);
-    int n2 = collect_ids(strt, k_query_fields, prefix, str_fields, MAX_SUGGESTIONS, b);
-    int n3 = collect_ids(un, k_query_fields, prefix, un_fields, MAX_SUGGESTIONS, b);
-    int n4 = collect_ids(root, k_query_globals, prefix, globals, MAX_SUGGESTIONS, b);
-
-    for (int i = 0; i < n1 && out_count < MAX_SUGGESTIONS; i++){
-        append_unique(out, MAX_SUGGESTIONS, &out_count, locals[i]);
+    ScopeWalk w = {
+        .prefix = prefix,
+        .prefix_len = strlen(prefix),
+        .cursor_byte = (uint32_t) row_col_to_byte(row, col),
+        .out = out,
+    };
+    memset(w.slots, -1, sizeof(w.slots));
+
+    // g_scope_path[top] is the root or the preprocessor conditional the
+    // top-level declaration at the cursor sits in
+    int len = scope_path(ts_tree_root_node(g_tree), w.cursor_byte);
+    int func = len, top = 0;
+    for (int i = 0; i < len; i++) {
+        const char *type = ts_node_type(g_scope_path[i]);
+        if (strcmp(type, "function_definition") == 0) { func = i; break; }
+        if (strncmp(type, "preproc_if", 10) == 0 || strncmp(type, "preproc_el", 10) == 0) top = i;
     }
-    for (int i = 0; i < n2 && out_count < MAX_SUGGESTIONS; i++){
-        append_unique(out, MAX_SUGGESTIONS, &out_count, str_fields[i]);
-    }
-    for (int i = 0; i < n3 && out_count < MAX_SUGGESTIONS; i++){
-        append_unique(out, MAX_SUGGESTIONS, &out_count, un_fields[i]);
-    }
-    for (int i = 0; i < n4 && out_count < MAX_SUGGESTIONS; i++){
-        append_unique(out, MAX_SUGGESTIONS, &out_count, globals[i]);
+    for (int i = len - 1; i > top && w.count < MAX_SUGGESTIONS; i--) {
+        walk_level(&w, g_scope_path[i], i + 1 < len ? &g_scope_path[i + 1] : NULL, i >= func);
     }
 
-    return out_count;
-
+    const Symbol *syms[MAX_SUGGESTIONS];
+    int n = symbolsComplete(prefix, syms, MAX_SUGGESTIONS);
+    for (int i = 0; i < n && w.count < MAX_SUGGESTIONS; i++) {
+        uint32_t s = syms[i]->byte;
+        if (w.cursor_byte >= s && w.cursor_byte < s + (uint32_t) strlen(syms[i]->name)) continue;
+        walk_add(&w, syms[i]->name);
+    }
+    return w.count;
 }
 
 
 void syntaxFree(void) {
+    if (E.doc.on_edit == on_doc_edit) docSetEditListener(&E.doc, NULL, NULL);
     if (g_cursor) ts_query_cursor_delete(g_cursor), g_cursor = NULL;
     if (g_query)  ts_query_delete(g_query), g_query = NULL;
+    free(g_scope_path), g_scope_path = NULL, g_scope_path_cap = 0;
+    symbolsFree();
     if (g_tree)   ts_tree_delete(g_tree), g_tree = NULL;
+    hl_reset();
     if (g_parser) ts_parser_delete(g_parser), g_parser = NULL;
-    free(g_full_text); g_full_text = NULL; g_full_len = 0;
-    free(g_row_byte_offsets); g_row_byte_offsets = NULL; g_row_offsets_count = 0;
 }
@@ -13,9 +13,19 @@ typedef struct {
 // init tree-sitter
 int syntaxInit(const char *lang_name, const char *query_path);
 
-// reparse the entire buffer (after edits)
+// reparse after edits, reusing the previous tree for the unchanged parts
+int syntaxReparse(void);
+
+// parse the entire buffer from scratch (after loading a file)
 int syntaxReparseFull(void);
 
+// make sure highlights for rows [first_row, last_row] are computed
+int syntaxHighlightRows(int first_row, int last_row);
+
+// spans of one row prepared by syntaxHighlightRows, sorted by start column
+// and not overlapping. Valid until the next edit or syntaxHighlightRows call
+const HighlightSpan *syntaxRowSpans(int row, int *count);
+
 // collect highlight spans for visible rows [first_row, last_row] inclusive
 // returns number of spans written to spans_out (up to max_spans)
 int syntaxQueryVisible(int first_row, int last_row, HighlightSpan *spans_out, int max_spans);
@@ -2,3 +2,40 @@
 
 // Global editor configuration instance
 struct editorConfig E;
+
+char *sidecarPath(const char *filename, const char *suffix) {
+    char *real = realpath(filename, NULL);
+    const char *name = real ? real : filename;
+    const char *slash = strrchr(name, '/');
+    int dirlen = slash ? (int) (slash - name) + 1 : 0;
+    const char *base = name + dirlen;
+
+    size_t size = strlen(name) + strlen(suffix) + sizeof("..");
+    char *path = malloc(size);
+    if (path) snprintf(path, size, "%.*s.%s.%s", dirlen, name, base, suffix);
+    free(real);
+    return path;
+}
+
+void fileIdFromStat(const struct stat *st, FileId *id) {
+    memset(id, 0, sizeof(*id));
+    id->dev = (uint64_t) st->st_dev;
+    id->ino = (uint64_t) st->st_ino;
+    id->size = (uint64_t) st->st_size;
+    id->mtime_sec = (int64_t) st->st_mtim.tv_sec;
+    id->mtime_nsec = (int64_t) st->st_mtim.tv_nsec;
+}
+
+int writeFully(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t) w;
+    }
+    return 0;
+}
@@ -11,12 +11,16 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 /*** defines ***/
 #define CTRL_KEY(k) ((k) & 0x1f)
 #define TEXTEDITVERSION "0.0.1"
 #define MAX_SUGGESTIONS 10
 #define MAX_WORD_LENGTH 256
+#define TAB_STOP 8
 
 enum editorKey {
   ARROW_LEFT = 1000,
@@ -33,15 +37,62 @@ enum editorKey {
   NEWLINE_KEY,
   ADD_CHAR_KEY,
   TAB_KEY,
-  ENTER
+  ENTER,
+  PASTE_KEY  // bracketed paste, text from terminalPasteText
 };
 
 /*** data structures ***/
 typedef struct erow {
     int size;
-    char* chars;
+    bool mapped; // chars point into the document's backing text, read only
+    bool frozen; // chars may be shared with a snapshot (see docSnapshot)
+    char* chars; // NUL terminated unless mapped
 } erow;
 
+// rows of the open file, see document.h
+typedef struct DocNode DocNode;
+typedef struct DocSlab DocSlab;
+
+// one edit to the document, in the shape tree-sitter's TSInputEdit expects
+typedef struct {
+    size_t start_byte;
+    size_t old_end_byte;
+    size_t new_end_byte;
+    int start_row, start_col;
+    int old_end_row, old_end_col;
+    int new_end_row, new_end_col;
+} DocEdit;
+
+typedef void (*DocEditListener)(const DocEdit *edit, void *ctx);
+
+typedef struct {
+    DocNode *root;
+    DocNode *free_nodes;
+    DocSlab *slabs;
+    int slab_used;
+    unsigned int seed;
+    DocEditListener on_edit;
+    void *edit_ctx;
+    int batch;       // docBeginBatch depth
+    bool batch_edit; // batched holds the edits made in the batch so far
+    DocEdit batched;
+    char *map;      // backing text mapped rows point into, or NULL
+    size_t map_len;
+    bool map_heap;  // map is a malloc'd buffer rather than a file mapping
+
+    // row text replaced or deleted while a snapshot is out, freed when it
+    // is released
+    int snapshots;
+    char **retired;
+    int nretired, retired_cap;
+} Document;
+
+// rows as they were when docSnapshot was called
+typedef struct {
+    erow *rows;
+    int count;
+} DocSnapshot;
+
 typedef struct {
   char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
   int count;
@@ -53,11 +104,15 @@ typedef struct {
 } AutoCompleteState;
 
 /*** Editor undo/redo ***/
+// keystrokes are recorded with the first four kinds; the history stores
+// everything as OP_INSERT_TEXT/OP_DELETE_TEXT
 typedef enum {
     OP_INSERT_CHAR,
     OP_DELETE_CHAR,
     OP_SPLIT_LINE, // newline
-    OP_JOIN_LINE // backspace at start of line
+    OP_JOIN_LINE, // backspace at start of line
+    OP_INSERT_TEXT, // text inserted at row,col, may span lines
+    OP_DELETE_TEXT  // the reverse: text removed from row,col to end_row,end_col
 } EditOpKind;
 
 typedef struct {
@@ -65,28 +120,86 @@ typedef struct {
     int row;
     int col;
     char ch;
+    // OP_INSERT_TEXT and OP_DELETE_TEXT only: the text and where it ends
+    // when inserted
+    char *text;
+    int len;
+    int end_row;
+    int end_col;
+    bool chained; // undone and redone together with the entry before it
 } EditOperation;
 
+// edit groups and text blobs in the compact encoding of editlog.c.
+// Past the memory cap the oldest records move to a file mapping.
 typedef struct {
-    EditOperation *items;
-    int len;
-    int cap;
-} EditStack;
+    const unsigned char *base; // records of an earlier session, mapped
+    size_t base_len;
+    unsigned char *b;     // the records after those in spill
+    size_t len, cap;
+    size_t records;
+    int spill_fd;
+    unsigned char *spill; // the oldest records of this session
+    size_t spill_len, spill_cap;
+} EditLog;
+
+// one undo step: the group of edits that led here from parent
+typedef struct {
+    size_t group;     // offset of the group in the edit log
+    int parent;       // -1 for the root, the state the file was opened in
+    int first_child;  // newest child first, linked through next_sibling
+    int next_sibling;
+    int redo_child;   // the branch redo follows, -1 for none
+    int depth;
+    int checkpoint;   // index into UndoTree.checkpoints, or -1
+} HistoryNode;
+
+// the whole document text at a node, to jump far without replaying. Kept
+// in memory only, and dropped oldest first to stay within a budget.
+typedef struct {
+    int node;
+    char *text;
+    size_t len;
+    unsigned long taken; // order taken in
+} HistoryCheckpoint;
+
+// Every state the document has been in. Undo moves to the parent, redo to
+// redo_child, and a new edit after an undo starts a new branch instead of
+// discarding the old one. Nodes are numbered in the order they were made.
+// Nodes saved with the file by an earlier session come first and are
+// used in place from a private mapping of the undo file, each checked the
+// first time a walk reaches it.
+typedef struct {
+    HistoryNode *base; // nodes [0, base_count)
+    int base_count;
+    unsigned char *base_checked; // a bit per base node, set once it is checked
+    void *saved_map;   // the undo file the base came from
+    size_t saved_len;
+    HistoryNode *nodes; // nodes [base_count, count)
+    int count, cap;
+    int current; // the node the document is at
+    HistoryCheckpoint *checkpoints; // HISTORY_CHECKPOINT_SLOTS of them
+    int ncheckpoints;
+    size_t checkpoint_bytes;
+    unsigned long checkpoints_taken;
+    int opened; // the node whose text is the document's backing text, or -1
+    EditLog log;
+} UndoTree;
 
 struct editorConfig {
     int screenrows;
     int screencols;
     struct termios orig_termios;
     int cx, cy;
-    int numrows;
-    erow *row;
+    int rx; // cx in screen columns, with tabs expanded
+    Document doc;
     int rowoff;
     int coloff;
     char *filename;
-    int dirty;
+    int dirty; // edits since the last save
     int line_num;
     int debug_tree;
     int goto_active;
+    int goto_history; // the goto prompt picks an undo state, not a line
     char goto_buf[16];
     int goto_len;
     int goto_saved_cx, goto_saved_cy;
@@ -102,16 +215,34 @@ struct editorConfig {
     int search_match_len;
 
     // undo/redo
-    EditStack undo_stack;
-    EditStack redo_stack;
+    UndoTree undo;
     int replaying_history;
 
     // save_as_prompt
     int save_as_active;
     char save_as_buf[256];
     int save_as_len;
+
+    // message shown in the status bar for a few seconds
+    char statusmsg[80];
+    time_t statusmsg_time;
 };
 
 extern struct editorConfig E;
 
+// .<name>.<suffix> in the directory of the file filename resolves to, for
+// the files kept alongside it; the caller frees it
+char *sidecarPath(const char *filename, const char *suffix);
+
+// what tells whether a file is still the one seen before, in a fixed
+// layout so it can be stored
+typedef struct {
+    uint64_t dev, ino, size;
+    int64_t mtime_sec, mtime_nsec;
+} FileId;
+
+void fileIdFromStat(const struct stat *st, FileId *id);
+// write all len bytes, retrying short writes; 0 on success, -1 on error
+int writeFully(int fd, const void *data, size_t len);
+
 #endif
@@ -1,77 +1,364 @@
 #include "fileio.h"
 #include "terminal.h"
 #include "history.h"
+#include "document.h"
+#include "loader.h"
+#include "journal.h"
+#include "undofile.h"
+#include "project.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 
 /*** file i/o functions ***/
 
+#define SAVE_IOV 1024 // iovecs per writev, the usual IOV_MAX
+
+// the part of a mapped file indexed before the editor first draws, the
+// rest is loaded in the background
+#define OPEN_SYNC_BYTES (256u << 10)
+
+void editorSetStatusMessage(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+  va_end(ap);
+  E.statusmsg_time = time(NULL);
+}
+
 void editorFree(void) {
-    for (int i = 0; i < E.numrows; i++) {
-        free(E.row[i].chars);
-    }
-    free(E.row);
+    editorSaveWait();
+    loaderCancel();
+    journalStop(E.dirty == 0);
+    docFree(&E.doc);
     historyFree();
 }
 
-void editorSave(void) {
-  if (E.numrows == 0 || !E.filename) return;
-  FILE *fp = fopen(E.filename, "w");
-  if (!fp) die("fopen");
+// write all of iov[0..n) to fd, resuming after short writes
+static int write_all(int fd, struct iovec *iov, int n) {
+  while (n > 0) {
+    ssize_t w = writev(fd, iov, n);
+    if (w == -1) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    while (n > 0 && (size_t) w >= iov->iov_len) {
+      w -= (ssize_t) iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *) iov->iov_base + w;
+      iov->iov_len -= (size_t) w;
+    }
+  }
+  return 0;
+}
 
-  for (int i = 0; i < E.numrows; i++) {
-    fwrite(E.row[i].chars, E.row[i].size, 1, fp);
-    if (i < E.numrows - 1) {
-      fwrite("\n", 1, 1, fp);
+// stream rows[0..n) to fd, SAVE_IOV rows and line breaks per writev, and
+// hash the bytes written
+static int write_rows(int fd, const erow *rows, int n, UndoHash *hash) {
+  static char newline[] = "\n";
+  struct iovec iov[SAVE_IOV];
+  int k = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (rows[i].size > 0) {
+      iov[k].iov_base = rows[i].chars;
+      iov[k].iov_len = (size_t) rows[i].size;
+      undoHashUpdate(hash, rows[i].chars, (size_t) rows[i].size);
+      k++;
+    }
+    if (i < n - 1) {
+      iov[k].iov_base = newline;
+      iov[k].iov_len = 1;
+      undoHashUpdate(hash, newline, 1);
+      k++;
+    }
+    if (k >= SAVE_IOV - 1) {
+      if (write_all(fd, iov, k) != 0) return -1;
+      k = 0;
     }
   }
-  E.dirty = 0;
+  return k > 0 ? write_all(fd, iov, k) : 0;
+}
 
-  fclose(fp);
+// path of the file a save should replace: symlinks are followed so the
+// link itself survives the rename
+static char *save_target(void) {
+  char *target = realpath(E.filename, NULL);
+  return target ? target : strdup(E.filename);
+}
+
+static void sync_dir(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *dir = slash ? strndup(path, (size_t) (slash - path) + 1) : strdup(".");
+  if (!dir) return;
+  int fd = open(dir, O_RDONLY);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+  free(dir);
+}
+
+/*** background save ***/
+// The rows are snapshotted on the main thread and written by a worker, so
+// editing goes on while a large file is written out. The worker only
+// touches the SaveJob; the main thread collects the result in
+// editorSaveWait once g_save_pipe becomes readable.
+
+typedef struct {
+  DocSnapshot snap;
+  char *target;
+  int dirty;        // E.dirty when the snapshot was taken
+  unsigned long seq; // last journal entry in the snapshot
+  const char *step; // what failed, NULL on success
+  int err;
+  struct stat saved; // the file as written, if saved_ok
+  bool saved_ok;
+  HistorySnapshot history; // undo history to save with it, if history_ok
+  bool history_ok;
+} SaveJob;
+
+static SaveJob g_job;
+static pthread_t g_save_thread;
+static bool g_saving = false;
+static int g_save_pipe[2] = { -1, -1 };
+
+// write the snapshot to a temp file next to the target and rename it into
+// place, so a failed or interrupted save leaves the old contents intact.
+// Rows borrowed from a mapping of the old file stay valid as well.
+static void save_snapshot(SaveJob *job) {
+  size_t len = strlen(job->target);
+  char *tmp = malloc(len + 8);
+  job->step = "out of memory";
+  job->err = ENOMEM;
+  if (!tmp) return;
+  memcpy(tmp, job->target, len);
+  memcpy(tmp + len, ".XXXXXX", 8);
+
+  job->step = "create temp file";
+  int fd = mkstemp(tmp);
+  if (fd == -1) goto fail;
+
+  struct stat st;
+  if (stat(job->target, &st) == 0) {
+    job->step = "copy permissions";
+    if (fchmod(fd, st.st_mode & 07777) == -1) goto fail;
+    if (fchown(fd, st.st_uid, st.st_gid) == -1) {
+      // keeping the owner needs privileges, the new file stays ours
+    }
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+  }
+
+  job->step = "write";
+  UndoHash hash;
+  undoHashInit(&hash);
+  if (write_rows(fd, job->snap.rows, job->snap.count, &hash) != 0) goto fail;
+  job->step = "fsync";
+  if (fsync(fd) == -1) goto fail;
+  job->step = "close";
+  int rc = close(fd);
+  fd = -1;
+  if (rc == -1) goto fail;
+  job->step = "rename";
+  if (rename(tmp, job->target) == -1) goto fail;
+  sync_dir(job->target);
+  job->saved_ok = stat(job->target, &job->saved) == 0;
+
+  // the history is only worth keeping for the file as saved; failing to
+  // write it doesn't fail the save
+  char *undo = job->saved_ok && job->history_ok ? sidecarPath(job->target, "undo") : NULL;
+  if (undo) undoFileWrite(undo, &job->saved, undoHashFinal(&hash), &job->history);
+  free(undo);
+
+  free(tmp);
+  job->step = NULL;
+  job->err = 0;
+  return;
+
+fail:
+  job->err = errno;
+  if (fd != -1) close(fd);
+  unlink(tmp);
+  free(tmp);
+}
+
+static void *save_worker(void *arg) {
+  save_snapshot(arg);
+  if (write(g_save_pipe[1], "s", 1) == -1) {
+    // nothing to do, editorSaveWait joins the thread anyway
+  }
+  return NULL;
+}
+
+// release the snapshot and report how the save went
+static int finish_save(void) {
+  int numrows = g_job.snap.count;
+  docReleaseSnapshot(&E.doc, &g_job.snap);
+  if (g_job.history_ok) historyReleaseSnapshot(&g_job.history);
+
+  int rc = 0;
+  if (g_job.step) {
+    editorSetStatusMessage("Save failed (%s): %s", g_job.step, strerror(g_job.err));
+    rc = -1;
+  } else {
+    // edits made while the file was written keep the buffer modified
+    E.dirty -= g_job.dirty;
+    // the journal only needs what came after the snapshot
+    if (g_job.saved_ok) journalCheckpoint(g_job.target, &g_job.saved, g_job.seq);
+    editorSetStatusMessage("Saved %d lines", numrows);
+    // other files may complete names from this one
+    projectRescan();
+  }
+  free(g_job.target);
+  g_job.target = NULL;
+  return rc;
+}
+
+int editorSaveFd(void) {
+  return g_saving ? g_save_pipe[0] : -1;
+}
+
+int editorSaveWait(void) {
+  if (!g_saving) return 0;
+  pthread_join(g_save_thread, NULL);
+  close(g_save_pipe[0]);
+  close(g_save_pipe[1]);
+  g_save_pipe[0] = g_save_pipe[1] = -1;
+  g_saving = false;
+  return finish_save();
+}
+
+int editorSave(void) {
+  // one save at a time; a new one writes everything the last one did
+  editorSaveWait();
+  // every row has to be in the document before it can be written out
+  loaderFinish();
+
+  if (docNumRows(&E.doc) == 0 || !E.filename) return 0;
+
+  g_job.target = save_target();
+  if (!g_job.target || docSnapshot(&E.doc, &g_job.snap) != 0) {
+    free(g_job.target);
+    g_job.target = NULL;
+    editorSetStatusMessage("Save failed: out of memory");
+    return -1;
+  }
+  g_job.dirty = E.dirty;
+  g_job.seq = journalSeq();
+  g_job.step = NULL;
+  g_job.saved_ok = false;
+  g_job.history_ok = historySnapshot(&g_job.history) == 0;
+
+  if (pipe(g_save_pipe) == -1) {
+    // no way to hear back from a worker, write it out here instead
+    save_snapshot(&g_job);
+    return finish_save();
+  }
+  if (pthread_create(&g_save_thread, NULL, save_worker, &g_job) != 0) {
+    close(g_save_pipe[0]);
+    close(g_save_pipe[1]);
+    g_save_pipe[0] = g_save_pipe[1] = -1;
+    save_snapshot(&g_job);
+    return finish_save();
+  }
+  g_saving = true;
+  editorSetStatusMessage("Saving...");
+  return 0;
+}
+
+// read a file that can't be mapped (a pipe, /dev/stdin, ...) into one
+// buffer, which the document then indexes in place like a mapping
+static void open_stream(FILE *fp) {
+  size_t len = 0, cap = 1 << 16;
+  char *buf = malloc(cap);
+  if (!buf) die("malloc");
+
+  size_t n;
+  while ((n = fread(buf + len, 1, cap - len, fp)) > 0) {
+    len += n;
+    if (len == cap) {
+      char *grown = realloc(buf, cap * 2);
+      if (!grown) die("realloc");
+      buf = grown;
+      cap *= 2;
+    }
+  }
+  if (ferror(fp)) die("fread");
+
+  if (len == 0) {
+    free(buf);
+    return;
+  }
+  if (docLoadBuffer(&E.doc, buf, len) != 0) die("docLoadBuffer");
+}
+
+// re-apply an entry from the journal of an earlier session
+static void recover_entry(JournalEntryType type, const EditOperation *op) {
+  // edits may touch any row, so the whole file has to be in
+  loaderFinish();
+  if (type == JOURNAL_UNDO) historyUndo();
+  else if (type == JOURNAL_REDO) historyRedo();
+  else if (type == JOURNAL_BRANCH) historyNextBranch(&(int){0});
+  else if (type == JOURNAL_JUMP) historyJump(op->row);
+  else historyReplay(op);
 }
 
 void editorOpen(char *filename) {
   E.filename = filename;
   FILE *fp = fopen(filename, "r");
   if (!fp) die("fopen");
-  if (E.row) {
-      for (int i = 0; i < E.numrows; i++){
-          if (E.row[i].chars) free(E.row[i].chars);
-          E.row[i].chars = NULL;
-      }
-      free(E.row);
+  docFree(&E.doc);
+
+  // regular files are mapped and indexed in place; rows are only copied
+  // once they are edited
+  struct stat st;
+  char *map = MAP_FAILED;
+  if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
   }
-  E.numrows = 0;
-  E.row = NULL;
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
-
-  while ((linelen = getline(&line, &linecap, fp)) != -1) {
-    while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                           line[linelen - 1] == '\r'))
-        linelen--;
-
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-
-    E.row[E.numrows].size = linelen;
-    E.row[E.numrows].chars = malloc(linelen + 1);
-    memcpy(E.row[E.numrows].chars, line, linelen);
-    E.row[E.numrows].chars[linelen] = '\0';
-    E.numrows++;
+  if (map != MAP_FAILED) {
+    size_t len = (size_t) st.st_size;
+    if (docSetBacking(&E.doc, map, len, false) != 0) die("docSetBacking");
+
+    // index the first screens right away and leave the rest to a worker
+    size_t head = len;
+    if (len > OPEN_SYNC_BYTES) {
+      char *nl = memchr(map + OPEN_SYNC_BYTES, '\n', len - OPEN_SYNC_BYTES);
+      if (nl) head = (size_t) (nl - map) + 1;
+    }
+    if (docAppendBorrowed(&E.doc, map, head) != 0) die("docAppendBorrowed");
+    if (head < len && loaderStart(map, head, len) != 0 &&
+        docAppendBorrowed(&E.doc, map + head, len - head) != 0) {
+      die("docAppendBorrowed");
+    }
+  } else {
+    open_stream(fp);
   }
   E.dirty = 0;
-  free(line);
+  bool regular = fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
   fclose(fp);
 
   // If no lines were read, create an empty first line
-  if (E.numrows == 0) {
-    // We need to call editorAllocateNewRow from editor.c
-    // For now, we'll do it inline to avoid circular dependencies
-    E.row = malloc(sizeof(erow));
-    E.row[0].size = 0;
-    E.row[0].chars = malloc(1);
-    E.row[0].chars[0] = '\0';
-    E.numrows = 1;
+  if (docNumRows(&E.doc) == 0) {
+    docInsertRow(&E.doc, 0, "", 0);
     E.cy = 0;
     E.cx = 0;
   }
+
+  // undo goes on from where the last session saved the file, then the
+  // edits of a session that ended without saving them are brought back
+  historyFree();
+  historyInit(regular ? filename : NULL, &st);
+  int recovered = regular ? journalStart(filename, &st, recover_entry) : 0;
+  if (recovered > 0) editorSetStatusMessage("Recovered %d edits from the journal", recovered);
 }
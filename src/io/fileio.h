@@ -5,7 +5,15 @@
 
 /*** file i/o functions ***/
 void editorFree(void);
-void editorSave(void);
+// start writing the buffer out on a worker thread; returns -1 after
+// reporting the error in the status bar if the save couldn't start
+int editorSave(void);
+// readable once the running save is done, -1 when there is none
+int editorSaveFd(void);
+// wait for the running save and report it; returns 0 on success or when
+// no save was running, -1 after reporting the error in the status bar
+int editorSaveWait(void);
+void editorSetStatusMessage(const char *fmt, ...);
 void editorOpen(char *filename);
 
 #endif
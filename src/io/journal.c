@@ -0,0 +1,291 @@
+#include "journal.h"
+#include "buffer.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// how long entries may wait in memory before the worker writes them out,
+// and how much may pile up before it is woken early
+#define JOURNAL_FLUSH_MS 250
+#define JOURNAL_BATCH (64 << 10)
+
+// on disk every entry is a JournalRecord followed by len bytes: the text
+// of an OP_INSERT_TEXT/OP_DELETE_TEXT edit, or a FileId for a
+// checkpoint. A torn record at the end (a crash mid-write) is dropped.
+typedef struct {
+    unsigned char type;
+    unsigned char kind;
+    char ch;
+    unsigned char chained;
+    int32_t row, col, end_row, end_col;
+    int32_t len;
+    uint64_t seq;
+} JournalRecord;
+
+
+static pthread_t g_thread;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;
+static bool g_running = false;
+static int g_fd = -1;
+static char *g_path = NULL;
+static unsigned long g_seq = 0;
+static bool g_lost = false; // an entry couldn't be queued, the rest is useless
+
+// shared with the worker, guarded by g_lock
+static struct abuf g_pending = ABUF_INIT;
+static bool g_truncate = false; // empty the file before the pending entries
+static bool g_stop = false;
+
+static void *journal_worker(void *arg) {
+    (void) arg;
+    struct abuf out = ABUF_INIT;
+
+    pthread_mutex_lock(&g_lock);
+    for (;;) {
+        while (g_pending.len == 0 && !g_truncate && !g_stop) pthread_cond_wait(&g_wake, &g_lock);
+        if (!g_stop && g_pending.len < JOURNAL_BATCH) {
+            // let the batch fill up; woken early when it is full
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += JOURNAL_FLUSH_MS * 1000000L;
+            until.tv_sec += until.tv_nsec / 1000000000L;
+            until.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&g_wake, &g_lock, &until);
+        }
+
+        // swap buffers so new entries queue up while this batch is written
+        struct abuf batch = g_pending;
+        g_pending = out;
+        out = batch;
+        bool truncate = g_truncate;
+        g_truncate = false;
+        bool stop = g_stop;
+        pthread_mutex_unlock(&g_lock);
+
+        if (truncate && ftruncate(g_fd, 0) == -1) {
+            // the old entries stay, replaying skips them by sequence number
+        }
+        if (out.len > 0 && writeFully(g_fd, out.b, (size_t) out.len) == 0) fdatasync(g_fd);
+        abReset(&out);
+
+        pthread_mutex_lock(&g_lock);
+        if (stop && g_pending.len == 0 && !g_truncate) break;
+    }
+    pthread_mutex_unlock(&g_lock);
+    abFree(&out);
+    return NULL;
+}
+
+// queue a record and its payload; with g_lock held
+static void queue_locked(const JournalRecord *r, const void *payload) {
+    int before = g_pending.len;
+    abAppend(&g_pending, (const char *) r, (int) sizeof(*r));
+    if (r->len > 0) abAppend(&g_pending, payload, r->len);
+    if (g_pending.len != before + (int) sizeof(*r) + r->len) {
+        // out of memory: a journal with a gap would replay wrongly, so
+        // empty it and leave it without a checkpoint until the next save
+        g_pending.len = 0;
+        g_truncate = true;
+        g_lost = true;
+    }
+}
+
+static void queue_checkpoint_locked(const struct stat *st, unsigned long seq) {
+    FileId id;
+    fileIdFromStat(st, &id);
+    JournalRecord r = { .type = JOURNAL_CHECKPOINT, .len = (int32_t) sizeof(id), .seq = seq };
+    queue_locked(&r, &id);
+}
+
+// Read the journal at path and, if its last checkpoint is for the file st,
+// replay the entries after it. Returns the entries replayed or -1 if the
+// journal doesn't apply; *valid gets the length of the intact records and
+// *last the highest sequence number.
+static int replay_journal(const char *path, const struct stat *st, JournalReplayFn replay,
+                          off_t *valid, unsigned long *last) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    struct stat jst;
+    char *buf = NULL;
+    size_t len = 0;
+    if (fstat(fd, &jst) == 0 && jst.st_size > 0) {
+        buf = malloc((size_t) jst.st_size);
+        while (buf && len < (size_t) jst.st_size) {
+            ssize_t r = read(fd, buf + len, (size_t) jst.st_size - len);
+            if (r <= 0) break;
+            len += (size_t) r;
+        }
+    }
+    close(fd);
+    if (!buf) return -1;
+
+    // find the last checkpoint and where the intact records end
+    JournalRecord r;
+    FileId id = { 0 };
+    bool have_checkpoint = false;
+    unsigned long checkpoint = 0;
+    size_t pos = 0;
+    *last = 0;
+    while (len - pos >= sizeof(r)) {
+        memcpy(&r, buf + pos, sizeof(r));
+        if (r.type > JOURNAL_JUMP || r.len < 0 || (size_t) r.len > len - pos - sizeof(r)) break;
+        if (r.type == JOURNAL_CHECKPOINT) {
+            if (r.len != (int32_t) sizeof(id)) break;
+            memcpy(&id, buf + pos + sizeof(r), sizeof(id));
+            have_checkpoint = true;
+            checkpoint = (unsigned long) r.seq;
+        }
+        if (r.seq > *last) *last = (unsigned long) r.seq;
+        pos += sizeof(r) + (size_t) r.len;
+    }
+    *valid = (off_t) pos;
+
+    FileId current;
+    fileIdFromStat(st, &current);
+    if (!have_checkpoint || memcmp(&id, &current, sizeof(id)) != 0) {
+        free(buf);
+        return -1;
+    }
+
+    int replayed = 0;
+    size_t end = pos;
+    for (pos = 0; pos < end; pos += sizeof(r) + (size_t) r.len) {
+        memcpy(&r, buf + pos, sizeof(r));
+        if (r.type == JOURNAL_CHECKPOINT || r.seq <= checkpoint) continue;
+        EditOperation op = {
+            .kind = (EditOpKind) r.kind,
+            .row = r.row,
+            .col = r.col,
+            .ch = r.ch,
+            .text = r.len > 0 ? buf + pos + sizeof(r) : NULL,
+            .len = r.len,
+            .end_row = r.end_row,
+            .end_col = r.end_col,
+            .chained = r.chained != 0
+        };
+        replay((JournalEntryType) r.type,
+               r.type == JOURNAL_EDIT || r.type == JOURNAL_JUMP ? &op : NULL);
+        replayed++;
+    }
+    free(buf);
+    return replayed;
+}
+
+// take over path and start the worker; a journal that isn't resumed is
+// emptied and begins with a checkpoint for st at seq
+static int open_journal(char *path, const struct stat *st, bool resume, off_t valid,
+                        unsigned long seq) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd == -1) {
+        free(path);
+        return -1;
+    }
+    // drop a torn record left by the crash before appending after it
+    if (resume && ftruncate(fd, valid) == -1) resume = false;
+
+    g_fd = fd;
+    g_path = path;
+    g_seq = seq;
+    g_lost = false;
+    g_stop = false;
+    g_truncate = !resume;
+    abReset(&g_pending);
+    if (!resume) queue_checkpoint_locked(st, seq);
+
+    if (pthread_create(&g_thread, NULL, journal_worker, NULL) != 0) {
+        close(fd);
+        g_fd = -1;
+        free(g_path);
+        g_path = NULL;
+        return -1;
+    }
+    g_running = true;
+    return 0;
+}
+
+int journalStart(const char *filename, const struct stat *st, JournalReplayFn replay) {
+    if (g_running) journalStop(false);
+    char *path = sidecarPath(filename, "journal");
+    if (!path) return -1;
+
+    off_t valid = 0;
+    unsigned long last = 0;
+    int replayed = replay_journal(path, st, replay, &valid, &last);
+    bool resume = replayed >= 0;
+    if (open_journal(path, st, resume, valid, resume ? last : 0) != 0) return -1;
+    return resume ? replayed : 0;
+}
+
+void journalRecord(JournalEntryType type, const EditOperation *op) {
+    if (!g_running || g_lost) return;
+
+    JournalRecord r = { .type = (unsigned char) type, .seq = ++g_seq };
+    if (op) {
+        r.kind = (unsigned char) op->kind;
+        r.ch = op->ch;
+        r.row = op->row;
+        r.col = op->col;
+        r.end_row = op->end_row;
+        r.end_col = op->end_col;
+        r.chained = op->chained;
+        if (op->text) r.len = op->len;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    // the worker only needs waking to start a batch or when one is full
+    bool wake = g_pending.len == 0;
+    queue_locked(&r, op ? op->text : NULL);
+    if (g_pending.len >= JOURNAL_BATCH) wake = true;
+    pthread_mutex_unlock(&g_lock);
+    if (wake) pthread_cond_signal(&g_wake);
+}
+
+unsigned long journalSeq(void) {
+    return g_seq;
+}
+
+void journalCheckpoint(const char *filename, const struct stat *st, unsigned long seq) {
+    char *path = sidecarPath(filename, "journal");
+    if (!path) return;
+    if (!g_running) {
+        open_journal(path, st, false, 0, g_seq);
+        return;
+    }
+    // saved under a new name: the journal follows the file
+    if (strcmp(path, g_path) != 0 && rename(g_path, path) == 0) {
+        free(g_path);
+        g_path = path;
+    } else {
+        free(path);
+    }
+
+    pthread_mutex_lock(&g_lock);
+    if (seq == g_seq) {
+        // the file has every entry, start the journal over
+        g_pending.len = 0;
+        g_truncate = true;
+        g_lost = false;
+    }
+    if (!g_lost) queue_checkpoint_locked(st, seq);
+    pthread_mutex_unlock(&g_lock);
+    pthread_cond_signal(&g_wake);
+}
+
+void journalStop(bool saved) {
+    if (!g_running) return;
+    pthread_mutex_lock(&g_lock);
+    g_stop = true;
+    pthread_mutex_unlock(&g_lock);
+    pthread_cond_signal(&g_wake);
+    pthread_join(g_thread, NULL);
+
+    close(g_fd);
+    g_fd = -1;
+    if (saved || g_lost) unlink(g_path);
+    free(g_path);
+    g_path = NULL;
+    abFree(&g_pending);
+    g_running = false;
+}
@@ -0,0 +1,44 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "common.h"
+#include <sys/stat.h>
+
+/*** edit journal ***/
+// Every history entry (an edit, an undo, a redo, a branch switch or a
+// jump to another state) is appended to a journal next to the file,
+// .<name>.journal, so a crash loses at most the last flush interval.
+// Entries are queued in memory and a worker thread writes them out in
+// batches; nothing on the editing path waits for the disk. A checkpoint
+// record ties the journal to the file it applies to, by identity rather
+// than by name, so a journal that doesn't match the file on disk is
+// ignored.
+
+typedef enum {
+    JOURNAL_EDIT,
+    JOURNAL_UNDO,
+    JOURNAL_REDO,
+    JOURNAL_CHECKPOINT,
+    JOURNAL_BRANCH,
+    JOURNAL_JUMP // op->row is the state jumped to
+} JournalEntryType;
+
+// called for each entry replayed from an unclean journal; op is only set
+// for edits and jumps, and op->text is only valid during the call
+typedef void (*JournalReplayFn)(JournalEntryType type, const EditOperation *op);
+
+// start journaling edits to filename, whose current state is st. If an
+// unclean journal for this very file exists, its entries are first
+// passed to replay and journaling goes on after them. Returns the number
+// of entries replayed, or -1 if there is no journal (editing still works).
+int journalStart(const char *filename, const struct stat *st, JournalReplayFn replay);
+void journalRecord(JournalEntryType type, const EditOperation *op);
+// number of the last entry recorded, for journalCheckpoint
+unsigned long journalSeq(void);
+// filename (st) now holds every entry up to seq. Starts the journal if
+// it isn't running and follows a change of filename.
+void journalCheckpoint(const char *filename, const struct stat *st, unsigned long seq);
+// flush and stop; the journal is deleted when nothing is left unsaved
+void journalStop(bool saved);
+
+#endif
@@ -0,0 +1,186 @@
+#include "loader.h"
+#include "document.h"
+#include "terminal.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define LOAD_CHUNK_BYTES (4u << 20)
+
+typedef struct LoadChunk {
+    Document doc;
+    struct LoadChunk *next;
+} LoadChunk;
+
+static pthread_t g_thread;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool g_active = false;
+
+// shared with the worker, guarded by g_lock
+static LoadChunk *g_head = NULL, *g_tail = NULL;
+static size_t g_done_bytes = 0;
+static bool g_finished = false; // worker has queued its last chunk
+static bool g_stop = false;
+static bool g_failed = false;
+
+static char *g_text = NULL;
+static size_t g_start = 0, g_len = 0;
+static int g_pipe[2] = { -1, -1 };
+
+static void *load_worker(void *arg) {
+    (void) arg;
+    size_t pos = g_start;
+    unsigned int n = 0;
+
+    while (pos < g_len) {
+        size_t end = pos + LOAD_CHUNK_BYTES;
+        if (end >= g_len) {
+            end = g_len;
+        } else {
+            // end the chunk after a line break
+            char *nl = memchr(g_text + end, '\n', g_len - end);
+            end = nl ? (size_t) (nl - g_text) + 1 : g_len;
+        }
+
+        LoadChunk *c = malloc(sizeof(LoadChunk));
+        if (!c) break;
+        docInit(&c->doc);
+        // each chunk draws its own priorities so merged chunks stay balanced
+        c->doc.seed = 0x9e3779b9u * ++n;
+        if (docAppendBorrowed(&c->doc, g_text + pos, end - pos) != 0) {
+            docFree(&c->doc);
+            free(c);
+            break;
+        }
+        c->next = NULL;
+
+        pthread_mutex_lock(&g_lock);
+        bool stop = g_stop;
+        if (!stop) {
+            if (g_tail) g_tail->next = c;
+            else g_head = c;
+            g_tail = c;
+            g_done_bytes = end - g_start;
+        }
+        pthread_mutex_unlock(&g_lock);
+        if (stop) {
+            docFree(&c->doc);
+            free(c);
+            return NULL;
+        }
+
+        if (write(g_pipe[1], "c", 1) == -1) {
+            // the pipe is full, the main thread has a wakeup pending anyway
+        }
+        pos = end;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    g_failed = pos < g_len;
+    g_finished = true;
+    pthread_mutex_unlock(&g_lock);
+    if (write(g_pipe[1], "f", 1) == -1) {
+        // as above
+    }
+    return NULL;
+}
+
+int loaderStart(char *text, size_t start, size_t len) {
+    if (g_active || start >= len) return -1;
+    if (pipe(g_pipe) == -1) return -1;
+    fcntl(g_pipe[0], F_SETFL, fcntl(g_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(g_pipe[1], F_SETFL, fcntl(g_pipe[1], F_GETFL) | O_NONBLOCK);
+
+    g_text = text;
+    g_start = start;
+    g_len = len;
+    g_head = g_tail = NULL;
+    g_done_bytes = 0;
+    g_finished = g_stop = g_failed = false;
+
+    if (pthread_create(&g_thread, NULL, load_worker, NULL) != 0) {
+        close(g_pipe[0]);
+        close(g_pipe[1]);
+        g_pipe[0] = g_pipe[1] = -1;
+        return -1;
+    }
+    g_active = true;
+    return 0;
+}
+
+bool loaderActive(void) {
+    return g_active;
+}
+
+int loaderFd(void) {
+    return g_active ? g_pipe[0] : -1;
+}
+
+static void drop_chunks(LoadChunk *c) {
+    while (c) {
+        LoadChunk *next = c->next;
+        docFree(&c->doc);
+        free(c);
+        c = next;
+    }
+}
+
+static void finish_thread(void) {
+    pthread_join(g_thread, NULL);
+    close(g_pipe[0]);
+    close(g_pipe[1]);
+    g_pipe[0] = g_pipe[1] = -1;
+    g_active = false;
+}
+
+bool loaderPoll(void) {
+    if (!g_active) return false;
+
+    char buf[64];
+    while (read(g_pipe[0], buf, sizeof(buf)) > 0);
+
+    pthread_mutex_lock(&g_lock);
+    LoadChunk *c = g_head;
+    g_head = g_tail = NULL;
+    bool finished = g_finished;
+    pthread_mutex_unlock(&g_lock);
+
+    while (c) {
+        LoadChunk *next = c->next;
+        docAppendDocument(&E.doc, &c->doc);
+        free(c);
+        c = next;
+    }
+
+    if (!finished) return false;
+    finish_thread();
+    if (g_failed) die("load");
+    return true;
+}
+
+void loaderFinish(void) {
+    while (g_active) {
+        struct pollfd pfd = { g_pipe[0], POLLIN, 0 };
+        poll(&pfd, 1, -1);
+        loaderPoll();
+    }
+}
+
+void loaderCancel(void) {
+    if (!g_active) return;
+    pthread_mutex_lock(&g_lock);
+    g_stop = true;
+    pthread_mutex_unlock(&g_lock);
+    finish_thread();
+
+    drop_chunks(g_head);
+    g_head = g_tail = NULL;
+}
+
+int loaderProgress(void) {
+    if (!g_active) return 100;
+    pthread_mutex_lock(&g_lock);
+    size_t done = g_done_bytes;
+    pthread_mutex_unlock(&g_lock);
+    return (int) (done * 100 / (g_len - g_start));
+}
@@ -0,0 +1,26 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "common.h"
+
+/*** background loading ***/
+// Indexes the rest of a file on a worker thread. The worker builds rows a
+// chunk at a time in private documents; the main thread splices them onto
+// E.doc in loaderPoll, so the document is only ever touched by one thread.
+
+// index the lines of text[start..len) (start is at a line start) and
+// append them to E.doc, which already owns text
+int loaderStart(char *text, size_t start, size_t len);
+bool loaderActive(void);
+// readable while finished chunks are waiting, -1 when no load is running
+int loaderFd(void);
+// append the finished chunks; returns true when this completed the load
+bool loaderPoll(void);
+// block until the whole file is in E.doc
+void loaderFinish(void);
+// stop the worker and drop whatever it has not handed over yet
+void loaderCancel(void);
+// percentage of the file indexed so far
+int loaderProgress(void);
+
+#endif
@@ -0,0 +1,228 @@
+#include "screen.h"
+
+static ScreenCell *g_front = NULL; // what the terminal shows
+static ScreenCell *g_back = NULL;  // the frame being drawn
+static int g_rows = 0;
+static int g_cols = 0;
+static bool g_repaint = true;      // front buffer unknown, clear and redraw
+
+// terminal state between flushes: cursor position (-1 when unknown, e.g.
+// after writing the last column) and the current SGR attributes
+static int g_cur_row = -1;
+static int g_cur_col = -1;
+static ScreenCell g_pen = { " ", 0, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT };
+
+static const ScreenCell k_blank = { " ", 0, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT };
+
+static bool pen_eq(const ScreenCell *a, const ScreenCell *b){
+    return a->attr == b->attr && a->fg == b->fg && a->bg == b->bg;
+}
+
+static bool cell_eq(const ScreenCell *a, const ScreenCell *b){
+    return memcmp(a->ch, b->ch, sizeof(a->ch)) == 0 && pen_eq(a, b);
+}
+
+static void set_cell(ScreenCell *cell, char ch, int fg, int bg, int attr){
+    memset(cell->ch, 0, sizeof(cell->ch));
+    cell->ch[0] = ch;
+    cell->attr = (unsigned char) attr;
+    cell->fg = (short) fg;
+    cell->bg = (short) bg;
+}
+
+static void append_cell(struct abuf *ab, const ScreenCell *cell){
+    abAppend(ab, cell->ch, (int) strnlen(cell->ch, sizeof(cell->ch)));
+}
+
+void screenResize(int rows, int cols){
+    screenFree();
+    if (rows <= 0 || cols <= 0) return;
+    g_front = malloc(sizeof(ScreenCell) * (size_t) rows * (size_t) cols);
+    g_back = malloc(sizeof(ScreenCell) * (size_t) rows * (size_t) cols);
+    if (!g_front || !g_back) { screenFree(); return; }
+    g_rows = rows;
+    g_cols = cols;
+    screenClear();
+    g_repaint = true;
+}
+
+void screenInvalidate(void){
+    g_repaint = true;
+}
+
+void screenFree(void){
+    free(g_front);
+    free(g_back);
+    g_front = g_back = NULL;
+    g_rows = g_cols = 0;
+}
+
+void screenClear(void){
+    for (int i = 0; i < g_rows * g_cols; i++) g_back[i] = k_blank;
+}
+
+int screenPut(int row, int col, const char *s, int len, int fg, int bg, int attr){
+    if (row < 0 || row >= g_rows || col >= g_cols) return 0;
+    if (col < 0) {
+        s -= col;
+        len += col;
+        col = 0;
+    }
+    if (len > g_cols - col) len = g_cols - col;
+
+    ScreenCell *cell = &g_back[row * g_cols + col];
+    for (int i = 0; i < len; i++) set_cell(&cell[i], s[i], fg, bg, attr);
+    return len > 0 ? len : 0;
+}
+
+void screenFill(int row, int col, int len, char ch, int fg, int bg, int attr){
+    if (row < 0 || row >= g_rows || col >= g_cols) return;
+    if (col < 0) { len += col; col = 0; }
+    if (len > g_cols - col) len = g_cols - col;
+
+    ScreenCell *cell = &g_back[row * g_cols + col];
+    for (int i = 0; i < len; i++) set_cell(&cell[i], ch, fg, bg, attr);
+}
+
+int screenPutText(int row, int rx, int xoff, const char *s, int len, int fg, int bg, int attr){
+    ScreenCell *line = row >= 0 && row < g_rows ? &g_back[row * g_cols] : NULL;
+    for (int i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char) s[i];
+        int col = rx - xoff;
+        if ((ch & 0xc0) == 0x80) {
+            // a continuation byte joins the cell before it, even one drawn
+            // by an earlier call; off screen it has nowhere to go
+            if (!line || col <= 0 || col > g_cols) continue;
+            ScreenCell *prev = &line[col - 1];
+            size_t n = strnlen(prev->ch, sizeof(prev->ch));
+            if (n < sizeof(prev->ch)) prev->ch[n] = (char) ch;
+            continue;
+        }
+        if (col >= g_cols) break;
+        int width = ch == '\t' ? TAB_STOP - rx % TAB_STOP : 1;
+        char shown = ch == '\t' ? ' ' : ch < 0x20 || ch == 0x7f ? '?' : (char) ch;
+        for (int k = 0; k < width; k++, col++) {
+            if (line && col >= 0 && col < g_cols) set_cell(&line[col], shown, fg, bg, attr);
+        }
+        rx += width;
+    }
+    return rx;
+}
+
+/*** flushing ***/
+
+static void append_color(struct abuf *ab, int color, bool background){
+    if (color >= 0) {
+        abAppendSGR(ab, color);
+        return;
+    }
+    abAppend(ab, background ? "\x1b[48;5;" : "\x1b[38;5;", 7);
+    abAppendInt(ab, -color);
+    abAppendChar(ab, 'm');
+}
+
+static void set_pen(struct abuf *ab, const ScreenCell *c){
+    if (pen_eq(c, &g_pen)) return;
+    if (c->attr != g_pen.attr) {
+        abAppend(ab, "\x1b[m", 3);
+        g_pen = k_blank;
+        if (c->attr & SCREEN_ATTR_REVERSE) abAppend(ab, "\x1b[7m", 4);
+        g_pen.attr = c->attr;
+    }
+    if (c->fg != g_pen.fg) append_color(ab, c->fg, false);
+    if (c->bg != g_pen.bg) append_color(ab, c->bg, true);
+    g_pen.fg = c->fg;
+    g_pen.bg = c->bg;
+}
+
+// move the terminal cursor using whichever sequence is shortest
+static void move_to(struct abuf *ab, int row, int col, const ScreenCell *back_row){
+    if (g_cur_row == row && g_cur_col == col) return;
+
+    if (g_cur_row == row && col > g_cur_col) {
+        // a short gap of unchanged cells drawn with the current pen is
+        // cheaper to write again than to jump over
+        int gap = col - g_cur_col;
+        bool same_pen = gap <= 4;
+        for (int c = g_cur_col; same_pen && c < col; c++) same_pen = pen_eq(&back_row[c], &g_pen);
+        if (same_pen) {
+            for (int c = g_cur_col; c < col; c++) append_cell(ab, &back_row[c]);
+        } else {
+            abAppend(ab, "\x1b[", 2);
+            abAppendInt(ab, gap);
+            abAppendChar(ab, 'C');
+        }
+    } else if (g_cur_row == row && col == 0) {
+        abAppendChar(ab, '\r');
+    } else if (g_cur_row >= 0 && row == g_cur_row + 1 && col == 0) {
+        abAppend(ab, "\r\n", 2);
+    } else {
+        abAppend(ab, "\x1b[", 2);
+        abAppendInt(ab, row + 1);
+        abAppendChar(ab, ';');
+        abAppendInt(ab, col + 1);
+        abAppendChar(ab, 'H');
+    }
+    g_cur_row = row;
+    g_cur_col = col;
+}
+
+void screenFlush(struct abuf *ab, int cursor_row, int cursor_col){
+    if (!g_back) return;
+
+    int start = ab->len;
+    abAppend(ab, "\x1b[?25l", 6);
+    int drawn = ab->len;
+
+    if (g_repaint) {
+        abAppend(ab, "\x1b[m\x1b[2J", 7);
+        g_pen = k_blank;
+        g_cur_row = g_cur_col = -1;
+        for (int i = 0; i < g_rows * g_cols; i++) g_front[i] = k_blank;
+        g_repaint = false;
+    }
+
+    for (int r = 0; r < g_rows; r++){
+        ScreenCell *back = &g_back[r * g_cols];
+        ScreenCell *front = &g_front[r * g_cols];
+
+        // past this column the new row is blank
+        int tail = g_cols;
+        while (tail > 0 && cell_eq(&back[tail - 1], &k_blank)) tail--;
+
+        for (int c = 0; c < g_cols; c++){
+            if (cell_eq(&back[c], &front[c])) continue;
+
+            if (c >= tail && g_cols - c > 3) {
+                // erase the rest of the row in one go
+                move_to(ab, r, c, back);
+                set_pen(ab, &k_blank);
+                abAppend(ab, "\x1b[K", 3);
+                for (int k = c; k < g_cols; k++) front[k] = k_blank;
+                break;
+            }
+
+            move_to(ab, r, c, back);
+            set_pen(ab, &back[c]);
+            append_cell(ab, &back[c]);
+            front[c] = back[c];
+            g_cur_col = c + 1;
+            // the terminal may now be waiting to wrap, don't trust the column
+            if (g_cur_col == g_cols) g_cur_row = g_cur_col = -1;
+        }
+    }
+
+    set_pen(ab, &k_blank);
+    if (cursor_row < 0) cursor_row = 0;
+    if (cursor_row >= g_rows) cursor_row = g_rows - 1;
+    if (cursor_col < 0) cursor_col = 0;
+    if (cursor_col >= g_cols) cursor_col = g_cols - 1;
+    move_to(ab, cursor_row, cursor_col, &g_back[cursor_row * g_cols]);
+
+    if (ab->len == drawn) {
+        // nothing changed, not even the cursor
+        ab->len = start;
+        return;
+    }
+    abAppend(ab, "\x1b[?25h", 6);
+}
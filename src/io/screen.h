@@ -0,0 +1,42 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "common.h"
+#include "buffer.h"
+
+/*** screen framebuffer ***/
+// Drawing goes into a back buffer of cells. screenFlush compares it with
+// what the terminal shows (the front buffer) and only emits changed cells.
+
+#define SCREEN_FG_DEFAULT 39
+#define SCREEN_BG_DEFAULT 49
+#define SCREEN_ATTR_REVERSE 1
+
+// colors use the syntax color ids: SGR codes, or -n for 256-color palette n
+typedef struct {
+    char ch[4]; // one character: an ASCII byte or a UTF-8 sequence, NUL padded
+    unsigned char attr;
+    short fg;
+    short bg;
+} ScreenCell;
+
+void screenResize(int rows, int cols);
+void screenInvalidate(void);
+void screenFree(void);
+
+// reset the back buffer to blank cells
+void screenClear(void);
+// write len chars at (row, col), clipped to the screen; returns chars written
+int screenPut(int row, int col, const char *s, int len, int fg, int bg, int attr);
+void screenFill(int row, int col, int len, char ch, int fg, int bg, int attr);
+// write len bytes of text that start at text column rx, shifted left by
+// xoff columns: tabs become spaces up to the next tab stop, control bytes
+// become '?' and a UTF-8 sequence shares the cell of its first byte, so
+// each cell is one terminal column. Returns the text column after the bytes
+int screenPutText(int row, int rx, int xoff, const char *s, int len, int fg, int bg, int attr);
+
+// append the escapes that turn the front buffer into the back buffer and
+// leave the cursor at (cursor_row, cursor_col)
+void screenFlush(struct abuf *ab, int cursor_row, int cursor_col);
+
+#endif
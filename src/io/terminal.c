@@ -1,4 +1,7 @@
 #include "terminal.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 
 /*** terminal functions ***/
 
@@ -10,6 +13,7 @@ void die(const char *s){
 }
 
 void disableRawMode(void){
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1){
         die("tcsetattr");
     }
@@ -23,68 +27,237 @@ void enableRawMode(void){
     raw.c_oflag &= ~(OPOST);
     raw.c_cflag |= (CS8);
     raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+    // reads never block, the main loop polls for input instead
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+    // ask for pastes to be wrapped in ESC[200~ ... ESC[201~
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-int editorReadKey(void){
-    int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) die("read");
+/*** input ***/
+// Everything available on stdin is read in one go into g_in and decoded
+// from there, so a burst of keys (or a paste) costs one read() instead of
+// one per byte.
+
+#define ESC_TIMEOUT_MS 25  // wait for the rest of a split escape sequence
+#define CSI_MAX_LEN 16
+#define PASTE_TIMEOUT_MS 500  // give up on a paste that never ends
+#define PASTE_START -2        // decode_escape result for ESC[200~
+
+static unsigned char g_in[8192];
+static size_t g_in_pos = 0;
+static size_t g_in_len = 0;
+
+static char *g_paste = NULL;
+static int g_paste_len = 0;
+static int g_paste_cap = 0;
+
+static int g_resize_pipe[2] = { -1, -1 };
+
+static bool wait_input(int timeout_ms){
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    int n;
+    while ((n = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR);
+    return n > 0;
+}
+
+int terminalReadInput(void){
+    if (g_in_pos > 0) {
+        memmove(g_in, &g_in[g_in_pos], g_in_len - g_in_pos);
+        g_in_len -= g_in_pos;
+        g_in_pos = 0;
     }
+    if (g_in_len == sizeof(g_in)) return 0;
 
-    if (c == '\x1b') {
-        char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1)!= 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1)!= 1) return '\x1b';
-
-        if (seq[0] == '['){
-            if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
-                    }
-                }
-            } else {
-                switch(seq[1]) {
-                    case 'A': return ARROW_UP;
-                    case 'B': return ARROW_DOWN;
-                    case 'C': return ARROW_RIGHT;
-                    case 'D': return ARROW_LEFT;
-                    case 'H': return HOME_KEY;
-                    case 'F': return END_KEY;
-                }
-            }
-        } else if (seq[0] == 'O') {
-            switch(seq[1]) {
-                case 'H': return HOME_KEY;
-                case 'F': return END_KEY;
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, &g_in[g_in_len], sizeof(g_in) - g_in_len)) == -1) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN) return 0;
+        return -1;
+    }
+    g_in_len += (size_t) n;
+    return (int) n;
+}
+
+bool terminalInputPending(void){
+    return wait_input(0);
+}
+
+static int control_key(unsigned char c){
+    if (isprint(c)) {
+        return c;
+    } else if (c == '\r') {
+        return NEWLINE_KEY;
+    } else if (c == 127 || c == '\b') { // Backspace (mac = 127)
+        return BACKSPACE;
+    } else if (c == '\t') {
+        return TAB_KEY;
+    }
+    return c;
+}
+
+// decode the escape sequence at p; returns the bytes it takes up, or 0 if
+// more input is needed to tell
+static size_t decode_escape(const unsigned char *p, size_t n, int *key){
+    *key = '\x1b';
+    if (n < 2) return 0;
+
+    if (p[1] == 'O') {
+        if (n < 3) return 0;
+        switch (p[2]) {
+            case 'H': *key = HOME_KEY; break;
+            case 'F': *key = END_KEY; break;
+        }
+        return 3;
+    }
+    if (p[1] != '[') return 1;
+
+    // CSI: parameter bytes then a final byte in 0x40-0x7e
+    size_t i = 2;
+    while (i < n && i < CSI_MAX_LEN && p[i] >= 0x30 && p[i] <= 0x3f) i++;
+    if (i == CSI_MAX_LEN) return 1;
+    if (i == n) return 0;
+    if (p[i] < 0x40 || p[i] > 0x7e) return 1;
+
+    if (p[i] == '~') {
+        if (i == 5 && memcmp(&p[2], "200", 3) == 0) *key = PASTE_START;
+        if (i == 3) {
+            switch (p[2]) {
+                case '1': *key = HOME_KEY; break;
+                case '3': *key = DEL_KEY; break;
+                case '4': *key = END_KEY; break;
+                case '5': *key = PAGE_UP; break;
+                case '6': *key = PAGE_DOWN; break;
+                case '7': *key = HOME_KEY; break;
+                case '8': *key = END_KEY; break;
             }
         }
+    } else if (i == 2) {
+        switch (p[i]) {
+            case 'A': *key = ARROW_UP; break;
+            case 'B': *key = ARROW_DOWN; break;
+            case 'C': *key = ARROW_RIGHT; break;
+            case 'D': *key = ARROW_LEFT; break;
+            case 'H': *key = HOME_KEY; break;
+            case 'F': *key = END_KEY; break;
+        }
+    }
+    return i + 1;
+}
 
-        return '\x1b';
-    } else {
-        if (isprint(c)) {
-            return c;
-        } else if (c == '\r') {
-            return NEWLINE_KEY;
-        } else if (c == 127 || c == '\b') { // Backspace (mac = 127)
-            return BACKSPACE;
-        } else if (c == '\t') {
-            return TAB_KEY;
+static void paste_append(const unsigned char *s, size_t len){
+    if (len == 0) return;
+    if (g_paste_len + (int) len > g_paste_cap) {
+        int cap = g_paste_cap ? g_paste_cap : 4096;
+        while (cap < g_paste_len + (int) len) cap *= 2;
+        char *p = realloc(g_paste, cap);
+        if (!p) return;
+        g_paste = p;
+        g_paste_cap = cap;
+    }
+    memcpy(&g_paste[g_paste_len], s, len);
+    g_paste_len += (int) len;
+}
+
+static const unsigned char *find_paste_end(const unsigned char *p, size_t n){
+    const unsigned char *end = p + n;
+    while ((p = memchr(p, '\x1b', end - p)) != NULL) {
+        if (end - p >= 6 && memcmp(p, "\x1b[201~", 6) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+// collect everything up to ESC[201~ into g_paste, reading more as needed
+static int read_paste(void){
+    g_paste_len = 0;
+    for (;;) {
+        const unsigned char *p = &g_in[g_in_pos];
+        size_t n = g_in_len - g_in_pos;
+        const unsigned char *end = find_paste_end(p, n);
+        if (end) {
+            paste_append(p, end - p);
+            g_in_pos += (end - p) + 6;
+            break;
         }
-        return c;
+
+        // the end marker may be split across reads, keep a possible prefix
+        size_t keep = n < 5 ? n : 5;
+        paste_append(p, n - keep);
+        g_in_pos += n - keep;
+        if (!wait_input(PASTE_TIMEOUT_MS) || terminalReadInput() <= 0) {
+            paste_append(&g_in[g_in_pos], g_in_len - g_in_pos);
+            g_in_pos = g_in_len;
+            break;
+        }
+    }
+    return PASTE_KEY;
+}
+
+const char *terminalPasteText(int *len){
+    *len = g_paste_len;
+    return g_paste;
+}
+
+int terminalNextKey(void){
+    if (g_in_pos == g_in_len) return -1;
+
+    unsigned char c = g_in[g_in_pos];
+    if (c != '\x1b') {
+        g_in_pos++;
+        return control_key(c);
     }
+
+    int key;
+    size_t used = decode_escape(&g_in[g_in_pos], g_in_len - g_in_pos, &key);
+    if (used == 0) {
+        // a sequence split across reads, or a lone ESC key press
+        while (used == 0 && wait_input(ESC_TIMEOUT_MS) && terminalReadInput() > 0)
+            used = decode_escape(&g_in[g_in_pos], g_in_len - g_in_pos, &key);
+        if (used == 0) {
+            key = '\x1b';
+            used = 1;
+        }
+    }
+    g_in_pos += used;
+    if (key == PASTE_START) return read_paste();
+    return key;
+}
+
+/*** window size changes ***/
+
+static void handle_sigwinch(int sig){
+    (void) sig;
+    int saved = errno;
+    if (write(g_resize_pipe[1], "w", 1) == -1) {
+        // pipe already full, a resize is pending anyway
+    }
+    errno = saved;
+}
+
+int terminalWatchResize(void){
+    if (pipe(g_resize_pipe) == -1) return -1;
+    for (int i = 0; i < 2; i++) {
+        fcntl(g_resize_pipe[i], F_SETFL, fcntl(g_resize_pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(g_resize_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigwinch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) return -1;
+    return g_resize_pipe[0];
+}
+
+bool terminalTakeResize(void){
+    char buf[64];
+    bool resized = false;
+    while (read(g_resize_pipe[0], buf, sizeof(buf)) > 0) resized = true;
+    return resized;
 }
 
 int getCursorPosition(int *rows, int *cols) {
@@ -95,7 +268,7 @@ int getCursorPosition(int *rows, int *cols) {
     printf("\r\n");
 
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+        if (!wait_input(100) || read(STDIN_FILENO, &buf[i], 1) != 1) break;
         if (buf[i] == 'R') break;
         i++;
     }
@@ -7,7 +7,21 @@
 void die(const char *s);
 void disableRawMode(void);
 void enableRawMode(void);
-int editorReadKey(void);
+
+// buffered input: terminalReadInput reads whatever is pending on stdin
+// (returns bytes read, -1 on error) and terminalNextKey decodes one key
+// from it, or returns -1 once the buffer is empty
+int terminalReadInput(void);
+int terminalNextKey(void);
+bool terminalInputPending(void);
+// text of the last PASTE_KEY, valid until the next key is decoded
+const char *terminalPasteText(int *len);
+
+// install a SIGWINCH handler; returns a descriptor that becomes readable
+// after the window size changes
+int terminalWatchResize(void);
+bool terminalTakeResize(void); // drains the descriptor, true if resized
+
 int getCursorPosition(int *rows, int *cols);
 int getWindowSize(int *rows, int *cols);
 
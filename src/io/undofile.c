@@ -0,0 +1,181 @@
+#include "undofile.h"
+#include "editlog.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// On disk: an UndoFileHeader, the nodes and the edit log records, all in the layout they have in memory so the nodes and the log
+// can be used straight from the mapping. The header records the sizes of
+// the structures, so a file from a different build is just ignored.
+// Nothing past the header is checked here: the nodes are checked by the
+// history the first time it walks through them, and the log's records
+// when they are read.
+
+#define UNDOFILE_MAGIC "teundo2"
+
+typedef struct {
+    char magic[8];
+    uint32_t node_size;
+    uint32_t unused;
+    uint64_t hash;
+    FileId file; // the file as saved
+    int32_t count;
+    int32_t current;
+    uint64_t log_len;
+} UndoFileHeader;
+
+#define HASH_PRIME 0x100000001b3ULL
+
+void undoHashInit(UndoHash *hash) {
+    memset(hash, 0, sizeof(*hash));
+    hash->h = 0xcbf29ce484222325ULL;
+}
+
+static void hash_word(UndoHash *hash, uint64_t w) {
+    hash->h = (((hash->h << 27) | (hash->h >> 37)) ^ w) * HASH_PRIME;
+}
+
+void undoHashUpdate(UndoHash *hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    hash->len += len;
+    if (hash->ntail > 0) {
+        while (len > 0 && hash->ntail < 8) {
+            hash->tail[hash->ntail++] = *p++;
+            len--;
+        }
+        if (hash->ntail < 8) return;
+        uint64_t w;
+        memcpy(&w, hash->tail, 8);
+        hash_word(hash, w);
+        hash->ntail = 0;
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        hash_word(hash, w);
+    }
+    memcpy(hash->tail, p, len);
+    hash->ntail = (unsigned)len;
+}
+
+uint64_t undoHashFinal(const UndoHash *hash) {
+    UndoHash last = *hash;
+    uint64_t w = 0;
+    memcpy(&w, last.tail, last.ntail);
+    hash_word(&last, w);
+    hash_word(&last, last.len);
+    uint64_t h = last.h;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int undoFileWrite(const char *path, const struct stat *st, uint64_t hash,
+                  const HistorySnapshot *s) {
+    size_t len = strlen(path);
+    char *tmp = malloc(len + 8);
+    if (!tmp) return -1;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".XXXXXX", 8);
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        free(tmp);
+        unlink(path);
+        return -1;
+    }
+
+    UndoFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, UNDOFILE_MAGIC, sizeof(hdr.magic));
+    hdr.node_size = (uint32_t)sizeof(HistoryNode);
+    hdr.hash = hash;
+    fileIdFromStat(st, &hdr.file);
+    hdr.count = s->count;
+    hdr.current = s->current;
+    hdr.log_len = s->log.base_len + s->log.spill_len + s->log.len;
+
+    // written in place of the old file, which may still be mapped
+    int rc = -1;
+    if (writeFully(fd, &hdr, sizeof(hdr)) == 0 &&
+        writeFully(fd, s->nodes, sizeof(HistoryNode) * (size_t)s->count) == 0 &&
+        editLogWriteSnapshot(&s->log, fd) == 0) {
+        rc = 0;
+    }
+    if (close(fd) == -1) rc = -1;
+    if (rc == 0 && rename(tmp, path) == -1) rc = -1;
+    if (rc != 0) {
+        // an old history would no longer line up with the journal
+        unlink(tmp);
+        unlink(path);
+    }
+    free(tmp);
+    return rc;
+}
+
+// whether filename, which has the size it was saved with, still has the
+// same contents
+static bool same_contents(const char *filename, const UndoFileHeader *hdr) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return false;
+    UndoHash hash;
+    undoHashInit(&hash);
+    bool ok = true;
+    if (hdr->file.size > 0) {
+        void *map = mmap(NULL, (size_t)hdr->file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = map != MAP_FAILED;
+        if (ok) {
+            undoHashUpdate(&hash, map, (size_t)hdr->file.size);
+            munmap(map, (size_t)hdr->file.size);
+        }
+    }
+    close(fd);
+    return ok && undoHashFinal(&hash) == hdr->hash;
+}
+
+int undoFileOpen(const char *path, const char *filename, const struct stat *st, UndoFile *u) {
+    memset(u, 0, sizeof(*u));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    UndoFileHeader hdr;
+    struct stat ust;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || fstat(fd, &ust) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // each part fits in the file before the sum of them is taken
+    uint64_t file_len = (uint64_t)ust.st_size;
+    bool valid = memcmp(hdr.magic, UNDOFILE_MAGIC, sizeof(hdr.magic)) == 0 &&
+                 hdr.node_size == sizeof(HistoryNode) &&
+                 hdr.count > 0 && hdr.current >= 0 && hdr.current < hdr.count &&
+                 (uint64_t)hdr.count <= file_len / sizeof(HistoryNode) &&
+                 hdr.log_len <= file_len;
+    size_t nodes_len = valid ? sizeof(HistoryNode) * (size_t)hdr.count : 0;
+    size_t len = sizeof(hdr) + nodes_len + (valid ? (size_t)hdr.log_len : 0);
+    valid = valid && (uint64_t)len == file_len;
+
+    // a file touched or copied without changing keeps its history, which
+    // takes reading it; otherwise only the header is read here
+    UndoFileHeader now = hdr;
+    fileIdFromStat(st, &now.file);
+    if (valid && memcmp(&now, &hdr, sizeof(hdr)) != 0) {
+        valid = now.file.size == hdr.file.size && same_contents(filename, &hdr);
+    }
+    void *map = valid ? mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    u->map = map;
+    u->len = len;
+    u->nodes = (HistoryNode *)((char *)map + sizeof(hdr));
+    u->count = hdr.count;
+    u->current = hdr.current;
+    u->log = (const unsigned char *)u->nodes + nodes_len;
+    u->log_len = (size_t)hdr.log_len;
+    return 0;
+}
+
+void undoFileClose(UndoFile *u) {
+    if (u->map) munmap(u->map, u->len);
+    memset(u, 0, sizeof(*u));
+}
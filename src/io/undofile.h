@@ -0,0 +1,48 @@
+#ifndef UNDOFILE_H
+#define UNDOFILE_H
+
+#include "common.h"
+#include "history.h"
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*** saved undo history ***/
+// Every save also writes the undo tree and its edit log next to the
+// file, as .<name>.undo, keyed by a hash of the bytes saved. It is found
+// again by the file's identity (device, inode, size and mtime) or, if
+// that changed, by hashing the file. Opening only maps it: nodes are
+// used in place and groups are decoded from the mapping, each checked
+// when undo first gets there.
+
+// a hash of file contents, the same however the bytes are split up
+typedef struct {
+    uint64_t h;
+    unsigned char tail[8]; // bytes not hashed yet, until a word is full
+    unsigned ntail;
+    uint64_t len;
+} UndoHash;
+
+typedef struct {
+    void *map;
+    size_t len;
+    HistoryNode *nodes; // writable, changes stay private
+    int count;
+    int current; // the state the file was saved in
+    const unsigned char *log;
+    size_t log_len;
+} UndoFile;
+
+void undoHashInit(UndoHash *hash);
+void undoHashUpdate(UndoHash *hash, const void *data, size_t len);
+uint64_t undoHashFinal(const UndoHash *hash);
+
+// write the history s to path for the file st, whose contents hash to
+// hash; returns 0 on success, -1 after removing path
+int undoFileWrite(const char *path, const struct stat *st, uint64_t hash,
+                  const HistorySnapshot *s);
+// map the undo file at path if it was written for filename as it is now
+// (st); returns -1 if there is none or it is for other contents
+int undoFileOpen(const char *path, const char *filename, const struct stat *st, UndoFile *u);
+void undoFileClose(UndoFile *u);
+
+#endif
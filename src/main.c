@@ -2,6 +2,10 @@
 #include "editor.h"
 #include "fileio.h"
 #include "syntax.h"
+#include "loader.h"
+#include "project.h"
+
+#include <poll.h>
 
 static int is_c_file(const char *path) {
   const char *dot = strrchr(path, '.');
@@ -11,6 +15,7 @@ static int is_c_file(const char *path) {
 int main(int argc, char *argv[]) {
   enableRawMode();
   initEditor();
+  bool highlight = false;
 
   if (argc >= 2) {
       editorOpen(argv[1]);
@@ -20,15 +25,53 @@ int main(int argc, char *argv[]) {
               perror("syntax init failed");
               exit(1);
           }
-          syntaxReparseFull();
+          highlight = true;
+          // a file still loading is parsed once all of it is in
+          if (!loaderActive()) syntaxReparseFull();
+          // names from the other files of its project, read in the
+          // background; completion does without them if this fails
+          projectStart(argv[1]);
       }
   } else {
       editorAllocateNewRow();
   }
 
+  int resize_fd = terminalWatchResize();
+  if (resize_fd == -1) die("sigaction");
+
   while (1) {
+      editorFinishInput();
       editorRefreshScreen();
-      editorProcessKey();
+
+      struct pollfd fds[4] = {
+          { STDIN_FILENO, POLLIN, 0 },
+          { resize_fd, POLLIN, 0 },
+          { loaderFd(), POLLIN, 0 }, // ignored by poll once loading is done
+          { editorSaveFd(), POLLIN, 0 }, // likewise when no save is running
+      };
+      if (poll(fds, 4, -1) == -1) {
+          if (errno == EINTR) continue;
+          die("poll");
+      }
+
+      if (fds[1].revents & POLLIN) {
+          terminalTakeResize();
+          editorResize();
+      }
+
+      if ((fds[2].revents & POLLIN) && loaderPoll() && highlight) syntaxReparseFull();
+
+      if (fds[3].revents & POLLIN) editorSaveWait();
+
+      if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) die("stdin");
+      if (fds[0].revents & POLLIN) {
+          // handle every key already queued before drawing again
+          do {
+              if (terminalReadInput() == -1) die("read");
+              int c;
+              while ((c = terminalNextKey()) != -1) editorProcessKey(c);
+          } while (terminalInputPending());
+      }
   }
 
   return 0;
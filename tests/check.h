@@ -0,0 +1,14 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+// fail the test, from main or a helper returning int, naming the condition
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    } \
+} while (0)
+
+#endif
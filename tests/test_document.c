@@ -0,0 +1,251 @@
+#include "common.h"
+#include "document.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static char *flatten(Document *d) {
+    size_t len = docLength(d);
+    char *out = malloc(len + 1);
+    size_t pos = 0;
+    for (int i = 0; i < docNumRows(d); i++) {
+        erow *row = docRow(d, i);
+        memcpy(out + pos, row->chars, (size_t)row->size);
+        pos += (size_t)row->size;
+        if (i < docNumRows(d) - 1) out[pos++] = '\n';
+    }
+    out[pos] = '\0';
+    return out;
+}
+
+static size_t point_to_byte(const char *text, int row, int col) {
+    size_t b = 0;
+    while (row > 0) { if (text[b++] == '\n') row--; }
+    return b + (size_t)col;
+}
+
+static DocEdit last_edit;
+static int edits_seen;
+
+static void record_edit(const DocEdit *edit, void *ctx) {
+    (void)ctx;
+    last_edit = *edit;
+    edits_seen++;
+}
+
+// the reported edit must explain the difference between before and after
+static int edit_matches(const char *before, const char *after) {
+    DocEdit *e = &last_edit;
+    size_t blen = strlen(before), alen = strlen(after);
+    if (e->old_end_byte < e->start_byte || e->new_end_byte < e->start_byte) return 0;
+    if (e->old_end_byte > blen || e->new_end_byte > alen) return 0;
+    if (blen - e->old_end_byte != alen - e->new_end_byte) return 0;
+    if (memcmp(before, after, e->start_byte) != 0) return 0;
+    if (strcmp(before + e->old_end_byte, after + e->new_end_byte) != 0) return 0;
+    return point_to_byte(before, e->start_row, e->start_col) == e->start_byte &&
+           point_to_byte(before, e->old_end_row, e->old_end_col) == e->old_end_byte &&
+           point_to_byte(after, e->new_end_row, e->new_end_col) == e->new_end_byte;
+}
+
+static int row_is(Document *d, int at, const char *s) {
+    erow *row = docRow(d, at);
+    return row && row->size == (int)strlen(s) && memcmp(row->chars, s, strlen(s)) == 0;
+}
+
+int main(void) {
+    Document d;
+    docInit(&d);
+
+    // build a large document and check lookups and offsets
+    for (int i = 0; i < 5000; i++) {
+        char line[32];
+        int len = snprintf(line, sizeof(line), "line %d", i);
+        CHECK(docInsertRow(&d, i, line, len) == 0);
+    }
+    CHECK(docNumRows(&d) == 5000);
+    CHECK(row_is(&d, 0, "line 0"));
+    CHECK(row_is(&d, 4999, "line 4999"));
+
+    size_t off = 0;
+    for (int i = 0; i < 5000; i++) {
+        CHECK(docRowOffset(&d, i) == off);
+        int col = -1;
+        CHECK(docRowAtByte(&d, off + 2, &col) == i && col == 2);
+        off += (size_t)docRow(&d, i)->size + 1;
+    }
+    CHECK(docLength(&d) == off - 1);
+
+    erow *rows[16];
+    CHECK(docRows(&d, 4990, 16, rows) == 10);
+    CHECK(strcmp(rows[3]->chars, "line 4993") == 0);
+
+    // in-row edits keep byte offsets in sync
+    CHECK(docRowInsert(&d, 10, 4, "XY", 2) == 0);
+    CHECK(row_is(&d, 10, "lineXY 10"));
+    CHECK(docRowOffset(&d, 11) == docRowOffset(&d, 10) + 10);
+    CHECK(docRowDelete(&d, 10, 4, 2) == 0);
+    CHECK(row_is(&d, 10, "line 10"));
+
+    // split and join
+    CHECK(docSplitRow(&d, 20, 4) == 0);
+    CHECK(row_is(&d, 20, "line") && row_is(&d, 21, " 20") && row_is(&d, 22, "line 21"));
+    CHECK(docJoinRow(&d, 20) == 0);
+    CHECK(row_is(&d, 20, "line 20") && docNumRows(&d) == 5000);
+
+    // multi-line text insert and range delete
+    int er = 0, ec = 0;
+    CHECK(docInsertText(&d, 30, 2, "a\nbb\nccc", 8, &er, &ec) == 0);
+    CHECK(er == 32 && ec == 3);
+    CHECK(row_is(&d, 30, "lia") && row_is(&d, 31, "bb") && row_is(&d, 32, "cccne 30"));
+    CHECK(docRow(&d, 33) && row_is(&d, 33, "line 31"));
+    CHECK(docDeleteRange(&d, 30, 2, er, ec) == 0);
+    CHECK(row_is(&d, 30, "line 30") && row_is(&d, 31, "line 31"));
+    CHECK(docNumRows(&d) == 5000);
+
+    CHECK(docInsertText(&d, 40, 0, "\n", 1, &er, &ec) == 0);
+    CHECK(er == 41 && ec == 0 && row_is(&d, 40, "") && row_is(&d, 41, "line 40"));
+    CHECK(docDeleteRow(&d, 40) == 0);
+    CHECK(row_is(&d, 40, "line 40") && docNumRows(&d) == 5000);
+
+    // every edit reports byte and point ranges that match the text change
+    docFree(&d);
+    docSetEditListener(&d, record_edit, NULL);
+    char *before = flatten(&d), *after;
+#define EDIT_OK(op) do { \
+        edits_seen = 0; \
+        CHECK((op) == 0); \
+        after = flatten(&d); \
+        CHECK(edits_seen == 1 && edit_matches(before, after)); \
+        free(before); \
+        before = after; \
+    } while (0)
+    EDIT_OK(docInsertRow(&d, 0, "first", 5));
+    EDIT_OK(docInsertRow(&d, 1, "last", 4));
+    EDIT_OK(docInsertRow(&d, 1, "middle", 6));
+    EDIT_OK(docRowInsert(&d, 1, 3, "XX", 2));
+    EDIT_OK(docRowDelete(&d, 1, 2, 3));
+    EDIT_OK(docSplitRow(&d, 0, 2));
+    EDIT_OK(docJoinRow(&d, 0));
+    EDIT_OK(docInsertText(&d, 2, 1, "a\nb\n", 4, NULL, NULL));
+    EDIT_OK(docDeleteRange(&d, 0, 3, 3, 1));
+    EDIT_OK(docDeleteRow(&d, docNumRows(&d) - 1));
+    EDIT_OK(docDeleteRow(&d, 0));
+    CHECK(docNumRows(&d) == 0);
+#undef EDIT_OK
+    free(before);
+
+    // edits in a batch are reported once, as one edit covering them all
+    for (int i = 0; i < 20; i++) docInsertRow(&d, i, "0123456789", 10);
+    srand(7);
+    for (int round = 0; round < 200; round++) {
+        before = flatten(&d);
+        edits_seen = 0;
+        docBeginBatch(&d);
+        docBeginBatch(&d);
+        int n = 1 + rand() % 6;
+        for (int k = 0; k < n; k++) {
+            int row = rand() % docNumRows(&d);
+            int col = rand() % (docRow(&d, row)->size + 1);
+            if (rand() % 2) {
+                const char *texts[] = { "ab", "x\ny", "\n", "long text" };
+                const char *t = texts[rand() % 4];
+                CHECK(docInsertText(&d, row, col, t, (int)strlen(t), NULL, NULL) == 0);
+            } else {
+                int end_row = row + rand() % 2;
+                if (end_row >= docNumRows(&d)) end_row = row;
+                int end_col = rand() % (docRow(&d, end_row)->size + 1);
+                if (end_row == row && end_col < col) end_col = col;
+                CHECK(docDeleteRange(&d, row, col, end_row, end_col) == 0);
+            }
+        }
+        docEndBatch(&d);
+        CHECK(edits_seen == 0);
+        docEndBatch(&d);
+        after = flatten(&d);
+        CHECK(edits_seen <= 1);
+        if (edits_seen == 1) CHECK(edit_matches(before, after));
+        else CHECK(strcmp(before, after) == 0);
+        free(before);
+        free(after);
+    }
+    docFree(&d);
+
+    docFree(&d);
+    CHECK(docNumRows(&d) == 0 && docLength(&d) == 0);
+
+    // rows over a mapping borrow its bytes until they are edited
+    const char text[] = "alpha\r\nbeta\n\ngamma";
+    size_t tlen = sizeof(text) - 1;
+    char *map = mmap(NULL, tlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(map != MAP_FAILED);
+    memcpy(map, text, tlen);
+    mprotect(map, tlen, PROT_READ);
+
+    CHECK(docLoadMapped(&d, map, tlen) == 0);
+    CHECK(docNumRows(&d) == 4);
+    CHECK(row_is(&d, 0, "alpha") && row_is(&d, 1, "beta"));
+    CHECK(row_is(&d, 2, "") && row_is(&d, 3, "gamma"));
+    CHECK(docRow(&d, 1)->mapped && docRow(&d, 1)->chars == map + 7);
+    CHECK(docLength(&d) == strlen("alpha\nbeta\n\ngamma"));
+
+    CHECK(docRowInsert(&d, 1, 4, "s", 1) == 0);
+    CHECK(!docRow(&d, 1)->mapped && row_is(&d, 1, "betas"));
+    CHECK(docJoinRow(&d, 2) == 0);
+    CHECK(row_is(&d, 2, "gamma") && docNumRows(&d) == 3);
+    CHECK(docRowDelete(&d, 0, 0, 2) == 0 && row_is(&d, 0, "pha"));
+    CHECK(memcmp(map, text, tlen) == 0);
+    CHECK(docLoadMapped(&d, map, tlen) == -1);
+    docFree(&d);
+    CHECK(d.map == NULL);
+
+    // chunks built in a separate document are spliced onto the end
+    map = mmap(NULL, tlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(map != MAP_FAILED);
+    memcpy(map, text, tlen);
+    CHECK(docSetBacking(&d, map, tlen, false) == 0);
+    CHECK(docAppendBorrowed(&d, map, 7) == 0);
+    CHECK(docNumRows(&d) == 1 && row_is(&d, 0, "alpha"));
+
+    Document chunk;
+    docInit(&chunk);
+    CHECK(docAppendBorrowed(&chunk, map + 7, tlen - 7) == 0);
+    char *before_append = flatten(&d);
+    edits_seen = 0;
+    docAppendDocument(&d, &chunk);
+    CHECK(docNumRows(&chunk) == 0);
+    CHECK(docNumRows(&d) == 4 && row_is(&d, 1, "beta") && row_is(&d, 3, "gamma"));
+    char *after_append = flatten(&d);
+    CHECK(edits_seen == 1 && edit_matches(before_append, after_append));
+    free(before_append);
+    free(after_append);
+    CHECK(docInsertRow(&d, 4, "delta", 5) == 0 && row_is(&d, 4, "delta"));
+    docFree(&d);
+
+    // a heap buffer works the same way and is freed with the document
+    char *buf = malloc(tlen);
+    CHECK(buf != NULL);
+    memcpy(buf, text, tlen);
+    CHECK(docLoadBuffer(&d, buf, tlen) == 0);
+    CHECK(docNumRows(&d) == 4 && row_is(&d, 3, "gamma"));
+
+    // a snapshot keeps the rows it saw while the document is edited
+    CHECK(docRowInsert(&d, 3, 0, "G", 1) == 0);
+    DocSnapshot snap;
+    CHECK(docSnapshot(&d, &snap) == 0 && snap.count == 4);
+    CHECK(docRowInsert(&d, 3, 1, "amma g", 6) == 0);
+    CHECK(docRowDelete(&d, 0, 0, 2) == 0);
+    CHECK(docDeleteRow(&d, 1) == 0);
+    CHECK(docInsertRow(&d, 0, "zeta", 4) == 0);
+    CHECK(row_is(&d, 0, "zeta") && row_is(&d, 1, "pha") && row_is(&d, 3, "Gamma ggamma"));
+    const char *want[] = { "alpha", "beta", "", "Ggamma" };
+    for (int i = 0; i < 4; i++) {
+        CHECK(snap.rows[i].size == (int)strlen(want[i]));
+        CHECK(memcmp(snap.rows[i].chars, want[i], strlen(want[i])) == 0);
+    }
+    docReleaseSnapshot(&d, &snap);
+    CHECK(d.snapshots == 0 && d.nretired == 0);
+    CHECK(docRowInsert(&d, 3, 0, "!", 1) == 0 && row_is(&d, 3, "!Gamma ggamma"));
+    docFree(&d);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "common.h"
+#include "editlog.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+
+// entry i of the sequences appended below
+static EditOperation make_op(int i, char *text) {
+    int len = i % 7 == 0 ? 40 : i % 5;
+    for (int k = 0; k < len; k++) text[k] = i % 7 == 0 ? ' ' : (char)('a' + (i + k) % 26);
+    int row = (i * 37) % 1000;
+    return (EditOperation){
+        .kind = i % 3 ? OP_INSERT_TEXT : OP_DELETE_TEXT,
+        .row = row,
+        .col = i % 80,
+        .text = len ? text : NULL,
+        .len = len,
+        .end_row = row + (i % 4 == 0),
+        .end_col = i % 4 == 0 ? 3 : i % 80 + len,
+        .chained = i % 10 != 0
+    };
+}
+
+static int same(const EditOperation *a, const EditOperation *b) {
+    return a->kind == b->kind && a->row == b->row && a->col == b->col &&
+           a->len == b->len && a->end_row == b->end_row && a->end_col == b->end_col &&
+           a->chained == b->chained && a->ch == b->ch &&
+           (a->len == 0 || memcmp(a->text, b->text, (size_t)a->len) == 0);
+}
+
+int main(void) {
+    EditLog log;
+    editLogInit(&log);
+    EditGroup g;
+    char text[64];
+
+    // groups come back exactly as appended, found by their offsets
+    size_t offs[100];
+    for (int i = 0; i < 100; i++) {
+        EditOperation ops[3];
+        char texts[3][64];
+        for (int k = 0; k < 3; k++) ops[k] = make_op(i * 3 + k, texts[k]);
+        CHECK(editLogAppend(&log, ops, 1 + i % 3, &offs[i]) == 0);
+    }
+    EditLogStats st;
+    editLogStats(&log, &st);
+    CHECK(st.records == 100 && st.spilled_bytes == 0);
+    // far below an EditOperation per entry, runs of spaces included
+    CHECK(st.mem_bytes < 200 * 16);
+
+    for (int i = 99; i >= 0; i--) {
+        CHECK(editLogRead(&log, offs[i], &g) == 0);
+        CHECK(g.count == 1 + i % 3);
+        for (int k = 0; k < g.count; k++) {
+            EditOperation want = make_op(i * 3 + k, text);
+            CHECK(same(&g.ops[k], &want));
+        }
+        editGroupFree(&g);
+    }
+
+    // a keystroke entry keeps its character
+    EditOperation key = { .kind = OP_INSERT_CHAR, .row = 5, .col = 2, .ch = 'x', .end_row = 5, .end_col = 3 };
+    size_t off;
+    CHECK(editLogAppend(&log, &key, 1, &off) == 0 && editLogRead(&log, off, &g) == 0);
+    CHECK(g.count == 1 && same(&g.ops[0], &key) && g.ops[0].text == NULL);
+    editGroupFree(&g);
+
+    // a record is only read from its start
+    CHECK(editLogRead(&log, off + 1, &g) == -1);
+
+    // attached records cut short are not read past their end, nor is
+    // anything past the end of the log
+    EditLog cut;
+    editLogInit(&cut);
+    editLogAttach(&cut, log.b, off + 3);
+    CHECK(editLogRead(&cut, offs[99], &g) == 0);
+    editGroupFree(&g);
+    CHECK(editLogRead(&cut, off, &g) == -1);
+    CHECK(editLogRead(&cut, off + 100, &g) == -1);
+    editLogFree(&cut);
+    editLogAttach(&cut, log.b, offs[99] + 4);
+    CHECK(editLogRead(&cut, offs[99], &g) == -1);
+    editLogFree(&cut);
+    editLogFree(&log);
+
+    // past the cap the oldest records go to the spill file and are read
+    // back from there at the same offsets
+    editLogInit(&log);
+    editLogSetMemoryCap(512);
+    static size_t many[2000];
+    for (int i = 0; i < 2000; i++) {
+        EditOperation in = make_op(i, text);
+        CHECK(editLogAppend(&log, &in, 1, &many[i]) == 0);
+    }
+    for (int i = 0; i < 2000; i++) {
+        EditOperation in = make_op(i, text);
+        CHECK(editLogAppend(&log, &in, 1, &off) == 0);
+    }
+    editLogStats(&log, &st);
+    CHECK(st.records == 4000 && st.mem_bytes <= 1024 && st.spilled_bytes > 0);
+    for (int i = 0; i < 2000; i++) {
+        EditOperation want = make_op(i, text);
+        CHECK(editLogRead(&log, many[i], &g) == 0);
+        CHECK(g.count == 1 && same(&g.ops[0], &want));
+        editGroupFree(&g);
+    }
+
+    editLogFree(&log);
+    editLogStats(&log, &st);
+    CHECK(st.records == 0 && st.mem_bytes == 0 && st.spilled_bytes == 0);
+    return 0;
+}
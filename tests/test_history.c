@@ -0,0 +1,215 @@
+#include "common.h"
+#include "document.h"
+#include "history.h"
+#include "editlog.h"
+#include "undofile.h"
+#include "check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STATES 3000
+
+static size_t steps(void) {
+    HistoryStats st;
+    historyStats(&st);
+    return st.steps;
+}
+
+// state k of the typing below is k x's on the first line
+static int at_state(int k) {
+    erow *row = docRow(&E.doc, 0);
+    if (docNumRows(&E.doc) != 1 || row->size != k) return 0;
+    for (int i = 0; i < k; i++) {
+        if (row->chars[i] != 'x') return 0;
+    }
+    return 1;
+}
+
+// save history for path, whose text is x and y typed in front of abc:
+// the root, then node 1 and node 2 a step each
+static int save_typed(const char *path, const HistoryNode nodes[3]) {
+    const char *text = "yxabc";
+    FILE *fp = fopen(path, "w");
+    CHECK(fp && fputs(text, fp) >= 0 && fclose(fp) == 0);
+    struct stat st;
+    CHECK(stat(path, &st) == 0);
+    UndoHash hash;
+    undoHashInit(&hash);
+    undoHashUpdate(&hash, text, strlen(text));
+
+    EditLog log;
+    editLogInit(&log);
+    HistoryNode saved[3];
+    memcpy(saved, nodes, sizeof(saved));
+    for (int i = 1; i <= 2; i++) {
+        EditOperation op = { .kind = OP_INSERT_TEXT, .text = i == 1 ? "x" : "y", .len = 1, .end_col = 1 };
+        CHECK(editLogAppend(&log, &op, 1, &saved[i].group) == 0);
+    }
+    HistorySnapshot snap = { .nodes = saved, .count = 3, .current = 2 };
+    CHECK(editLogSnapshot(&log, &snap.log) == 0);
+    char *undo = sidecarPath(path, "undo");
+    CHECK(undo && undoFileWrite(undo, &st, undoHashFinal(&hash), &snap) == 0);
+    free(undo);
+    editLogReleaseSnapshot(&snap.log);
+    editLogFree(&log);
+    return 0;
+}
+
+// open path as the editor does, continuing its saved history
+static int open_typed(const char *path) {
+    struct stat st;
+    CHECK(stat(path, &st) == 0);
+    char *text = strdup("yxabc");
+    CHECK(text && docLoadBuffer(&E.doc, text, strlen(text)) == 0);
+    historyInit(path, &st);
+    return 0;
+}
+
+static int line_is(const char *text) {
+    erow *row = docRow(&E.doc, 0);
+    return docNumRows(&E.doc) == 1 && row->size == (int)strlen(text) && memcmp(row->chars, text, row->size) == 0;
+}
+
+int main(void) {
+    docInit(&E.doc);
+    CHECK(docInsertRow(&E.doc, 0, "", 0) == 0);
+    historyInit(NULL, NULL);
+
+    // one step per x, typed at the start of the line so no run forms; every
+    // other one is recorded after it is made, as pastes are
+    for (int i = 0; i < STATES; i++) {
+        if (i % 2) {
+            char x = 'x';
+            CHECK(docInsertText(&E.doc, 0, 0, &x, 1, NULL, NULL) == 0);
+            historyRecord((EditOperation){
+                .kind = OP_INSERT_TEXT, .row = 0, .col = 0, .text = &x, .len = 1, .end_row = 0, .end_col = 1
+            });
+        } else {
+            historyRecord((EditOperation){ .kind = OP_INSERT_CHAR, .row = 0, .col = 0, .ch = 'x' });
+            CHECK(docRowInsert(&E.doc, 0, 0, "x", 1) == 0);
+        }
+    }
+    historyJump(STATES); // only closes the last step
+    HistoryStats st;
+    historyStats(&st);
+    CHECK(st.current == STATES && st.checkpoints == STATES / 1024);
+
+    // back near the start from the opened text, not three thousand undos
+    size_t before = steps();
+    historyJump(5);
+    CHECK(at_state(5));
+    CHECK(steps() - before == 5);
+
+    // deep down from the nearest checkpoint on the way
+    before = steps();
+    historyJump(2500);
+    CHECK(at_state(2500));
+    CHECK(steps() - before <= 1024);
+    before = steps();
+    historyJump(1100);
+    CHECK(at_state(1100));
+    CHECK(steps() - before <= 1024);
+    historyFree();
+    docFree(&E.doc);
+
+    // the opened state comes back from the text the file was read from,
+    // carriage returns dropped as when it was opened
+    char *text = strdup("one\r\ntwo\n");
+    CHECK(text && docLoadBuffer(&E.doc, text, strlen(text)) == 0);
+    historyInit(NULL, NULL);
+    for (int i = 0; i < 200; i++) {
+        historyRecord((EditOperation){ .kind = OP_INSERT_CHAR, .row = 1, .col = 0, .ch = 'x' });
+        CHECK(docRowInsert(&E.doc, 1, 0, "x", 1) == 0);
+    }
+    before = steps();
+    historyJump(0);
+    CHECK(steps() == before);
+    CHECK(docNumRows(&E.doc) == 2);
+    CHECK(docRow(&E.doc, 0)->size == 3 && memcmp(docRow(&E.doc, 0)->chars, "one", 3) == 0);
+    CHECK(docRow(&E.doc, 1)->size == 3 && memcmp(docRow(&E.doc, 1)->chars, "two", 3) == 0);
+    historyJump(200);
+    CHECK(docRow(&E.doc, 1)->size == 203);
+    historyFree();
+    docFree(&E.doc);
+
+    // checkpoints of a big file stay within the budget, the oldest going
+    // first, and jumps past a dropped one still land right
+    size_t big_len = 40000 * 101;
+    char *big = malloc(big_len);
+    CHECK(big != NULL);
+    memset(big, 'y', big_len);
+    for (size_t i = 0; i < big_len; i += 101) big[i] = '\n';
+    CHECK(docLoadBuffer(&E.doc, big, big_len) == 0);
+    historyInit(NULL, NULL);
+    int deep = 12 * 1024;
+    for (int i = 0; i < deep; i++) {
+        historyRecord((EditOperation){ .kind = OP_INSERT_CHAR, .row = 0, .col = 0, .ch = 'x' });
+        CHECK(docRowInsert(&E.doc, 0, 0, "x", 1) == 0);
+    }
+    historyJump(deep);
+    historyStats(&st);
+    CHECK(st.checkpoint_bytes <= HISTORY_CHECKPOINT_BUDGET);
+    CHECK(st.checkpoints > 0 && st.checkpoints < deep / 1024);
+    before = steps();
+    historyJump(deep - 1100);
+    CHECK(docRow(&E.doc, 0)->size == deep - 1100 && docNumRows(&E.doc) == 40001);
+    CHECK(steps() - before <= 1024);
+    historyJump(1100);
+    CHECK(docRow(&E.doc, 0)->size == 1100 && docRow(&E.doc, 40000)->size == 100);
+    // and the dropped checkpoint the way there passed is taken again
+    historyJump(deep);
+    before = steps();
+    historyJump(1030);
+    CHECK(docRow(&E.doc, 0)->size == 1030 && steps() - before == 6);
+    historyFree();
+    docFree(&E.doc);
+
+    // a saved history is walked as it was saved
+    const char *path = "/tmp/test_history.txt";
+    const HistoryNode typed[3] = {
+        { .parent = -1, .first_child = 1, .next_sibling = -1, .redo_child = 1, .checkpoint = -1 },
+        { .parent = 0, .first_child = 2, .next_sibling = -1, .redo_child = 2, .depth = 1, .checkpoint = -1 },
+        { .parent = 1, .first_child = -1, .next_sibling = -1, .redo_child = -1, .depth = 2, .checkpoint = -1 }
+    };
+    CHECK(save_typed(path, typed) == 0 && open_typed(path) == 0);
+    historyStats(&st);
+    CHECK(st.states == 3 && st.current == 2);
+    historyUndo();
+    CHECK(line_is("xabc"));
+    historyJump(0);
+    CHECK(line_is("abc"));
+    historyRedo();
+    historyRedo();
+    CHECK(line_is("yxabc"));
+    historyFree();
+    docFree(&E.doc);
+
+    // one whose nodes lead out of the tree or round in a circle is not,
+    // when a walk gets to them: the document stays where it is
+    for (int damage = 0; damage < 5; damage++) {
+        HistoryNode bad[3];
+        memcpy(bad, typed, sizeof(bad));
+        if (damage == 0) bad[1].parent = 1;
+        if (damage == 1) bad[1].next_sibling = 2;
+        if (damage == 2) bad[1].first_child = 3;
+        if (damage == 3) bad[0].redo_child = 3;
+        if (damage == 4) bad[2].depth = 5; // the saved state, so none of it is used
+        CHECK(save_typed(path, bad) == 0 && open_typed(path) == 0);
+        historyStats(&st);
+        CHECK(st.states == (damage == 4 ? 1 : 3));
+        historyUndo();
+        historyJump(0);
+        historyUndo();
+        CHECK(line_is(damage == 3 ? "xabc" : "yxabc"));
+        historyFree();
+        docFree(&E.doc);
+    }
+    unlink(path);
+    char *undo = sidecarPath(path, "undo");
+    CHECK(undo != NULL);
+    unlink(undo);
+    free(undo);
+    return 0;
+}
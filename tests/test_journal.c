@@ -0,0 +1,89 @@
+#include "common.h"
+#include "journal.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+
+static JournalEntryType seen_types[16];
+static EditOperation seen_ops[16];
+static char seen_text[16][16];
+static int seen;
+
+static void record_replay(JournalEntryType type, const EditOperation *op) {
+    if (seen == 16) return;
+    seen_types[seen] = type;
+    if (op) {
+        seen_ops[seen] = *op;
+        if (op->text) memcpy(seen_text[seen], op->text, (size_t)op->len);
+    }
+    seen++;
+}
+
+static int journal_exists(void) {
+    return access("/tmp/.test_journal.txt.journal", F_OK) == 0;
+}
+
+int main(void) {
+    const char *file = "/tmp/test_journal.txt";
+    FILE *fp = fopen(file, "w");
+    CHECK(fp != NULL);
+    fputs("hello\n", fp);
+    fclose(fp);
+    struct stat st;
+    CHECK(stat(file, &st) == 0);
+    unlink("/tmp/.test_journal.txt.journal");
+
+    // a fresh journal has nothing to replay
+    seen = 0;
+    CHECK(journalStart(file, &st, record_replay) == 0 && seen == 0);
+    journalRecord(JOURNAL_EDIT, &(EditOperation){ .kind = OP_INSERT_CHAR, .row = 0, .col = 5, .ch = '!' });
+    char text[] = "a\nb";
+    journalRecord(JOURNAL_EDIT, &(EditOperation){
+        .kind = OP_INSERT_TEXT, .row = 0, .col = 0, .text = text, .len = 3, .end_row = 1, .end_col = 1
+    });
+    journalRecord(JOURNAL_UNDO, NULL);
+    // stopping with unsaved edits keeps the journal, like a crash would
+    journalStop(false);
+    CHECK(journal_exists());
+
+    // the next session for the same file gets every entry back in order
+    seen = 0;
+    CHECK(journalStart(file, &st, record_replay) == 3 && seen == 3);
+    CHECK(seen_types[0] == JOURNAL_EDIT && seen_ops[0].kind == OP_INSERT_CHAR);
+    CHECK(seen_ops[0].col == 5 && seen_ops[0].ch == '!');
+    CHECK(seen_types[1] == JOURNAL_EDIT && seen_ops[1].kind == OP_INSERT_TEXT);
+    CHECK(seen_ops[1].len == 3 && memcmp(seen_text[1], "a\nb", 3) == 0 && seen_ops[1].end_row == 1);
+    CHECK(seen_types[2] == JOURNAL_UNDO);
+
+    // entries up to a checkpoint are in the file and aren't replayed
+    journalRecord(JOURNAL_REDO, NULL);
+    unsigned long seq = journalSeq();
+    journalRecord(JOURNAL_EDIT, &(EditOperation){ .kind = OP_SPLIT_LINE, .row = 0, .col = 2 });
+    fp = fopen(file, "w");
+    CHECK(fp != NULL);
+    fputs("saved\n", fp);
+    fclose(fp);
+    CHECK(stat(file, &st) == 0);
+    journalCheckpoint(file, &st, seq);
+    journalStop(false);
+
+    seen = 0;
+    CHECK(journalStart(file, &st, record_replay) == 1 && seen == 1);
+    CHECK(seen_types[0] == JOURNAL_EDIT && seen_ops[0].kind == OP_SPLIT_LINE);
+    journalStop(false);
+
+    // a journal for another version of the file is ignored
+    fp = fopen(file, "a");
+    CHECK(fp != NULL);
+    fputs("changed elsewhere\n", fp);
+    fclose(fp);
+    CHECK(stat(file, &st) == 0);
+    seen = 0;
+    CHECK(journalStart(file, &st, record_replay) == 0 && seen == 0);
+
+    // and a clean exit removes it
+    journalStop(true);
+    CHECK(!journal_exists());
+    unlink(file);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "common.h"
+#include "lineindex.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(void) {
+    size_t ends[1024], want[1024];
+
+    CHECK(lineScan("", 0, ends, 16) == 0);
+    CHECK(lineScan("abc", 3, ends, 16) == 0);
+    CHECK(lineScan("a\nb\r\n\n", 6, ends, 16) == 3);
+    CHECK(ends[0] == 1 && ends[1] == 4 && ends[2] == 5);
+
+    // every variant agrees with a plain loop, across vector boundaries and
+    // when the table fills up part way through a vector
+    static char buf[3000];
+    unsigned int seed = 1;
+    for (int round = 0; round < 500; round++) {
+        size_t len = (size_t)(seed % sizeof(buf));
+        for (size_t i = 0; i < len; i++) {
+            seed = seed * 1103515245u + 12345u;
+            buf[i] = (seed >> 16) % 6 == 0 ? '\n' : 'x';
+        }
+        size_t max = 1 + seed % 300;
+
+        size_t n = 0;
+        for (size_t i = 0; i < len && n < max; i++) {
+            if (buf[i] == '\n') want[n++] = i;
+        }
+
+        CHECK(lineScanScalar(buf, len, ends, max) == n);
+        CHECK(memcmp(ends, want, n * sizeof(size_t)) == 0);
+        CHECK(lineScanSSE2(buf, len, ends, max) == n);
+        CHECK(memcmp(ends, want, n * sizeof(size_t)) == 0);
+        CHECK(lineScanAVX2(buf, len, ends, max) == n);
+        CHECK(memcmp(ends, want, n * sizeof(size_t)) == 0);
+        CHECK(lineScan(buf, len, ends, max) == n);
+        CHECK(memcmp(ends, want, n * sizeof(size_t)) == 0);
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include "common.h"
+#include "project.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static char g_dir[] = "/tmp/test_projectXXXXXX";
+
+static void write_file(const char *name, const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", g_dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fputs(text, f);
+    fclose(f);
+}
+
+static void remove_file(const char *name) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", g_dir, name);
+    remove(path);
+}
+
+// wait until the files as they are now are in the index; 0 on success
+static int wait_pass(void) {
+    unsigned target = projectRescan();
+    for (int i = 0; i < 1000; i++) {
+        if (projectPasses() >= target) return 0;
+        usleep(10000);
+    }
+    return -1;
+}
+
+int main(void) {
+    CHECK(mkdtemp(g_dir) != NULL);
+    char sub[256], hidden[256];
+    snprintf(sub, sizeof(sub), "%s/src", g_dir);
+    snprintf(hidden, sizeof(hidden), "%s/.git", g_dir);
+    CHECK(mkdir(sub, 0700) == 0 && mkdir(hidden, 0700) == 0);
+
+    write_file("src/shape.h",
+               "typedef struct shape { int shape_sides; } shape_t;\n"
+               "int shape_area(shape_t *s);\n");
+    write_file("src/shape.c",
+               "#include \"shape.h\"\n"
+               "static int shape_count;\n"
+               "int shape_area(shape_t *s) {\n"
+               "    int shape_local = s->shape_sides;\n"
+               "    return shape_local;\n"
+               "}\n");
+    write_file("notes.txt", "int shape_notes;\n");
+    write_file(".git/shape_hidden.c", "int shape_hidden;\n");
+
+    // started for a file in a subdirectory, the index covers the whole
+    // project, from the directory holding .git down
+    char start[256];
+    snprintf(start, sizeof(start), "%s/src/shape.h", g_dir);
+    CHECK(projectStart(start) == 0);
+    CHECK(projectStart(start) == -1);
+    CHECK(wait_pass() == 0);
+
+    // file-scope names from both files, once each, fields and locals left out
+    char out[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+    int n = projectComplete("shape", out, MAX_SUGGESTIONS);
+    CHECK(n == 4);
+    CHECK(strcmp(out[0], "shape") == 0 && strcmp(out[1], "shape_area") == 0);
+    CHECK(strcmp(out[2], "shape_count") == 0 && strcmp(out[3], "shape_t") == 0);
+    CHECK(projectComplete("shape", out, 2) == 2);
+    CHECK(projectComplete("zz", out, MAX_SUGGESTIONS) == 0);
+
+    // the definition, not the prototype in the header
+    char path[256], want[256];
+    int row = -1, col = -1;
+    CHECK(projectFind("shape_area", path, sizeof(path), &row, &col) == 0);
+    snprintf(want, sizeof(want), "%s/src/shape.c", g_dir);
+    CHECK(strcmp(path, want) == 0 && row == 2 && col == 4);
+    CHECK(projectFind("shape_sides", path, sizeof(path), &row, &col) == 0);
+    CHECK(projectFind("shape_local", path, sizeof(path), &row, &col) == -1);
+
+    // a changed file is read again, a new one picked up, a removed one dropped
+    write_file("src/shape.h", "int shape_perimeter(void);\n");
+    write_file("src/extra.c", "int shape_extra;\n");
+    remove_file("src/shape.c");
+    CHECK(wait_pass() == 0);
+    n = projectComplete("shape", out, MAX_SUGGESTIONS);
+    CHECK(n == 2);
+    CHECK(strcmp(out[0], "shape_extra") == 0 && strcmp(out[1], "shape_perimeter") == 0);
+    CHECK(projectFind("shape_area", path, sizeof(path), &row, &col) == -1);
+
+    // nothing changed, nothing moves
+    CHECK(wait_pass() == 0);
+    CHECK(projectComplete("shape", out, MAX_SUGGESTIONS) == 2);
+
+    projectStop();
+    CHECK(projectComplete("shape", out, MAX_SUGGESTIONS) == 0);
+
+    // a file that looks the same as when the cache was written is taken
+    // from the cache, even though its contents changed
+    char extra[256];
+    struct stat st;
+    snprintf(extra, sizeof(extra), "%s/src/extra.c", g_dir);
+    CHECK(stat(extra, &st) == 0);
+    write_file("src/extra.c", "int shape_extrb;\n");
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    CHECK(utimensat(AT_FDCWD, extra, times, 0) == 0);
+    CHECK(projectStart(start) == 0);
+    CHECK(wait_pass() == 0);
+    CHECK(projectComplete("shape", out, MAX_SUGGESTIONS) == 2);
+    CHECK(strcmp(out[0], "shape_extra") == 0 && strcmp(out[1], "shape_perimeter") == 0);
+
+    // touched, it is parsed again
+    times[1].tv_sec -= 10;
+    CHECK(utimensat(AT_FDCWD, extra, times, 0) == 0);
+    CHECK(wait_pass() == 0);
+    CHECK(projectComplete("shape_extr", out, MAX_SUGGESTIONS) == 1);
+    CHECK(strcmp(out[0], "shape_extrb") == 0);
+    projectStop();
+
+    // a damaged cache is ignored
+    char cache[256];
+    snprintf(cache, sizeof(cache), "%s/.textedit.index", g_dir);
+    CHECK(truncate(cache, 20) == 0);
+    CHECK(projectStart(start) == 0);
+    CHECK(wait_pass() == 0);
+    n = projectComplete("shape", out, MAX_SUGGESTIONS);
+    CHECK(n == 2 && strcmp(out[0], "shape_extrb") == 0);
+    projectStop();
+
+    // outside a project only the file's own directory is read, and no
+    // cache is left in it
+    char plain[] = "/tmp/test_project_plainXXXXXX";
+    char file[256], nested[256];
+    CHECK(mkdtemp(plain) != NULL);
+    snprintf(file, sizeof(file), "%s/alone.c", plain);
+    snprintf(nested, sizeof(nested), "%s/deeper", plain);
+    CHECK(mkdir(nested, 0700) == 0);
+    FILE *f = fopen(file, "w");
+    CHECK(f != NULL);
+    fputs("int alone_here;\n", f);
+    fclose(f);
+    snprintf(nested, sizeof(nested), "%s/deeper/below.c", plain);
+    CHECK((f = fopen(nested, "w")) != NULL);
+    fputs("int alone_below;\n", f);
+    fclose(f);
+    CHECK(projectStart(file) == 0);
+    CHECK(wait_pass() == 0);
+    CHECK(projectComplete("alone", out, MAX_SUGGESTIONS) == 1 && strcmp(out[0], "alone_here") == 0);
+    projectStop();
+    snprintf(cache, sizeof(cache), "%s/.textedit.index", plain);
+    CHECK(access(cache, F_OK) == -1);
+    remove(nested);
+    remove(file);
+    snprintf(nested, sizeof(nested), "%s/deeper", plain);
+    rmdir(nested);
+    rmdir(plain);
+
+    snprintf(cache, sizeof(cache), "%s/.textedit.index", g_dir);
+    remove(cache);
+    remove_file("src/shape.h");
+    remove_file("src/extra.c");
+    remove_file("notes.txt");
+    remove_file(".git/shape_hidden.c");
+    rmdir(sub);
+    rmdir(hidden);
+    rmdir(g_dir);
+    return 0;
+}
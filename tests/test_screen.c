@@ -0,0 +1,157 @@
+#include "common.h"
+#include "buffer.h"
+#include "screen.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+
+#define ROWS 4
+#define COLS 20
+
+// just enough of a terminal to replay what screenFlush writes: a tab moves
+// the cursor to the next tab stop without drawing, as a real one does, and
+// a UTF-8 continuation byte goes into the cell before the cursor
+static char g_term[ROWS][COLS][5];
+static int g_row, g_col;
+
+static void term_clear(int r, int from) {
+    for (int c = from; c < COLS; c++) strcpy(g_term[r][c], " ");
+}
+
+static void term_reset(void) {
+    for (int r = 0; r < ROWS; r++) term_clear(r, 0);
+    g_row = g_col = 0;
+}
+
+// the cells of row r one after the other
+static const char *term_row(int r) {
+    static char text[COLS * 4 + 1];
+    text[0] = '\0';
+    for (int c = 0; c < COLS; c++) strcat(text, g_term[r][c]);
+    return text;
+}
+
+static void term_feed(const char *s, int len) {
+    for (int i = 0; i < len; i++) {
+        char ch = s[i];
+        if (ch == '\x1b' && i + 1 < len && s[i + 1] == '[') {
+            int args[2] = { 0, 0 }, nargs = 0;
+            i += 2;
+            if (i < len && s[i] == '?') i++;
+            for (; i < len; i++) {
+                if (s[i] >= '0' && s[i] <= '9') args[nargs] = args[nargs] * 10 + (s[i] - '0');
+                else if (s[i] == ';') nargs = 1;
+                else break;
+            }
+            if (i == len) return;
+            switch (s[i]) {
+            case 'C': g_col += args[0] ? args[0] : 1; break;
+            case 'H': g_row = args[0] - 1; g_col = args[1] - 1; break;
+            case 'K': term_clear(g_row, g_col); break;
+            case 'J': term_reset(); break;
+            default: break; // colors, cursor visibility
+            }
+        } else if (ch == '\r') {
+            g_col = 0;
+        } else if (ch == '\n') {
+            g_row++;
+        } else if (ch == '\t') {
+            g_col = (g_col / 8 + 1) * 8;
+        } else if ((ch & 0xc0) == 0x80) {
+            if (g_row < ROWS && g_col > 0) {
+                char *cell = g_term[g_row][g_col - 1];
+                size_t n = strlen(cell);
+                if (n < 4) cell[n] = ch, cell[n + 1] = '\0';
+            }
+            continue;
+        } else {
+            if (g_row < ROWS && g_col < COLS) g_term[g_row][g_col][0] = ch, g_term[g_row][g_col][1] = '\0';
+            g_col++;
+        }
+        if (g_col > COLS - 1) g_col = COLS - 1;
+    }
+}
+
+static void frame(int cursor_row, int cursor_col) {
+    struct abuf ab = ABUF_INIT;
+    screenFlush(&ab, cursor_row, cursor_col);
+    term_feed(ab.b, ab.len);
+    abFree(&ab);
+}
+
+static int contains(const struct abuf *ab, const char *s, int len) {
+    for (int i = 0; i + len <= ab->len; i++) {
+        if (memcmp(ab->b + i, s, (size_t)len) == 0) return 1;
+    }
+    return 0;
+}
+
+static void put_row(int row, int xoff, const char *text) {
+    screenPutText(row, 0, xoff, text, (int)strlen(text), SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, 0);
+}
+
+int main(void) {
+    screenResize(ROWS, COLS);
+    term_reset();
+
+    // tabs are spaces up to the next stop, control bytes one '?' each
+    screenClear();
+    put_row(0, 0, "ab\tcd");
+    put_row(1, 0, "x\x01y\x7f");
+    frame(0, 0);
+    CHECK(strcmp(term_row(0), "ab      cd          ") == 0);
+    CHECK(strcmp(term_row(1), "x?y?                ") == 0);
+
+    // typing before the tab only changes the cells that moved; the
+    // terminal has to end up with the same row as a full repaint
+    screenClear();
+    put_row(0, 0, "abQ\tcd");
+    put_row(1, 0, "x\x01y\x7f");
+    frame(0, 3);
+    CHECK(strcmp(term_row(0), "abQ     cd          ") == 0);
+    CHECK(g_row == 0 && g_col == 3);
+
+    // and past the tab stop the rest of the row moves
+    screenClear();
+    put_row(0, 0, "abQRSTUV\tcd");
+    frame(0, 8);
+    CHECK(strcmp(term_row(0), "abQRSTUV        cd  ") == 0);
+
+    // scrolled sideways, a tab that starts off screen still ends in place
+    screenClear();
+    put_row(0, 4, "ab\tcd");
+    frame(0, 0);
+    CHECK(strcmp(term_row(0), "    cd              ") == 0);
+
+    // UTF-8 text reaches the terminal as it is, a character per cell, and
+    // stays whole when only the cells after it change
+    screenClear();
+    put_row(0, 0, "h\xc3\xa9 \xe2\x94\x80\xf0\x9f\x98\x80!");
+    struct abuf ab = ABUF_INIT;
+    screenFlush(&ab, 0, 0);
+    CHECK(contains(&ab, "h\xc3\xa9 \xe2\x94\x80\xf0\x9f\x98\x80!", 12));
+    term_feed(ab.b, ab.len);
+    abFree(&ab);
+    CHECK(strcmp(term_row(0), "h\xc3\xa9 \xe2\x94\x80\xf0\x9f\x98\x80!              ") == 0);
+    screenClear();
+    put_row(0, 0, "h\xc3\xa9 \xe2\x94\x80\xf0\x9f\x98\x80?");
+    frame(0, 0);
+    CHECK(strcmp(term_row(0), "h\xc3\xa9 \xe2\x94\x80\xf0\x9f\x98\x80?              ") == 0);
+    screenClear();
+    put_row(0, 0, "H\xc3\xa9 \xe2\x94\x80\xf0\x9f\x98\x80?");
+    frame(0, 0);
+    CHECK(strcmp(term_row(0), "H\xc3\xa9 \xe2\x94\x80\xf0\x9f\x98\x80?              ") == 0);
+
+    // a sequence split between two runs, as a colored span may split it
+    screenClear();
+    CHECK(screenPutText(1, 0, 0, "a\xc3", 2, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, 0) == 2);
+    CHECK(screenPutText(1, 2, 0, "\xa9" "b", 2, 31, SCREEN_BG_DEFAULT, 0) == 3);
+    frame(0, 0);
+    CHECK(strcmp(term_row(1), "a\xc3\xa9" "b                 ") == 0);
+
+    // the text column after a run, for the next one to start from
+    CHECK(screenPutText(2, 3, 0, "\t", 1, SCREEN_FG_DEFAULT, SCREEN_BG_DEFAULT, 0) == 8);
+
+    screenFree();
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include "common.h"
+#include "document.h"
+#include "symbols.h"
+#include "check.h"
+#include <tree_sitter/api.h>
+#include <stdio.h>
+#include <string.h>
+
+extern const TSLanguage *tree_sitter_c(void);
+
+static const char *k_source =
+    "#ifndef POINT_H\n"
+    "#define POINT_H\n"
+    "#define MAX_POINTS 64\n"
+    "typedef struct point { int px; int py; } point_t;\n"
+    "enum color { RED, GREEN };\n"
+    "static int point_count = 0;\n"
+    "int point_add(point_t *p);\n"
+    "int point_add(point_t *p) {\n"
+    "    int local = p->px;\n"
+    "    return local + point_count;\n"
+    "}\n"
+    "#endif\n";
+
+static TSParser *g_parser;
+static TSTree *g_tree;
+
+static int kind_of(const char *name) {
+    const Symbol *s = symbolsFind(name);
+    return s ? (int)s->kind : -1;
+}
+
+static void on_edit(const DocEdit *e, void *ctx) {
+    (void)ctx;
+    symbolsNoteEdit((uint32_t)e->start_byte, (uint32_t)e->old_end_byte, (uint32_t)e->new_end_byte);
+    TSInputEdit edit = {
+        .start_byte = (uint32_t)e->start_byte,
+        .old_end_byte = (uint32_t)e->old_end_byte,
+        .new_end_byte = (uint32_t)e->new_end_byte,
+        .start_point = { (uint32_t)e->start_row, (uint32_t)e->start_col },
+        .old_end_point = { (uint32_t)e->old_end_row, (uint32_t)e->old_end_col },
+        .new_end_point = { (uint32_t)e->new_end_row, (uint32_t)e->new_end_col },
+    };
+    if (g_tree) ts_tree_edit(g_tree, &edit);
+}
+
+// parse the document again, reusing the edited tree, and update the index
+// the way syntaxReparse does
+static void reparse(void) {
+    size_t len = docLength(&E.doc), at = 0;
+    char *text = malloc(len + 1);
+    for (int i = 0; i < docNumRows(&E.doc); i++) {
+        erow *row = docRow(&E.doc, i);
+        memcpy(text + at, row->chars, (size_t)row->size);
+        at += (size_t)row->size;
+        if (i + 1 < docNumRows(&E.doc)) text[at++] = '\n';
+    }
+    TSTree *tree = ts_parser_parse_string(g_parser, g_tree, text, (uint32_t)len);
+    free(text);
+    if (g_tree) {
+        uint32_t nranges = 0;
+        TSRange *ranges = ts_tree_get_changed_ranges(g_tree, tree, &nranges);
+        symbolsUpdate(ts_tree_root_node(tree), ranges, nranges);
+        free(ranges);
+        ts_tree_delete(g_tree);
+    } else {
+        symbolsClear();
+        symbolsUpdate(ts_tree_root_node(tree), NULL, 0);
+    }
+    g_tree = tree;
+}
+
+static void load(const char *text) {
+    size_t len = strlen(text);
+    char *buf = malloc(len);
+    memcpy(buf, text, len);
+    docFree(&E.doc);
+    docLoadBuffer(&E.doc, buf, len);
+    if (g_tree) ts_tree_delete(g_tree), g_tree = NULL;
+    reparse();
+}
+
+// the index after incremental updates has to match one read from scratch
+static int matches_rebuild(void) {
+    int n = symbolsCount();
+    Symbol *saved = malloc(sizeof(Symbol) * (size_t)(n ? n : 1));
+    for (int i = 0; i < n; i++) {
+        saved[i] = *symbolsAt(i);
+        saved[i].name = strdup(saved[i].name);
+    }
+    symbolsClear();
+    symbolsUpdate(ts_tree_root_node(g_tree), NULL, 0);
+    int ok = symbolsCount() == n;
+    for (int i = 0; i < n; i++) {
+        const Symbol *s = symbolsAt(i);
+        if (ok && (s->byte != saved[i].byte || s->kind != saved[i].kind ||
+                   strcmp(s->name, saved[i].name) != 0)) {
+            fprintf(stderr, "symbol %d: %s at %u, rebuilt %s at %u\n", i,
+                    saved[i].name, saved[i].byte, s->name, s->byte);
+            ok = 0;
+        }
+        free(saved[i].name);
+    }
+    free(saved);
+    return ok;
+}
+
+int main(void) {
+    docInit(&E.doc);
+    docSetEditListener(&E.doc, on_edit, NULL);
+    g_parser = ts_parser_new();
+    CHECK(g_parser && ts_parser_set_language(g_parser, tree_sitter_c()));
+    load(k_source);
+
+    // everything declared at file scope, inside the include guard too
+    CHECK(kind_of("MAX_POINTS") == SYMBOL_MACRO);
+    CHECK(kind_of("point") == SYMBOL_TYPE);
+    CHECK(kind_of("point_t") == SYMBOL_TYPE);
+    CHECK(kind_of("px") == SYMBOL_FIELD);
+    CHECK(kind_of("GREEN") == SYMBOL_ENUMERATOR);
+    CHECK(kind_of("point_count") == SYMBOL_VARIABLE);
+    CHECK(kind_of("local") == -1 && kind_of("p") == -1 && kind_of("POINT_H") == SYMBOL_MACRO);
+
+    // the definition wins over the prototype before it
+    const Symbol *def = symbolsFind("point_add");
+    CHECK(def && def->kind == SYMBOL_FUNCTION);
+    int col = 0;
+    CHECK(docRowAtByte(&E.doc, def->byte, &col) == 7 && col == 4);
+
+    // one entry per name, fields left out
+    const Symbol *found[MAX_SUGGESTIONS];
+    int n = symbolsComplete("point", found, MAX_SUGGESTIONS);
+    CHECK(n == 4);
+    CHECK(strcmp(found[0]->name, "point") == 0 && strcmp(found[1]->name, "point_add") == 0);
+    CHECK(strcmp(found[2]->name, "point_count") == 0 && strcmp(found[3]->name, "point_t") == 0);
+    CHECK(symbolsComplete("p", found, MAX_SUGGESTIONS) == 4);
+    CHECK(symbolsComplete("zz", found, MAX_SUGGESTIONS) == 0);
+
+    // a declaration added in front moves what follows
+    CHECK(docInsertText(&E.doc, 3, 0, "int added;\n", 11, NULL, NULL) == 0);
+    reparse();
+    CHECK(kind_of("added") == SYMBOL_VARIABLE);
+    def = symbolsFind("point_add");
+    CHECK(docRowAtByte(&E.doc, def->byte, &col) == 8 && col == 4);
+    CHECK(matches_rebuild());
+
+    // renaming inside a function body, then the function itself
+    CHECK(docRowInsert(&E.doc, 9, 8, "x", 1) == 0);
+    reparse();
+    CHECK(matches_rebuild());
+    CHECK(docRowInsert(&E.doc, 8, 13, "2", 1) == 0);
+    reparse();
+    CHECK(kind_of("point_add") == SYMBOL_PROTOTYPE && kind_of("point_add2") == SYMBOL_FUNCTION);
+    CHECK(matches_rebuild());
+
+    // edits anywhere, several between parses, checked against a full read
+    const char *snippets[] = { "int g", ";", "}", "{", "\n", "struct s { int f; };\n",
+                               "#define M 1\n", "/*", "*/", "enum { A, B };", "x" };
+    int nsnippets = (int)(sizeof(snippets) / sizeof(snippets[0]));
+    srand(7);
+    for (int round = 0; round < 300; round++) {
+        int edits = 1 + rand() % 3;
+        for (int k = 0; k < edits; k++) {
+            int row = rand() % docNumRows(&E.doc);
+            int size = docRow(&E.doc, row)->size;
+            int at = size ? rand() % (size + 1) : 0;
+            if (rand() % 3 == 0 && size > 0) {
+                at = rand() % size;
+                CHECK(docRowDelete(&E.doc, row, at, 1 + rand() % (size - at)) == 0);
+            } else {
+                const char *s = snippets[rand() % nsnippets];
+                CHECK(docInsertText(&E.doc, row, at, s, (int)strlen(s), NULL, NULL) == 0);
+            }
+        }
+        reparse();
+        CHECK(matches_rebuild());
+        if (docLength(&E.doc) > 4000) load(k_source);
+    }
+
+    symbolsFree();
+    ts_tree_delete(g_tree);
+    ts_parser_delete(g_parser);
+    docFree(&E.doc);
+    return 0;
+}
@@ -1,22 +1,17 @@
 #include "common.h"
 #include "syntax.h"
+#include "document.h"
 #include <stdio.h>
 #include <string.h>
 
 static void load_buffer_from_string(const char *src) {
     // create a single-row buffer (no newlines for this test)
-    E.numrows = 1;
-    E.row = malloc(sizeof(erow));
-    E.row[0].size = (int)strlen(src);
-    E.row[0].chars = malloc(E.row[0].size + 1);
-    memcpy(E.row[0].chars, src, E.row[0].size);
-    E.row[0].chars[E.row[0].size] = '\0';
+    docInsertRow(&E.doc, 0, src, (int)strlen(src));
 }
 
 int main(void) {
     // minimal editor config for syntax
-    E.row = NULL;
-    E.numrows = 0;
+    docInit(&E.doc);
 
     if (syntaxInit("c", "tree-sitter-c/queries/highlights.scm") != 0) {
         fprintf(stderr, "syntaxInit failed\n");
@@ -37,8 +32,21 @@ int main(void) {
         return 1;
     }
 
+    // per-row spans come back sorted and disjoint for the renderer's sweep
+    int nrow = 0;
+    const HighlightSpan *row_spans = syntaxRowSpans(0, &nrow);
+    if (!row_spans || nrow <= 0) {
+        fprintf(stderr, "expected cached spans for row 0\n");
+        return 1;
+    }
+    for (int i = 1; i < nrow; i++) {
+        if (row_spans[i].start_col < row_spans[i - 1].end_col) {
+            fprintf(stderr, "row spans overlap at %d\n", i);
+            return 1;
+        }
+    }
+
     syntaxFree();
-    free(E.row[0].chars);
-    free(E.row);
+    docFree(&E.doc);
     return 0;
 }
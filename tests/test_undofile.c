@@ -0,0 +1,101 @@
+#include "common.h"
+#include "editlog.h"
+#include "undofile.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+
+static int write_file(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    fputs(text, fp);
+    return fclose(fp);
+}
+
+static uint64_t hash_of(const char *text) {
+    UndoHash hash;
+    undoHashInit(&hash);
+    undoHashUpdate(&hash, text, strlen(text));
+    return undoHashFinal(&hash);
+}
+
+int main(void) {
+    const char *file = "/tmp/test_undofile.txt";
+    const char *path = "/tmp/.test_undofile.txt.undo";
+    const char *text = "int main(void) {\n    return 0;\n}";
+    CHECK(write_file(file, text) == 0);
+    struct stat st;
+    CHECK(stat(file, &st) == 0);
+
+    // the hash doesn't depend on how the bytes are split up
+    UndoHash hash;
+    undoHashInit(&hash);
+    for (const char *p = text; *p; p++) undoHashUpdate(&hash, p, 1);
+    CHECK(undoHashFinal(&hash) == hash_of(text));
+    CHECK(hash_of("abc") != hash_of("abd") && hash_of("") != hash_of("a"));
+
+    // a root and two branches from it, one group each
+    EditLog log;
+    editLogInit(&log);
+    EditOperation ops[2] = {
+        { .kind = OP_INSERT_TEXT, .row = 1, .col = 4, .text = "x", .len = 1, .end_row = 1, .end_col = 5 },
+        { .kind = OP_DELETE_TEXT, .row = 0, .col = 0, .text = "int", .len = 3, .end_row = 0, .end_col = 3 }
+    };
+    size_t offs[2];
+    CHECK(editLogAppend(&log, &ops[0], 1, &offs[0]) == 0);
+    CHECK(editLogAppend(&log, &ops[1], 1, &offs[1]) == 0);
+    HistoryNode nodes[3] = {
+        { .parent = -1, .first_child = 2, .next_sibling = -1, .redo_child = 1, .checkpoint = -1 },
+        { .group = offs[0], .parent = 0, .first_child = -1, .next_sibling = -1, .redo_child = -1,
+          .depth = 1, .checkpoint = -1 },
+        { .group = offs[1], .parent = 0, .first_child = -1, .next_sibling = 1, .redo_child = -1,
+          .depth = 1, .checkpoint = -1 }
+    };
+    HistorySnapshot snap = { .nodes = nodes, .count = 3, .current = 2 };
+    CHECK(editLogSnapshot(&log, &snap.log) == 0);
+    CHECK(undoFileWrite(path, &st, hash_of(text), &snap) == 0);
+    editLogReleaseSnapshot(&snap.log);
+    editLogFree(&log);
+
+    // it comes back as saved, and the log reads the same at the same offsets
+    UndoFile u;
+    CHECK(undoFileOpen(path, file, &st, &u) == 0);
+    CHECK(u.count == 3 && u.current == 2);
+    CHECK(memcmp(u.nodes, nodes, sizeof(nodes)) == 0);
+    EditLog loaded;
+    editLogInit(&loaded);
+    editLogAttach(&loaded, u.log, u.log_len);
+    EditGroup g;
+    CHECK(editLogRead(&loaded, u.nodes[2].group, &g) == 0);
+    CHECK(g.count == 1 && g.ops[0].kind == OP_DELETE_TEXT && memcmp(g.ops[0].text, "int", 3) == 0);
+    editGroupFree(&g);
+
+    // appending goes on after the saved records
+    size_t off;
+    CHECK(editLogAppend(&loaded, &ops[0], 1, &off) == 0 && off == u.log_len);
+    CHECK(editLogRead(&loaded, off, &g) == 0 && g.ops[0].row == 1);
+    editGroupFree(&g);
+    editLogFree(&loaded);
+
+    // changes to the nodes stay in this process
+    u.nodes[0].redo_child = 2;
+    undoFileClose(&u);
+    CHECK(undoFileOpen(path, file, &st, &u) == 0 && u.nodes[0].redo_child == 1);
+    undoFileClose(&u);
+
+    // the same contents under a new mtime are found by hashing
+    struct stat touched = st;
+    touched.st_mtim.tv_sec += 10;
+    CHECK(undoFileOpen(path, file, &touched, &u) == 0);
+    undoFileClose(&u);
+
+    // other contents of the same size are not
+    CHECK(write_file(file, "int main(void) {\n    return 1;\n}") == 0);
+    CHECK(stat(file, &st) == 0);
+    CHECK(undoFileOpen(path, file, &st, &u) == -1);
+
+    unlink(file);
+    unlink(path);
+    CHECK(undoFileOpen(path, file, &st, &u) == -1);
+    return 0;
+}